@@ -3,7 +3,8 @@
  * @brief  ファイルディスクリプタクラス
  *
  * このクラスは、select()関数使用時のファイルディスクリプタ操作をまとめています。
- * 
+ * Linuxでは、epollによる監視（エポールモード）も選択できます。
+ *
  * @author  渡辺正勝
  *
  * 変更履歴<BR>
@@ -16,10 +17,17 @@
 #define CFileDescriptor_h
 
 #include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <list>
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define CFD_EPOLL	// epoll が使用可能
+#endif
+
 using namespace std;
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -30,8 +38,16 @@ class CFileDescriptor
 {
 public:
 
+	// 監視方式
+	typedef enum {
+				MODE_SELECT,	// select()（全環境）
+				MODE_EPOLL		// epoll（Linuxのみ。使用できなければ select()になる。）
+			} MODE;
+
 	// select()関数使用時、使用後に、下記領域を直接参照します。意味は自明。
 	// 尚、select()関数呼び出し前に、必ずrebuild()関数を呼び出してください。
+	// エポールモードでは、イベントが発生したファイルディスクリプタのみ
+	// setReady()関数で設定されます。（それ以外は常にクリアされた状態）
 
 	int		m_maxfd_plus1;
 
@@ -49,18 +65,92 @@ public:
 	, m_p_readfds(NULL)
 	, m_p_writefds(NULL)
 	, m_p_exceptfds(NULL)
+#ifdef CFD_EPOLL
+	, m_mode(MODE_EPOLL)
+#else
+	, m_mode(MODE_SELECT)
+#endif
+	, m_epfd(-1)
+	, m_nevents(0)
+	, m_bool_ready(false)
+	, m_bool_large_fd(false)
 	{
+		FD_ZERO(&m_readfds);
+		FD_ZERO(&m_writefds);
+		FD_ZERO(&m_exceptfds);
 		pthread_mutex_init(&m_mutex, NULL);
 	}
 
 	//  デストラクタ
 	virtual ~CFileDescriptor()
 	{
+		close();
 		pthread_mutex_destroy(&m_mutex);
 	}
 
+	// 監視方式の設定（open()前に設定すること）
+	int setMode(MODE mode)
+	{
+		if (m_epfd != (-1)) {
+			return(-1);
+		}
+		m_mode = mode;
+		return(0);
+	}
+
+	// FD_SETSIZE 以上のファイルディスクリプタの登録を許すか否か（エポールモードのみ）
+	// fd_set に設定できないので、getEvent()で取り出して個別に処理する場合に許すこと。
+	void setLargeFD(bool bool_enable)
+	{
+		m_bool_large_fd = bool_enable;
+	}
+
+	// エポールモードで動作中か否か
+	bool isEpoll() const
+	{
+		return(m_epfd != (-1));
+	}
+
+	// エポールのファイルディスクリプタ（エポールモードでなければ -1）
+	// イベントがあれば読み込み可になるので、他のエポールで監視できる。
+	int getEpollFD() const
+	{
+		return(m_epfd);
+	}
+
+	// 監視開始（スレッド起動時に呼び出す）
+	// エポールモードでは、既に登録済みのファイルディスクリプタも監視対象にする。
+	// epollが使用できない場合は select()で動作する。
+	void open()
+	{
+#ifdef CFD_EPOLL
+		if ((m_mode != MODE_EPOLL) || (m_epfd != (-1))) {
+			return;
+		}
+		pthread_mutex_lock(&m_mutex);
+		m_epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (m_epfd != (-1)) {
+			list<CControlBlock>::iterator iter;
+			for (iter = m_list.begin(); iter != m_list.end(); ++iter) {
+				control(iter->m_fd);
+			}
+		}
+		pthread_mutex_unlock(&m_mutex);
+#endif
+	}
+
+	// 監視終了（スレッド終了時に呼び出す）
+	void close()
+	{
+		if (m_epfd != (-1)) {
+			::close(m_epfd);
+			m_epfd = (-1);
+		}
+	}
+
 	// ファイルディスクリプタ追加
-	int append(int fd, bool bool_read, bool bool_write, bool bool_except=false)
+	// bool_large が真なら、setLargeFD()に関わらず FD_SETSIZE 以上も登録する。（エポールモードのみ）
+	int append(int fd, bool bool_read, bool bool_write, bool bool_except=false, bool bool_large=false)
 	{
 		if (fd < 0) {
 			return(-1);
@@ -68,11 +158,16 @@ public:
 		if (!(bool_read || bool_write || bool_except)) {
 			return(-1);
 		}
+		// select()は FD_SETSIZE 以上を扱えない。エポールモードも、許可されなければ扱わない。
+		if ((fd >= FD_SETSIZE) && ((m_mode == MODE_SELECT) || !(m_bool_large_fd || bool_large))) {
+			return(-1);
+		}
 		CControlBlock ControlBlock(fd, bool_read, bool_write, bool_except);
 		pthread_mutex_lock(&m_mutex);
 		m_list.push_back(ControlBlock);
+		int ret = control(fd);
 		pthread_mutex_unlock(&m_mutex);
-		return(0);
+		return(ret);
 	}
 
 	// ファイルディスクリプタ削除
@@ -94,6 +189,7 @@ public:
 				}
 			}
 		} while (bool_erase);
+		control(fd);
 		pthread_mutex_unlock(&m_mutex);
 		return(0);
 	}
@@ -112,6 +208,9 @@ public:
 		pthread_mutex_lock(&m_mutex);
 		list<CControlBlock>::iterator iter;
 		for (iter = m_list.begin(); iter != m_list.end(); ++iter) {
+			if (iter->m_fd >= FD_SETSIZE) {
+				continue;	// エポールが使用できず select()になった場合
+			}
 			m_maxfd_plus1 = (m_maxfd_plus1 >= (iter->m_fd+1)) ? m_maxfd_plus1: (iter->m_fd+1);
 			if (iter->m_bool_read) {
 				FD_SET(iter->m_fd, &m_readfds);
@@ -129,6 +228,93 @@ public:
 		pthread_mutex_unlock(&m_mutex);
 	}
 
+	// イベント待ち
+	// select()モードでは rebuild()してから select()を呼び出す。
+	// エポールモードでは epoll_wait()を呼び出す。結果は getEvent()で取り出す。
+	// p_timeout が NULL の場合は無期限に待つ。
+	// 返り値は select()、epoll_wait()と同じ。
+	int wait(struct timeval *p_timeout)
+	{
+#ifdef CFD_EPOLL
+		if (m_epfd != (-1)) {
+			int msec = (-1);
+			if (p_timeout) {
+				// 早く起きすぎないよう、ミリ秒未満は切り上げる。
+				msec = (p_timeout->tv_sec * 1000) + ((p_timeout->tv_usec + 999) / 1000);
+			}
+			m_nevents = epoll_wait(m_epfd, m_events, MAX_EVENTS, msec);
+			if (m_nevents < 0) {
+				int ret = m_nevents;
+				m_nevents = 0;
+				return(ret);
+			}
+			return(m_nevents);
+		}
+#endif
+		rebuild();
+		return(select(m_maxfd_plus1, m_p_readfds, m_p_writefds, m_p_exceptfds, p_timeout));
+	}
+
+	// エポールモードで、wait()で発生したイベントを取り出す。
+	// index は 0 から wait()の返り値未満まで。
+	int getEvent(int index, int *p_fd, bool *p_bool_read, bool *p_bool_write, bool *p_bool_except)
+	{
+#ifdef CFD_EPOLL
+		if ((index < 0) || (index >= m_nevents)) {
+			return(-1);
+		}
+		uint32_t events   = m_events[index].events;
+		uint64_t data     = m_events[index].data.u64;
+		uint32_t interest = static_cast<uint32_t>(data >> 32);
+		// エラーと切断は、select()と同様に登録された監視種別で通知する。
+		uint32_t error    = (events & (EPOLLERR | EPOLLHUP)) ? (EPOLLIN | EPOLLOUT) : 0;
+		*p_fd          = static_cast<int>(data & 0xffffffff);
+		*p_bool_read   = ((events | error) & interest & EPOLLIN)  != 0;
+		*p_bool_write  = ((events | error) & interest & EPOLLOUT) != 0;
+		*p_bool_except = ( events           & interest & EPOLLPRI) != 0;
+		return(0);
+#else
+		return(-1);
+#endif
+	}
+
+	// エポールモードで、イベントが発生したファイルディスクリプタを
+	// select()形式の領域（m_readfds等）に設定する。
+	int setReady(int fd, bool bool_read, bool bool_write, bool bool_except)
+	{
+		if ((fd < 0) || (fd >= FD_SETSIZE)) {
+			return(-1);
+		}
+		if (bool_read)		FD_SET(fd, &m_readfds);
+		if (bool_write)		FD_SET(fd, &m_writefds);
+		if (bool_except)	FD_SET(fd, &m_exceptfds);
+		m_bool_ready = (m_bool_ready || bool_read || bool_write || bool_except);
+		return(0);
+	}
+
+	// setReady()で設定されたものがあるか否か
+	bool isReady() const
+	{
+		return(m_bool_ready);
+	}
+
+	// setReady()で設定したものをクリアする。
+	// 全体をクリアせず、発生したイベント分だけクリアする。
+	void clearReady()
+	{
+#ifdef CFD_EPOLL
+		for (int i = 0; i < m_nevents; i++) {
+			int fd = static_cast<int>(m_events[i].data.u64 & 0xffffffff);
+			if (fd < FD_SETSIZE) {
+				FD_CLR(fd, &m_readfds);
+				FD_CLR(fd, &m_writefds);
+				FD_CLR(fd, &m_exceptfds);
+			}
+		}
+#endif
+		m_bool_ready = false;
+	}
+
 private:
 	class CControlBlock
 	{
@@ -153,11 +339,62 @@ private:
 		};
 	};
 
+	// エポールの監視対象を、リストの内容に合わせる。（m_mutex取得済みで呼び出す）
+	// 同じファイルディスクリプタが複数登録されている場合は、監視種別の和とする。
+	int control(int fd)
+	{
+#ifdef CFD_EPOLL
+		if (m_epfd == (-1)) {
+			return(0);
+		}
+		uint32_t interest = 0;
+		list<CControlBlock>::iterator iter;
+		for (iter = m_list.begin(); iter != m_list.end(); ++iter) {
+			if (iter->m_fd == fd) {
+				if (iter->m_bool_read)		interest |= EPOLLIN;
+				if (iter->m_bool_write)		interest |= EPOLLOUT;
+				if (iter->m_bool_except)	interest |= EPOLLPRI;
+			}
+		}
+		struct epoll_event event;
+		event.events   = interest;
+		event.data.u64 = (static_cast<uint64_t>(interest) << 32) | static_cast<uint32_t>(fd);
+		if (interest == 0) {
+			epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, &event);
+			return(0);
+		}
+		if (epoll_ctl(m_epfd, EPOLL_CTL_MOD, fd, &event) == 0) {
+			return(0);
+		}
+		if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &event) == 0) {
+			return(0);
+		}
+		return(-1);
+#else
+		return(0);
+#endif
+	}
+
 	//  ファイルディスクリプタ管理ブロックのリスト
 	list<CControlBlock>	m_list;
 
 	//  ミューテック（上記リストの排他）
 	pthread_mutex_t	m_mutex;
+
+	//  監視方式
+	MODE	m_mode;
+
+	//  エポール
+	enum { MAX_EVENTS = 64 };	// 一度に取り出すイベント数
+	int		m_epfd;
+#ifdef CFD_EPOLL
+	struct epoll_event	m_events[MAX_EVENTS];
+#endif
+	int		m_nevents;
+	bool	m_bool_ready;
+
+	//  FD_SETSIZE 以上の登録を許すか否か
+	bool	m_bool_large_fd;
 };
 
 #endif
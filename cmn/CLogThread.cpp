@@ -41,29 +41,68 @@ int CLogThread::onPreThreadCreate()
 
 int CLogThread::onMsg(CThreadMsg *p_msg)
 {
-	if (CLogThreadMsg* pLogThreadMsg = dynamic_cast<CLogThreadMsg*>(p_msg)) {
-		struct tm *ptm = localtime(&pLogThreadMsg->m_time.tv_sec);
-		if (m_nLine == 0) {
-			openFile(ptm);
+	if (CLogThreadMsg* pLogThreadMsg = msg_cast<CLogThreadMsg>(p_msg)) {
+		// formatLine()がファイルを開く（切り替える）ので、out()より先に呼ぶ。
+		string strLine = formatLine(pLogThreadMsg);
+		out() << strLine << endl;
+		if ((++m_nLine) == m_nMaxLine) {
+			closeFile();
+			m_nLine = 0;
 		}
-		out()	<< m_StrAid.Format(	"%04d.%02d.%02d %02d:%02d:%02d %06d ",
-									ptm->tm_year+1900,
-									ptm->tm_mon+1,
-									ptm->tm_mday,
-									ptm->tm_hour,
-									ptm->tm_min,
-									ptm->tm_sec,
-									pLogThreadMsg->m_time.tv_usec)
-				<< pLogThreadMsg->m_strMsg
-				<< endl;
+	}
+	return(ERR_OK);
+}
+
+// まとめて整形し、ファイル毎に１回だけ書き込む。
+// 行毎に endl（フラッシュ）しないので、書き込み回数が減る。
+int CLogThread::onMsgBatch(CThreadMsg **pp_msg, int num)
+{
+	string strBuf;
+	for (int i = 0; i < num; i++) {
+		CLogThreadMsg* pLogThreadMsg = msg_cast<CLogThreadMsg>(pp_msg[i]);
+		if (pLogThreadMsg == NULL) {
+			// ログメッセージ以外は順番を崩さないよう、書き込んでから渡す。
+			if (!strBuf.empty()) {
+				out() << strBuf << flush;
+				strBuf.clear();
+			}
+			dispatchMsg(pp_msg[i]);
+			continue;
+		}
+		strBuf += formatLine(pLogThreadMsg);
+		strBuf += '\n';
 		if ((++m_nLine) == m_nMaxLine) {
+			out() << strBuf << flush;
+			strBuf.clear();
 			closeFile();
 			m_nLine = 0;
 		}
 	}
+	if (!strBuf.empty()) {
+		out() << strBuf << flush;
+	}
 	return(ERR_OK);
 }
 
+// ログメッセージを１行に整形する。
+// ファイルの先頭行であれば、ファイルをオープンする。
+string CLogThread::formatLine(CLogThreadMsg* pLogThreadMsg)
+{
+	struct tm *ptm = localtime(&pLogThreadMsg->m_time.tv_sec);
+	if (m_nLine == 0) {
+		openFile(ptm);
+	}
+	return(m_StrAid.Format(	"%04d.%02d.%02d %02d:%02d:%02d %06d ",
+							ptm->tm_year+1900,
+							ptm->tm_mon+1,
+							ptm->tm_mday,
+							ptm->tm_hour,
+							ptm->tm_min,
+							ptm->tm_sec,
+							pLogThreadMsg->m_time.tv_usec)
+		   + pLogThreadMsg->m_strMsg);
+}
+
 // ログファイルのオープン処理
 // ファイル名には日付を加える。
 // 指定ファイル数を超えたら、古い順から削除する。
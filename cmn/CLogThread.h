@@ -58,7 +58,7 @@ using namespace std;
 ////////////////////////////////////////////////////////////////////////////////
 
 // ログメッセージ（ログスレッドに送る。）
-class CLogThreadMsg : public CThreadMsg
+class CLogThreadMsg : public CThreadMsgT<CLogThreadMsg>
 {
 public:
 	string		m_strMsg;	// メッセージ
@@ -141,10 +141,15 @@ public:
 protected:
 	virtual int onPreThreadCreate();
 	virtual int onMsg(CThreadMsg *p_msg);
+	// まとめて取り出したログメッセージは、まとめて書き込む。
+	virtual int onMsgBatch(CThreadMsg **pp_msg, int num);
 
 	virtual void openFile(struct tm *ptm);
 	virtual void closeFile();
 
+	// ログメッセージを１行に整形する。（必要ならファイルをオープンする）
+	string formatLine(CLogThreadMsg* pLogThreadMsg);
+
 	int		m_nLogThreadNo;
 	string	m_strDirPath;
 	string	m_strFilePrefix;
@@ -39,7 +39,7 @@
 	接続時にこのメッセージで通知します。
 */
 class CTcpListener;
-class CTcpListenerConnectMsg : public CThreadMsg
+class CTcpListenerConnectMsg : public CThreadMsgT<CTcpListenerConnectMsg>
 {
 public:
 	CTcpListener	*pTcpListener;	// 通知元リスナスレッド
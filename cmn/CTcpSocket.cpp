@@ -97,6 +97,24 @@ int CTcpSocket::Send(const void *vp_data, int data_len)
 	return(ret);
 }
 
+#if __cplusplus >= 201103L
+int CTcpSocket::Send(vector<char>&& vec_data)
+{
+	if (vec_data.empty()) {
+		return(ERR_PARAM);
+	}
+	return(emplaceMsg<CTcpSocketSendMsg>(std::move(vec_data)));
+}
+
+int CTcpSocket::Send(string&& str_data)
+{
+	if (str_data.empty()) {
+		return(ERR_PARAM);
+	}
+	return(emplaceMsg<CTcpSocketSendMsg>(std::move(str_data)));
+}
+#endif
+
 int CTcpSocket::onPreThreadCreate()
 {
 	if (m_type == EGSOCK_TYPE::SERVER) {
@@ -120,11 +138,18 @@ int CTcpSocket::onPreThreadCreate()
 
 int CTcpSocket::onThreadInitiate()
 {
+	if (m_pNoticeThread) {
+		m_pNoticeThread->addQueueListener(this);
+	}
 	return(openSocket());
 }
 
 void CTcpSocket::onThreadTerminate()
 {
+	if (m_pNoticeThread) {
+		m_pNoticeThread->removeQueueListener(this);
+	}
+	m_bool_recv_paused = false;
 	closeSocket();
 }
 
@@ -137,14 +162,14 @@ void CTcpSocket::onTimer(int timer_id)
 
 int CTcpSocket::onMsg(CThreadMsg *p_msg)
 {
-	if (CTcpSocketSendMsg* pTcpSocketSendMsg = dynamic_cast<CTcpSocketSendMsg*>(p_msg)) {
+	if (CTcpSocketSendMsg* pTcpSocketSendMsg = msg_cast<CTcpSocketSendMsg>(p_msg)) {
 		if (m_status == EGSOCK_STS::CONNECT) {
 			sendSocket(pTcpSocketSendMsg->p_data, pTcpSocketSendMsg->data_len);
 		} else {
 			onError(EGSOCK_ERR::SEND_DATA_WAS_LOST);
 		}
 	}
-	if (CTcpServerSetFdMsg* pTcpServerSetFdMsg = dynamic_cast<CTcpServerSetFdMsg*>(p_msg)) {
+	if (CTcpServerSetFdMsg* pTcpServerSetFdMsg = msg_cast<CTcpServerSetFdMsg>(p_msg)) {
 		closeSocket();
 		m_socketFD = pTcpServerSetFdMsg->socketFD;
 		openSocket();
@@ -167,6 +192,60 @@ int CTcpSocket::sendSocket(const char *p_data, int data_len)
 	return(n);
 }
 
+// 連続する送信メッセージは、まとめて送信する。（setSendBatching()を指定した場合）
+// それ以外のメッセージは、順番を崩さないよう送信してから振り分ける。
+int CTcpSocket::onMsgBatch(CThreadMsg **pp_msg, int num)
+{
+	if (!m_bool_send_batching) {
+		return(CThreadBase::onMsgBatch(pp_msg, num));
+	}
+	struct iovec iov[EGSOCK_CONFIG::MAX_IOV];
+	int iovcnt = 0;
+	for (int i = 0; i < num; i++) {
+		CTcpSocketSendMsg* pTcpSocketSendMsg = msg_cast<CTcpSocketSendMsg>(pp_msg[i]);
+		if (pTcpSocketSendMsg &&
+			(pTcpSocketSendMsg->p_data) &&
+			(m_status == EGSOCK_STS::CONNECT)) {
+			if (iovcnt == EGSOCK_CONFIG::MAX_IOV) {
+				sendSocketV(iov, iovcnt);
+				iovcnt = 0;
+			}
+			iov[iovcnt].iov_base = pTcpSocketSendMsg->p_data;
+			iov[iovcnt].iov_len  = pTcpSocketSendMsg->data_len;
+			iovcnt++;
+			continue;
+		}
+		if (iovcnt) {
+			sendSocketV(iov, iovcnt);
+			iovcnt = 0;
+		}
+		dispatchMsg(pp_msg[i]);
+	}
+	if (iovcnt) {
+		sendSocketV(iov, iovcnt);
+	}
+	return(ERR_OK);
+}
+
+// ::writev()のラッパ（エラー処理等の統一のため）
+// １つだけなら sendSocket()で送信する。
+int CTcpSocket::sendSocketV(const struct iovec *p_iov, int iovcnt)
+{
+	if (iovcnt == 1) {
+		return(sendSocket(static_cast<const char*>(p_iov[0].iov_base), static_cast<int>(p_iov[0].iov_len)));
+	}
+	ssize_t data_len = 0;
+	for (int i = 0; i < iovcnt; i++) {
+		data_len += p_iov[i].iov_len;
+	}
+	ssize_t n = writev(m_socketFD, p_iov, iovcnt);
+	if (n != data_len) {
+		// 一部だけ送信できた場合は errno が設定されない。
+		onError(EGSOCK_ERR::API_CALL, (n < 0) ? errno : 0);
+	}
+	return(static_cast<int>(n));
+}
+
 int CTcpSocket::onEvent(fd_set *p_readfds, fd_set *p_writefds, fd_set *p_exceptfds)
 {
 	if (m_status == EGSOCK_STS::CONNECT) {
@@ -233,7 +312,7 @@ again:
 					return(-1);
 				}
 				if (!error) {
-					appendFD(m_socketFD, true, false);
+					appendSocketFD();
 					changeStatus(EGSOCK_STS::CONNECT);
 					// cout << "connect completed" << endl;
 				} else {
@@ -247,6 +326,22 @@ again:
 	return(ERR_OK);
 }
 
+int CTcpSocket::onQueueWatermark(CThreadBase *p_thread, bool bool_high)
+{
+	if ((p_thread != m_pNoticeThread) || (bool_high == m_bool_recv_paused)) {
+		return(ERR_OK);
+	}
+	m_bool_recv_paused = bool_high;
+	if ((m_status == EGSOCK_STS::CONNECT) && (m_socketFD != (-1))) {
+		if (bool_high) {
+			removeFD(m_socketFD);
+		} else {
+			appendFD(m_socketFD, true, false);
+		}
+	}
+	return(ERR_OK);
+}
+
 int CTcpSocket::onReceive(const char *p_data , int data_len, int *p_accept_len)
 {
 	if (m_pNoticeThread) {
@@ -266,6 +361,9 @@ int CTcpSocket::onChangeStatus(int new_status, int pre_status)
 		pTcpSocketChangeStatusMsg->pTcpSocket = this;
 		pTcpSocketChangeStatusMsg->new_status = new_status;
 		pTcpSocketChangeStatusMsg->pre_status = pre_status;
+		if (m_bool_conflate_status) {
+			pTcpSocketChangeStatusMsg->setConflateKey(reinterpret_cast<unsigned long>(this));
+		}
 		m_pNoticeThread->postMsg(pTcpSocketChangeStatusMsg);
 	} else {
 		cout << "change status : " << pre_status << " to " << new_status << endl;
@@ -304,7 +402,7 @@ int CTcpSocket::openSocket()
 int CTcpSocket::openSocketServer()
 {
 	if (m_socketFD != (-1)) {
-		appendFD(m_socketFD, true, false);
+		appendSocketFD();
 		changeStatus(EGSOCK_STS::CONNECT);
 	}
 	return(ERR_OK);
@@ -351,7 +449,7 @@ int CTcpSocket::openSocketClient()
 			closeSocket(m_connect_T2);
 			return(-1);
 		}
-		appendFD(m_socketFD, true, false);
+		appendSocketFD();
 		changeStatus(EGSOCK_STS::CONNECT);
 	} else {
 		if (errno != EINPROGRESS) {
@@ -385,6 +483,14 @@ int CTcpSocket::closeSocket(int timer)
 	return(ERR_OK);
 }
 
+int CTcpSocket::appendSocketFD()
+{
+	if (m_bool_recv_paused) {
+		return(ERR_OK);	// onQueueWatermark()で再開する。
+	}
+	return(appendFD(m_socketFD, true, false));
+}
+
 int CTcpSocket::changeStatus(int new_status)
 {
 	// EGSOCK_STS::DISCONNECT で呼び出すのは closeSocket() のみ！
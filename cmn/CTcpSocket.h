@@ -17,6 +17,7 @@
 
 #include "CThreadBase.h"
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 
@@ -55,7 +56,26 @@
 			virtual void onThreadTerminate();
 			virtual void onTimer();
 			virtual int  onMsg();
+			virtual int  onMsgBatch();
 			virtual int  onEvent();
+			virtual int  onQueueWatermark();
+
+	５．setSendBatching()を指定すると、まとめて取り出した送信メッセージは、
+		onMsgBatch()で writev()により一度に送信します。（sendSocketV()）
+		送信メッセージが１つだけの場合は sendSocket()で送信します。
+		指定しない場合（デフォルト）は、従来どおり onMsg()で１つずつ送信します。
+		送信メッセージを onMsg()のオーバーライドで加工する派生クラスは、
+		指定しないでください。
+
+	６．通知先スレッドのキューに水位（CThreadBase::setQueueWatermark()）を
+		設定すると、通知先のキューが高水位以上の間はソケットからの受信を止めます。
+		低水位以下に戻ると受信を再開します。（その間はカーネルのバッファに溜まり、
+		ＴＣＰのフロー制御で送信側が待たされます）
+
+	７．setStatusConflation()を指定すると、状態変化メッセージはソケット毎に
+		まとめられます。（CThreadMsg::setConflateKey()）
+		通知先が取り出す前に状態が何度変わっても、最新の状態だけが通知されます。
+		pre_status は、まとめた最初のメッセージの変化前の状態です。
 */
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -63,6 +83,7 @@
 ////////////////////////////////////////////////////////////////////////////////
 namespace EGSOCK_CONFIG {
 	const static int MAX_BUF_LEN	= 65535;	// 受信バッファ長（ウィンドウ・サイズと同じ！）
+	const static int MAX_IOV		= 64;		// 一度に送信する最大メッセージ数（writev）
 
 	// 以下、クライアント側で使用
 	const static int TIMER_ID	= INT_MAX - 1;	// 接続処理に使用するタイマ
@@ -108,7 +129,7 @@ namespace EGSOCK_ERR {
 */
 
 // 送信メッセージ（要求元 -> ＴＣＰソケットクラス）
-class CTcpSocketSendMsg : public CThreadMsg
+class CTcpSocketSendMsg : public CThreadMsgT<CTcpSocketSendMsg>
 {
 public:
 	int		data_len;
@@ -117,6 +138,7 @@ public:
 	CTcpSocketSendMsg(int _data_len=0, const void *_vp_data=NULL)
 	: data_len(_data_len)
 	, p_data(NULL)
+	, m_bool_moved(false)
 	{
 		if (data_len > 0) {
 			p_data = new char[data_len];
@@ -125,17 +147,45 @@ public:
 			}
 		}
 	};
+#if __cplusplus >= 201103L
+	// バッファをムーブで受け取る（コピーしない）
+	explicit CTcpSocketSendMsg(vector<char>&& _vec_data)
+	: data_len(static_cast<int>(_vec_data.size()))
+	, p_data(NULL)
+	, m_bool_moved(true)
+	, m_vec_data(std::move(_vec_data))
+	{
+		if (data_len > 0) {
+			p_data = m_vec_data.data();
+		}
+	};
+	explicit CTcpSocketSendMsg(string&& _str_data)
+	: data_len(static_cast<int>(_str_data.size()))
+	, p_data(NULL)
+	, m_bool_moved(true)
+	, m_str_data(std::move(_str_data))
+	{
+		if (data_len > 0) {
+			p_data = &m_str_data[0];
+		}
+	};
+#endif
 	virtual ~CTcpSocketSendMsg()
 	{
-		if (p_data) {
+		if (p_data && !m_bool_moved) {
 			delete [] p_data;
 		}
 	};
+
+private:
+	bool			m_bool_moved;	// ムーブで受け取ったバッファ（下記）を使用中
+	vector<char>	m_vec_data;
+	string			m_str_data;
 };
 
 // ファイルディスクリプタ設定メッセージ（要求元 -> ＴＣＰソケットクラス）
 // クライアント側で使用
-class CTcpServerSetFdMsg : public CThreadMsg
+class CTcpServerSetFdMsg : public CThreadMsgT<CTcpServerSetFdMsg>
 {
 public:
 	int socketFD;
@@ -161,7 +211,7 @@ public:
 };
 
 // 受信メッセージ（ＴＣＰソケットクラス -> 通知先）
-class CTcpSocketReceiveMsg : public CTcpSocketMsg
+class CTcpSocketReceiveMsg : public CThreadMsgT<CTcpSocketReceiveMsg, CTcpSocketMsg>
 {
 public:
 	int		data_len;
@@ -187,7 +237,7 @@ public:
 };
 
 // 状態変化メッセージ（ＴＣＰソケットクラス -> 通知先）
-class CTcpSocketChangeStatusMsg : public CTcpSocketMsg
+class CTcpSocketChangeStatusMsg : public CThreadMsgT<CTcpSocketChangeStatusMsg, CTcpSocketMsg>
 {
 public:
 	int	new_status;
@@ -198,10 +248,16 @@ public:
 	, pre_status(EGSOCK_STS::DISCONNECT)
 	{};
 	virtual ~CTcpSocketChangeStatusMsg() {};
+
+	// まとめられた時は、元の変化前の状態を引き継ぐ。
+	virtual void onConflate(CThreadMsg *p_old)
+	{
+		pre_status = static_cast<CTcpSocketChangeStatusMsg*>(p_old)->pre_status;
+	};
 };
 
 // エラーメッセージ（ＴＣＰソケットクラス -> 通知先）
-class CTcpSocketErrorMsg : public CTcpSocketMsg
+class CTcpSocketErrorMsg : public CThreadMsgT<CTcpSocketErrorMsg, CTcpSocketMsg>
 {
 public:
 	int	error;
@@ -236,6 +292,9 @@ public:
 	, m_connect_T1(0)
 	, m_connect_T2(0)
 	, m_flags(0)
+	, m_bool_recv_paused(false)
+	, m_bool_conflate_status(false)
+	, m_bool_send_batching(false)
 	{
 		pthread_mutex_init(&m_mutex, NULL);
 	};
@@ -253,6 +312,9 @@ public:
 	, m_connect_T1(0)
 	, m_connect_T2(0)
 	, m_flags(0)
+	, m_bool_recv_paused(false)
+	, m_bool_conflate_status(false)
+	, m_bool_send_batching(false)
 	{
 		pthread_mutex_init(&m_mutex, NULL);
 	};
@@ -273,6 +335,9 @@ public:
 	, m_connect_T1(connect_T1)
 	, m_connect_T2(connect_T2)
 	, m_flags(0)
+	, m_bool_recv_paused(false)
+	, m_bool_conflate_status(false)
+	, m_bool_send_batching(false)
 	{
 		pthread_mutex_init(&m_mutex, NULL);
 	};
@@ -319,8 +384,41 @@ public:
 		return(ERR_OK);
 	};
 
+	/*
+		状態変化メッセージをまとめるか否かを設定する。
+		スレッド起動前に設定してください。
+	*/
+	int setStatusConflation(bool bool_conflate)
+	{
+		// 起動前か？
+		if (get_pthread() != 0) {
+			return(ERR_CONTEXT);
+		}
+		m_bool_conflate_status = bool_conflate;
+		return(ERR_OK);
+	};
+
+	/*
+		連続する送信メッセージを writev()でまとめて送信するか否かを設定する。
+		スレッド起動前に設定してください。
+	*/
+	int setSendBatching(bool bool_batching)
+	{
+		// 起動前か？
+		if (get_pthread() != 0) {
+			return(ERR_CONTEXT);
+		}
+		m_bool_send_batching = bool_batching;
+		return(ERR_OK);
+	};
+
 	// データ送信要求
 	virtual int Send(const void *vp_data, int data_len);
+#if __cplusplus >= 201103L
+	// データ送信要求（バッファをムーブで渡す。コピーしない）
+	int Send(vector<char>&& vec_data);
+	int Send(string&& str_data);
+#endif
 
 	// 状態問い合わせ
 	int getStatus()
@@ -346,7 +444,13 @@ protected:
 	*/
 	virtual void onTimer(int timer_id);
 	virtual int onMsg(CThreadMsg *p_msg);
+	virtual int onMsgBatch(CThreadMsg **pp_msg, int num);
 	virtual int onEvent(fd_set *p_readfds, fd_set *p_writefds, fd_set *p_exceptfds);
+	/*
+		通知先スレッドのキューが高水位以上になると受信を止め、
+		低水位以下に戻ると受信を再開します。
+	*/
+	virtual int onQueueWatermark(CThreadBase *p_thread, bool bool_high);
 	/*
 		onReceive()関数の *p_accept_len について！
 
@@ -382,8 +486,10 @@ protected:
 	int openSocketClient();
 	int closeSocket(int timer=0);
 	int changeStatus(int new_status);
+	int appendSocketFD();	// 受信を監視する（受信を止めている間は何もしない）
 
 	virtual int sendSocket(const char *p_data, int data_len);
+	virtual int sendSocketV(const struct iovec *p_iov, int iovcnt);
 
 	int		m_type;
 	int		m_socketFD;
@@ -406,6 +512,10 @@ private:
 	// 以下、クライアント側で使用
 	int		m_flags;
 
+	bool	m_bool_recv_paused;	// 通知先のキューが高水位なので受信を止めている
+	bool	m_bool_conflate_status;	// 状態変化メッセージをまとめる
+	bool	m_bool_send_batching;	// 送信メッセージをまとめて送信する
+
 };
 
 #endif
@@ -4,8 +4,11 @@
  *
  * このファイルは、スレッドベースクラスと、その構成要素である下記クラスの実装です。
  * 
+ * ・スレッドメッセージプールクラス<BR>
  * ・スレッドキュークラス<BR>
+ * ・スレッド通知クラス<BR>
  * ・タイマ制御ブロックリストクラス<BR>
+ * ・フューチャの共有状態クラス<BR>
  * 
  * @author  渡辺正勝
  *
@@ -21,440 +24,3005 @@
 #include <iostream>	// デバッグで使う。
 #include <pthread.h>
 #include <exception>
+#include <new>
 #include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
 #include "CThreadBase.h"
 
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#define CTB_EVENTFD	// eventfd が使用可能
+#define CTB_TIMERFD	// timerfd が使用可能
+#define CTB_COND_MONOTONIC	// 条件変数を CLOCK_MONOTONIC で待てる
+#endif
+
+#if defined(CFD_EPOLL) && defined(CTB_EVENTFD) && defined(CTB_TIMERFD)
+#define CTB_ACTOR	// アクタスケジューラが使用可能
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
-// スレッドキュークラス
+// スレッドメッセージプールクラス
 ////////////////////////////////////////////////////////////////////////////////
 
-// コンストラクタ
-CThreadQueue::CThreadQueue()
+// スレッド毎の空きリスト
+// calloc()で確保するので、メンバは全てPODにすること。
+class CThreadMsgPool::CCache
 {
-	pthread_mutex_init(&m_mutex, NULL);
-}
+public:
+	void*				m_p_free[NUM_CLASS];	// 空きリスト（サイズ区分毎）
+	int					m_num_free[NUM_CLASS];	// 空きリストの個数
+	unsigned long long	m_hit;					// 空きリストから確保した数
+	unsigned long long	m_miss;					// malloc()で確保した数
+	int					m_node;					// 置き場のノード番号
+	CCache*				m_p_next;				// 全スレッドのリストの次
 
-// デストラクタ
-CThreadQueue::~CThreadQueue()
+	static __thread CCache*	t_p_cache;			// 自スレッドの空きリスト
+	static __thread bool	t_bool_destroyed;	// 自スレッドの空きリストは破棄済み
+
+	// 以下は g_mutex で排他する。（g_hit、g_miss は排他なしでも加算する）
+	static pthread_mutex_t	g_mutex;
+	static pthread_once_t	g_once;
+	static pthread_key_t	g_key;
+	static CCache*			g_p_list;				// 全スレッドのリスト
+	static void*			g_p_depot[MAX_NODE][NUM_CLASS];		// 置き場（BATCH個のまとまりのリスト）
+	static int				g_num_depot[MAX_NODE][NUM_CLASS];	// 置き場のまとまりの数
+	static unsigned long long	g_hit;				// 終了したスレッド等の分
+	static unsigned long long	g_miss;				// 終了したスレッド等の分
+};
+
+__thread CThreadMsgPool::CCache*	CThreadMsgPool::CCache::t_p_cache = NULL;
+__thread bool						CThreadMsgPool::CCache::t_bool_destroyed = false;
+pthread_mutex_t						CThreadMsgPool::CCache::g_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_once_t						CThreadMsgPool::CCache::g_once = PTHREAD_ONCE_INIT;
+pthread_key_t						CThreadMsgPool::CCache::g_key;
+CThreadMsgPool::CCache*				CThreadMsgPool::CCache::g_p_list = NULL;
+void*								CThreadMsgPool::CCache::g_p_depot[MAX_NODE][NUM_CLASS];
+int									CThreadMsgPool::CCache::g_num_depot[MAX_NODE][NUM_CLASS];
+unsigned long long					CThreadMsgPool::CCache::g_hit = 0;
+unsigned long long					CThreadMsgPool::CCache::g_miss = 0;
+
+// 空き領域の先頭２ワードを使って繋ぐ。（ALIGN は２ワード以上）
+static inline void*& nextBlock(void *p) { return(static_cast<void**>(p)[0]); }
+static inline void*& nextBatch(void *p) { return(static_cast<void**>(p)[1]); }
+
+// 自スレッドだけが更新し、他のスレッドは getStats()で読むだけのカウンタ
+static inline void countUp(unsigned long long *p_count)
 {
-	removeAll();
-	pthread_mutex_destroy(&m_mutex);
+	__atomic_store_n(p_count, *p_count + 1, __ATOMIC_RELAXED);
 }
 
-// スレッドメッセージのポインタを登録する。
-int CThreadQueue::put(CThreadMsg *p_msg, bool bool_front)
+// 繋がった領域を全て解放する。
+static void freeChain(void *p)
 {
-	int ret = 0;
-	pthread_mutex_lock(&m_mutex);
-	if (bool_front) {
-		m_dq_p_msg.push_front(p_msg);
-	} else {
-		m_dq_p_msg.push_back(p_msg);
+	while (p) {
+		void *p_next = nextBlock(p);
+		free(p);
+		p = p_next;
 	}
-	pthread_mutex_unlock(&m_mutex);
-	return(ret);
 }
 
-// スレッドメッセージのポインタを取り出す。
-int CThreadQueue::get(CThreadMsg **pp_msg)
+// 領域を確保する。
+void* CThreadMsgPool::allocate(size_t size)
 {
-	int ret = 0;
-	pthread_mutex_lock(&m_mutex);
-	if (m_dq_p_msg.empty()) {
-		*pp_msg = NULL;
-		ret = (-1);
+	size_t index = (size > 0) ? ((size - 1) / ALIGN) : 0;
+	CCache *p_cache = getCache();
+	if (index < NUM_CLASS) {
+		if (p_cache) {
+			if (p_cache->m_p_free[index] == NULL) {
+				refill(p_cache, index);
+			}
+			void *p = p_cache->m_p_free[index];
+			if (p) {
+				p_cache->m_p_free[index] = nextBlock(p);
+				p_cache->m_num_free[index]--;
+				countUp(&p_cache->m_hit);
+				return(p);
+			}
+		}
+		// 後で空きリストに返せるよう、サイズ区分の大きさで確保する。
+		size = (index + 1) * ALIGN;
+	}
+	if (p_cache) {
+		countUp(&p_cache->m_miss);
 	} else {
-		*pp_msg = m_dq_p_msg.front();
-		m_dq_p_msg.pop_front();
+		__atomic_add_fetch(&CCache::g_miss, 1, __ATOMIC_RELAXED);
 	}
-	pthread_mutex_unlock(&m_mutex);
-	return(ret);
-}
-
-// キューイングされている全てのメッセージを削除します。
-void CThreadQueue::removeAll()
-{
-	pthread_mutex_lock(&m_mutex);
-	while (!m_dq_p_msg.empty()) {
-		delete m_dq_p_msg.front();
-		m_dq_p_msg.pop_front();
+	void *p = malloc(size);
+	if (p == NULL) {
+		throw bad_alloc();
 	}
-	pthread_mutex_unlock(&m_mutex);
-	return;
+	return(p);
 }
 
-// スレッドキューが空か否かを返す。
-bool CThreadQueue::empty()
+// 領域を解放する。
+void CThreadMsgPool::deallocate(void *p, size_t size)
 {
-	bool bool_ret = false;
-	pthread_mutex_lock(&m_mutex);
-	if (m_dq_p_msg.empty()) {
-		bool_ret = true;
+	if (p == NULL) {
+		return;
 	}
-	pthread_mutex_unlock(&m_mutex);
-	return(bool_ret);
+	size_t index = (size > 0) ? ((size - 1) / ALIGN) : 0;
+	CCache *p_cache;
+	if ((index >= NUM_CLASS) || ((p_cache = getCache()) == NULL)) {
+		free(p);
+		return;
+	}
+	if (p_cache->m_num_free[index] >= LOCAL_MAX) {
+		// 置き場も一杯なら、まとめて返しても解放するだけなので、すぐに解放する。
+		if (__atomic_load_n(&CCache::g_num_depot[p_cache->m_node][index], __ATOMIC_RELAXED) >= DEPOT_MAX) {
+			free(p);
+			return;
+		}
+		release(p_cache, index);
+	}
+	nextBlock(p) = p_cache->m_p_free[index];
+	p_cache->m_p_free[index] = p;
+	p_cache->m_num_free[index]++;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// タイマ制御ブロックリストクラス
-////////////////////////////////////////////////////////////////////////////////
-
-// コンストラクタ
-CTimerCBList::CTimerCBList()
+// サイズの分からない領域を解放する。
+void CThreadMsgPool::discard(void *p)
 {
-	pthread_mutex_init(&m_mutex, NULL);
+	free(p);	// 領域は全て malloc()で確保している。
 }
 
-// デストラクタ
-CTimerCBList::~CTimerCBList()
+// 統計情報を取得する。
+void CThreadMsgPool::getStats(STATS *p_stats)
 {
-	pthread_mutex_destroy(&m_mutex);
+	if (p_stats == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&CCache::g_mutex);
+	p_stats->hit  = __atomic_load_n(&CCache::g_hit,  __ATOMIC_RELAXED);
+	p_stats->miss = __atomic_load_n(&CCache::g_miss, __ATOMIC_RELAXED);
+	for (CCache *p_cache = CCache::g_p_list; p_cache; p_cache = p_cache->m_p_next) {
+		p_stats->hit  += __atomic_load_n(&p_cache->m_hit,  __ATOMIC_RELAXED);
+		p_stats->miss += __atomic_load_n(&p_cache->m_miss, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&CCache::g_mutex);
 }
 
-// タイマ制御ブロックを作り、タイムアウト順にリストに登録する。
-int CTimerCBList::set(int msec_elapsed_time, int timer_id, int msec_period)
+// 自スレッドの置き場のノード番号を設定する。
+int CThreadMsgPool::setNode(int node)
 {
-	if (msec_elapsed_time <= 0)	{	return(CThreadBase::ERR_PARAM);	}
-	if (timer_id < 0)			{	return(CThreadBase::ERR_PARAM);	}
-	if (msec_period < 0)		{	return(CThreadBase::ERR_PARAM);	}
-	CTimerCB TimerCB(msec_elapsed_time, timer_id, msec_period);
-	return(set(TimerCB));
+	if ((node < 0) || (node >= MAX_NODE)) {
+		return(-1);
+	}
+	CCache *p_cache = getCache();
+	if (p_cache == NULL) {
+		return(-1);
+	}
+	p_cache->m_node = node;
+	return(0);
 }
 
-// タイマ制御ブロックを、タイムアウト順にリストに登録する。
-int CTimerCBList::set(CTimerCB &rTimerCB)
+// 自スレッドの空きリストを返す。（初回は作成する）
+// スレッド終了処理中で既に破棄した場合は NULL を返す。
+CThreadMsgPool::CCache* CThreadMsgPool::getCache()
 {
-	pthread_mutex_lock(&m_mutex);
-	list<CTimerCB>::iterator iter;
-	for (iter = m_list_TCB.begin(); iter != m_list_TCB.end(); ++iter) {
-		if (rTimerCB < (*iter)) {
-			break;
-		}
+	CCache *p_cache = CCache::t_p_cache;
+	if (p_cache || CCache::t_bool_destroyed) {
+		return(p_cache);
 	}
-	m_list_TCB.insert(iter, rTimerCB);
-	pthread_mutex_unlock(&m_mutex);
-	return(CThreadBase::ERR_OK);
+	pthread_once(&CCache::g_once, createKey);
+	p_cache = static_cast<CCache*>(calloc(1, sizeof(CCache)));
+	if (p_cache == NULL) {
+		return(NULL);
+	}
+	pthread_mutex_lock(&CCache::g_mutex);
+	p_cache->m_p_next = CCache::g_p_list;
+	CCache::g_p_list = p_cache;
+	pthread_mutex_unlock(&CCache::g_mutex);
+	pthread_setspecific(CCache::g_key, p_cache);
+	CCache::t_p_cache = p_cache;
+	return(p_cache);
 }
 
-// リストからタイマ制御ブロックを削除する。
-int CTimerCBList::cancel(int timer_id)
+// スレッド終了時に、空きリストを破棄する。
+void CThreadMsgPool::destroyCache(void *vp)
 {
-	// timer_id が (-1)であれば全キャンセル
-	if (timer_id < (-1)) {
-		return(CThreadBase::ERR_PARAM);
+	CCache *p_cache = static_cast<CCache*>(vp);
+	for (int index = 0; index < NUM_CLASS; index++) {
+		freeChain(p_cache->m_p_free[index]);
 	}
-	pthread_mutex_lock(&m_mutex);
-
-	list<CTimerCB>::iterator iter;
-	for (iter = m_list_TCB.begin(); iter != m_list_TCB.end(); ++iter) {
-		if ((timer_id == (-1)) || (iter->m_timer_id == timer_id)) {
-			iter->m_remove = true;
-		}
+	pthread_mutex_lock(&CCache::g_mutex);
+	CCache **pp = &CCache::g_p_list;
+	while (*pp && (*pp != p_cache)) {
+		pp = &(*pp)->m_p_next;
+	}
+	if (*pp) {
+		*pp = p_cache->m_p_next;
 	}
-	m_list_TCB.remove_if(CTimerCB::is_remove);
+	__atomic_add_fetch(&CCache::g_hit,  p_cache->m_hit,  __ATOMIC_RELAXED);
+	__atomic_add_fetch(&CCache::g_miss, p_cache->m_miss, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&CCache::g_mutex);
+	free(p_cache);
+	CCache::t_p_cache = NULL;
+	CCache::t_bool_destroyed = true;
+}
 
-	pthread_mutex_unlock(&m_mutex);
-	return(CThreadBase::ERR_OK);
+// スレッド終了を検出するためのキーを作成する。
+void CThreadMsgPool::createKey()
+{
+	pthread_key_create(&CCache::g_key, destroyCache);
 }
 
-// リスト先頭のタイマ制御ブロックがタイムアウトしているか否かを返す。
-bool CTimerCBList::timeout(int *p_timer_id)
+// 置き場から BATCH 個補充する。（空きリストが空の時に呼び出す）
+void CThreadMsgPool::refill(CCache *p_cache, int index)
 {
-	bool bool_ret = false;
-	CTimerCB TimerCB;
-	pthread_mutex_lock(&m_mutex);
-	if (!m_list_TCB.empty()) {
-		CTimeVal current_time(CTimeVal::CURRENT);
-		if (m_list_TCB.begin()->m_target_time <= current_time) {
-			TimerCB = m_list_TCB.front();
-			m_list_TCB.pop_front();
-			if (p_timer_id) {
-				*p_timer_id = TimerCB.m_timer_id;
-			}
-			bool_ret = true;
-		}
+	// 置き場が空なら排他を取らずに戻る。（送信が受信を上回っている間は、毎回ここに来る）
+	int node = p_cache->m_node;
+	if (__atomic_load_n(&CCache::g_num_depot[node][index], __ATOMIC_RELAXED) == 0) {
+		return;
 	}
-	pthread_mutex_unlock(&m_mutex);
-	if (TimerCB.m_msec_period > 0) {
-		TimerCB.m_target_time.addMS(TimerCB.m_msec_period);
-		set(TimerCB);
+	pthread_mutex_lock(&CCache::g_mutex);
+	void *p_batch = CCache::g_p_depot[node][index];
+	if (p_batch) {
+		CCache::g_p_depot[node][index] = nextBatch(p_batch);
+		__atomic_store_n(&CCache::g_num_depot[node][index], CCache::g_num_depot[node][index] - 1, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&CCache::g_mutex);
+	if (p_batch) {
+		p_cache->m_p_free[index]   = p_batch;
+		p_cache->m_num_free[index] = BATCH;
 	}
-	return(bool_ret);
 }
 
-// 次にタイムアウトする目標時刻を返す。
-CTimeVal CTimerCBList::next_time()
+// 空きリストの先頭から BATCH 個を置き場に返す。
+// 置き場が一杯の場合は解放する。
+void CThreadMsgPool::release(CCache *p_cache, int index)
 {
-	CTimeVal target_time(CTimeVal::CLEAR);
-	pthread_mutex_lock(&m_mutex);
-	if (!m_list_TCB.empty()) {
-		target_time = m_list_TCB.begin()->m_target_time;
+	void *p_batch = p_cache->m_p_free[index];
+	void *p_last  = p_batch;
+	for (int i = 1; i < BATCH; i++) {
+		p_last = nextBlock(p_last);
 	}
-	pthread_mutex_unlock(&m_mutex);
-	return(target_time);
+	p_cache->m_p_free[index] = nextBlock(p_last);
+	p_cache->m_num_free[index] -= BATCH;
+	nextBlock(p_last) = NULL;
+
+	int node = p_cache->m_node;
+	pthread_mutex_lock(&CCache::g_mutex);
+	if (CCache::g_num_depot[node][index] < DEPOT_MAX) {
+		nextBatch(p_batch) = CCache::g_p_depot[node][index];
+		CCache::g_p_depot[node][index] = p_batch;
+		__atomic_store_n(&CCache::g_num_depot[node][index], CCache::g_num_depot[node][index] + 1, __ATOMIC_RELAXED);
+		p_batch = NULL;
+	}
+	pthread_mutex_unlock(&CCache::g_mutex);
+	freeChain(p_batch);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// スレッドベースクラス（キュー、タイマ付き）
+// スレッドメッセージベースクラス
 ////////////////////////////////////////////////////////////////////////////////
 
-// 例外のハンドラ
-void callback_unexpected()
-{
-	cerr << "callback unexpected handler." << endl;
-	cerr << "this thread = " << pthread_self() << endl;
-}
+int CThreadMsg::g_msg_type_count = MSG_TYPE_NONE;
 
-// スタートルーチン
-void* start_routine(void* arg)
+// 新しい型IDを払い出す。
+int CThreadMsg::newMsgType()
 {
-	set_unexpected(callback_unexpected);
-	return((reinterpret_cast<CThreadBase*>(arg))->run());
+	return(__atomic_add_fetch(&g_msg_type_count, 1, __ATOMIC_RELAXED));
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// スレッドキュークラス
+////////////////////////////////////////////////////////////////////////////////
+
 // コンストラクタ
-CThreadBase::CThreadBase()
-: m_pthread(0)
-, m_pthread_copy(0)
-, m_bool_shutdown(false)
-, m_thread_no(-1)
-, m_parent(NULL)
-, m_p_pthread_attr(NULL)
+CThreadQueue::CThreadQueue(MODE mode)
+: m_mode(mode)
+, m_lanes(0)
+, m_drain(DRAIN_STRICT)
+, m_rr_lane(0)
+, m_rr_credit(0)
+, m_capacity(0)
+, m_full(FULL_BLOCK)
+, m_high(0)
+, m_low(0)
+, m_p_watermark(NULL)
+, m_vp_watermark_arg(NULL)
+, m_bool_count(false)
+, m_count(0)
+, m_bool_peak(false)
+, m_peak(0)
+, m_high_state(0)
+, m_dropped(0)
+, m_blocked(0)
+, m_bool_closed(false)
+, m_conflated(0)
 {
 	pthread_mutex_init(&m_mutex, NULL);
-	assert(pipe(m_pipe)==0);
+	pthread_mutex_init(&m_conflate_mutex, NULL);
+	pthread_mutex_init(&m_space_mutex, NULL);
+	pthread_cond_init(&m_space_cond, NULL);
+	setLanes(LANE_NORMAL + 1);
 }
 
 // デストラクタ
-CThreadBase::~CThreadBase()
+CThreadQueue::~CThreadQueue()
 {
-	stop();	// もし生きてたら止める。
-	setInstanceInfo(STS_DESTROY);
-	close(m_pipe[PIPE_READ]);
-	close(m_pipe[PIPE_WRITE]);
+	removeAll();
+	pthread_cond_destroy(&m_space_cond);
+	pthread_mutex_destroy(&m_space_mutex);
+	pthread_mutex_destroy(&m_conflate_mutex);
 	pthread_mutex_destroy(&m_mutex);
 }
 
-// スレッド属性を設定する。
-int CThreadBase::setAttribute(const int thread_no, CThreadBase* parent, pthread_attr_t* p_pthread_attr)
+// スレッドメッセージのポインタを登録する。
+int CThreadQueue::put(CThreadMsg *p_msg, bool bool_front)
 {
-	if (m_pthread != 0) {
-		return(ERR_CONTEXT);
+	return(putLane(p_msg, bool_front ? LANE_HIGH : LANE_NORMAL));
+}
+
+// スレッドメッセージのポインタを、レーンを指定して登録する。
+int CThreadQueue::putLane(CThreadMsg *p_msg, int lane, bool bool_force)
+{
+	if (lane < 0) {
+		return(PUT_ERROR);
 	}
-	m_thread_no	= thread_no;
-	m_parent	= parent;
-	if (p_pthread_attr) {
-		m_pthread_attr   = *p_pthread_attr;
-		m_p_pthread_attr = &m_pthread_attr;
+	if (lane >= m_lanes) {
+		lane = m_lanes - 1;
 	}
-	int ret;
-	ret = setInstanceInfo(STS_READY);
-	return(ret);
+	// まだ取り出されていなければ置き換える。（容量は確保しない）
+	bool bool_keyed = isKeyed(p_msg);
+	if (bool_keyed && conflate(p_msg, false)) {
+		return(PUT_OK);
+	}
+	unsigned long count = 0;
+	if (m_bool_count) {
+		if (bool_force || (m_capacity == 0)) {
+			count = __atomic_add_fetch(&m_count, 1, __ATOMIC_SEQ_CST);
+		} else {
+			int ret = reserve(p_msg);
+			if (ret == PUT_DROPPED) {
+				return(PUT_OK);
+			}
+			if (ret != PUT_OK) {
+				return(ret);
+			}
+			count = __atomic_load_n(&m_count, __ATOMIC_RELAXED);
+		}
+	}
+	// 容量を待つ間に、他の送信元が同じキーで登録していれば置き換える。
+	if (bool_keyed && conflate(p_msg, true)) {
+		popped(1);	// 確保した容量を戻す。
+		return(PUT_OK);
+	}
+	// 制御メッセージは、レーンの取り出し方に関わらず先に取り出す。
+	bool bool_control = (lane == LANE_HIGH) && isControl(p_msg);
+	if (m_mode == MODE_LOCKFREE) {
+		if (bool_control) {
+			m_control_list.push(p_msg);
+		} else {
+			m_list[lane].push(p_msg);
+		}
+	} else {
+		CThreadMsg *p_oldest = NULL;
+		pthread_mutex_lock(&m_mutex);
+		if (bool_control) {
+			m_dq_control.push_back(p_msg);
+		} else {
+			m_vec_dq_p_msg[lane].push_back(p_msg);
+		}
+		if (!bool_force && (m_capacity != 0) && (m_full == FULL_DROP_OLDEST) && (count > m_capacity)) {
+			p_oldest = removeOldest();
+		}
+		pthread_mutex_unlock(&m_mutex);
+		if (p_oldest) {
+			delete p_oldest;
+			__atomic_add_fetch(&m_dropped, 1, __ATOMIC_RELAXED);
+			count = __atomic_sub_fetch(&m_count, 1, __ATOMIC_SEQ_CST);
+		}
+	}
+	if (m_bool_count) {
+		pushed(count);
+	}
+	return(PUT_OK);
 }
 
-// スレッドを起動する。
-int CThreadBase::start()
+// 容量を確保する。
+int CThreadQueue::reserve(CThreadMsg *p_msg)
 {
-	if (m_pthread != 0) {
-		return(ERR_CONTEXT);
+	for (;;) {
+		unsigned long count = __atomic_add_fetch(&m_count, 1, __ATOMIC_SEQ_CST);
+		// FULL_DROP_OLDEST は、登録してから古いものを外す。
+		if ((count <= m_capacity) || (m_full == FULL_DROP_OLDEST)) {
+			return(PUT_OK);
+		}
+		__atomic_sub_fetch(&m_count, 1, __ATOMIC_SEQ_CST);
+		switch (m_full) {
+		case FULL_BLOCK:
+			if (!waitSpace()) {
+				return(PUT_CLOSED);
+			}
+			break;
+		case FULL_DROP_NEWEST:
+			__atomic_add_fetch(&m_dropped, 1, __ATOMIC_RELAXED);
+			delete p_msg;
+			return(PUT_DROPPED);
+		default:
+			__atomic_add_fetch(&m_dropped, 1, __ATOMIC_RELAXED);
+			return(PUT_FULL);
+		}
 	}
-	int ret;
-	ret = onPreThreadCreate();
-	if (ret) {
-		return(ret);
+}
+
+// 空きができるまで待つ。
+// 待つ数を増やしてから滞留数を確認し、取り出し側は滞留数を減らしてから待つ数を確認する。
+// どちらかが必ず相手の更新を見るので、起こし損ねない。
+bool CThreadQueue::waitSpace()
+{
+	pthread_mutex_lock(&m_space_mutex);
+	__atomic_add_fetch(&m_blocked, 1, __ATOMIC_SEQ_CST);
+	while (!m_bool_closed && (__atomic_load_n(&m_count, __ATOMIC_SEQ_CST) >= m_capacity)) {
+		pthread_cond_wait(&m_space_cond, &m_space_mutex);
 	}
-	pthread_mutex_lock(&m_mutex);
-	ret = pthread_create(&m_pthread, m_p_pthread_attr, start_routine, (void*)this);
-	m_pthread_copy = m_pthread;
-	pthread_mutex_unlock(&m_mutex);
-	if (ret) {
-		return(ret);
+	bool bool_ret = !m_bool_closed;
+	__atomic_sub_fetch(&m_blocked, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&m_space_mutex);
+	return(bool_ret);
+}
+
+// 制御用の待ち行列に入れるメッセージか否か
+bool CThreadQueue::isControl(CThreadMsg *p_msg)
+{
+	return(msg_cast<CStopMsg>(p_msg) || msg_cast<CQueueWatermarkMsg>(p_msg));
+}
+
+// 最も低いレーンの最も古いメッセージを外す。
+// 終了メッセージと水位通知メッセージは外さない。
+// キー付きメッセージは、キー毎に１つしか溜まらないので外さない。
+CThreadMsg* CThreadQueue::removeOldest()
+{
+	for (int lane = m_lanes - 1; lane >= 0; lane--) {
+		deque<CThreadMsg*>& dq_p_msg = m_vec_dq_p_msg[lane];
+		deque<CThreadMsg*>::iterator iter;
+		for (iter = dq_p_msg.begin(); iter != dq_p_msg.end(); ++iter) {
+			if (msg_cast<CStopMsg>(*iter) || msg_cast<CQueueWatermarkMsg>(*iter) || isKeyed(*iter)) {
+				continue;
+			}
+			CThreadMsg *p_msg = *iter;
+			dq_p_msg.erase(iter);
+			return(p_msg);
+		}
 	}
-	return(ret);
+	return(NULL);
 }
 
-// スレッドを終了する。
-int CThreadBase::stop(bool bool_join, bool bool_immediately, void* vp_ret)
+// 取り出されていない同じキーのメッセージを置き換える。
+bool CThreadQueue::conflate(CThreadMsg *p_msg, bool bool_insert)
 {
-	return(stop_join(true, bool_join, bool_immediately, vp_ret));
+	CONFLATE_KEY key(p_msg->m_msg_type, p_msg->m_conflate_key);
+	pthread_mutex_lock(&m_conflate_mutex);
+	map<CONFLATE_KEY, CConflate>::iterator iter = m_map_conflate.find(key);
+	if (iter == m_map_conflate.end()) {
+		if (bool_insert) {
+			CConflate conflate = { p_msg, NULL };
+			m_map_conflate.insert(make_pair(key, conflate));
+		}
+		pthread_mutex_unlock(&m_conflate_mutex);
+		return(false);
+	}
+	// キュー内のメッセージは取り出す時に入れ替えるので、預かっている方だけ解放する。
+	CThreadMsg *p_old = iter->second.p_latest;
+	p_msg->onConflate(p_old ? p_old : iter->second.p_queued);
+	iter->second.p_latest = p_msg;
+	pthread_mutex_unlock(&m_conflate_mutex);
+	delete p_old;
+	__atomic_add_fetch(&m_conflated, 1, __ATOMIC_RELAXED);
+	return(true);
 }
 
-// スレッド終了を待つ。
-int CThreadBase::join()
+// 取り出したメッセージを、預かっている最新のメッセージと入れ替える。
+CThreadMsg* CThreadQueue::takeLatest(CThreadMsg *p_msg)
 {
-	return(stop_join(false, true));
+	CThreadMsg *p_latest = NULL;
+	CONFLATE_KEY key(p_msg->m_msg_type, p_msg->m_conflate_key);
+	pthread_mutex_lock(&m_conflate_mutex);
+	map<CONFLATE_KEY, CConflate>::iterator iter = m_map_conflate.find(key);
+	if ((iter != m_map_conflate.end()) && (iter->second.p_queued == p_msg)) {
+		p_latest = iter->second.p_latest;
+		m_map_conflate.erase(iter);
+	}
+	pthread_mutex_unlock(&m_conflate_mutex);
+	if (p_latest == NULL) {
+		return(p_msg);
+	}
+	delete p_msg;
+	return(p_latest);
 }
 
-// スレッド終了、スレッド終了待ち合わせ。
-int CThreadBase::stop_join(bool bool_stop, bool bool_join, bool bool_immediately, void* vp_ret)
+// 登録した。
+void CThreadQueue::pushed(unsigned long count)
 {
-	if (m_pthread == 0) {
-		return(ERR_CONTEXT);
+	if (m_bool_peak) {
+		// 超えた時だけ書き込む。
+		unsigned long peak = __atomic_load_n(&m_peak, __ATOMIC_RELAXED);
+		while ((count > peak) &&
+			   !__atomic_compare_exchange_n(&m_peak, &peak, count, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		}
 	}
-	if (m_pthread == pthread_self()) {
-		return(ERR_CONTEXT);
+	if ((m_high == 0) || (count < m_high)) {
+		return;
 	}
-	if (bool_stop) {
-		shutdown(bool_immediately, vp_ret);
+	int expected = 0;
+	if (!__atomic_compare_exchange_n(&m_high_state, &expected, 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+		return;
 	}
-	if (bool_join) {
-		pthread_join(m_pthread, NULL);
-		m_pthread = 0;
-		onPostThreadJoin();
+	m_p_watermark(m_vp_watermark_arg, true);
+	// 状態を変える前に低水位以下まで取り出されていた場合は、ここで戻す。
+	if (__atomic_load_n(&m_count, __ATOMIC_SEQ_CST) <= m_low) {
+		expected = 1;
+		if (__atomic_compare_exchange_n(&m_high_state, &expected, 0, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+			m_p_watermark(m_vp_watermark_arg, false);
+		}
 	}
-	return(ERR_OK);
 }
 
-// 自スレッドにスレッド終了メッセージをキューイングする。
-void CThreadBase::shutdown(bool bool_immediately, void* vp_ret)
+// 取り出した。
+void CThreadQueue::popped(unsigned long num)
 {
-	if (active() == false) {
+	if (!m_bool_count || (num == 0)) {
 		return;
 	}
-	CStopMsg *p_stop_msg = new CStopMsg(vp_ret);
-	postMsg(p_stop_msg, bool_immediately);
+	unsigned long count = __atomic_sub_fetch(&m_count, num, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&m_blocked, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&m_space_mutex);
+		pthread_cond_broadcast(&m_space_cond);
+		pthread_mutex_unlock(&m_space_mutex);
+	}
+	if ((m_high == 0) || (count > m_low) || !__atomic_load_n(&m_high_state, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+	int expected = 1;
+	if (__atomic_compare_exchange_n(&m_high_state, &expected, 0, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+		m_p_watermark(m_vp_watermark_arg, false);
+	}
+}
 
-	m_bool_shutdown = true;
-	setInstanceInfo(STS_SHUTDOWN);
+// スレッドメッセージのポインタを取り出す。
+int CThreadQueue::get(CThreadMsg **pp_msg)
+{
+	if (m_mode == MODE_MUTEX) {
+		pthread_mutex_lock(&m_mutex);
+	}
+	*pp_msg = pop();
+	if (m_mode == MODE_MUTEX) {
+		pthread_mutex_unlock(&m_mutex);
+	}
+	if (*pp_msg == NULL) {
+		return(-1);
+	}
+	if (isKeyed(*pp_msg)) {
+		*pp_msg = takeLatest(*pp_msg);
+	}
+	popped(1);
+	return(0);
 }
 
-// スレッドにメッセージをキューイングする。
-int CThreadBase::postMsg(CThreadMsg *p_msg, bool bool_high_prior)
+// スレッドメッセージのポインタをまとめて取り出す。
+int CThreadQueue::getBatch(CThreadMsg **pp_msg, int max_num)
 {
-	int ret = ERR_OK;
-	if (active() == false) {
-		if (m_pthread == 0) {
-			ret = ERR_CONTEXT;
-		} else {
-			ret = ERR_TERMINATE;
+	int num = 0;
+	if (m_mode == MODE_MUTEX) {
+		pthread_mutex_lock(&m_mutex);
+	}
+	while (num < max_num) {
+		if ((pp_msg[num] = pop()) == NULL) {
+			break;
 		}
-		// エラーの時はメッセージを削除する。
-		// postMsg()したメッセージは、責任を持って削除する。
-		// 呼び出し側に負担をかけない。
-		delete p_msg;
-		return(ret);
+		num++;
 	}
-	ret = m_queue.put(p_msg, bool_high_prior);
-	if (ret) {
-		return(ret);
+	if (m_mode == MODE_MUTEX) {
+		pthread_mutex_unlock(&m_mutex);
 	}
-	// スレッドへの通知（内容は無意味）
-	if (write(m_pipe[PIPE_WRITE], "!", 1) != 1) {
-		ret = ERR_SYSTEM;
+	for (int i = 0; i < num; i++) {
+		if (isKeyed(pp_msg[i])) {
+			pp_msg[i] = takeLatest(pp_msg[i]);
+		}
 	}
-	return(ret);
+	popped(num);
+	return(num);
 }
 
-// スレッドのrun関数。
-void* CThreadBase::run()
+// レーンから１つ取り出す。
+CThreadMsg* CThreadQueue::popLane(int lane)
 {
-	// 起動側スレッドがスレッド識別子を取り込むのを待ち合わせる。
-	pthread_mutex_lock(&m_mutex);
+	if (m_mode == MODE_LOCKFREE) {
+		return(m_list[lane].pop());
+	}
+	deque<CThreadMsg*>& dq_p_msg = m_vec_dq_p_msg[lane];
+	if (dq_p_msg.empty()) {
+		return(NULL);
+	}
+	CThreadMsg *p_msg = dq_p_msg.front();
+	dq_p_msg.pop_front();
+	return(p_msg);
+}
+
+// 取り出し方に従って１つ取り出す。
+CThreadMsg* CThreadQueue::pop()
+{
+	CThreadMsg *p_msg = NULL;
+	// 制御メッセージ（終了、水位通知）は常に先に取り出す。
+	if (m_mode == MODE_LOCKFREE) {
+		p_msg = m_control_list.pop();
+	} else if (!m_dq_control.empty()) {
+		p_msg = m_dq_control.front();
+		m_dq_control.pop_front();
+	}
+	if (p_msg) {
+		return(p_msg);
+	}
+	if (m_drain == DRAIN_STRICT) {
+		for (int lane = 0; (lane < m_lanes) && (p_msg == NULL); lane++) {
+			p_msg = popLane(lane);
+		}
+		return(p_msg);
+	}
+	// 今のレーンの残りがなくなるか空になれば、次のレーンに移る。
+	// 全レーンが空であれば NULL。
+	for (int tried = 0; tried < m_lanes; ) {
+		if (m_rr_credit <= 0) {
+			m_rr_lane   = (m_rr_lane + 1) % m_lanes;
+			m_rr_credit = m_weight[m_rr_lane];
+		}
+		if ((p_msg = popLane(m_rr_lane)) != NULL) {
+			m_rr_credit--;
+			return(p_msg);
+		}
+		m_rr_credit = 0;
+		tried++;
+	}
+	return(NULL);
+}
+
+// キューイングされている全てのメッセージを削除します。
+void CThreadQueue::removeAll()
+{
+	CThreadMsg *p_msg;
+	for (int lane = 0; lane < MAX_LANES; lane++) {
+		while ((p_msg = m_list[lane].pop()) != NULL) {
+			delete p_msg;
+		}
+	}
+	while ((p_msg = m_control_list.pop()) != NULL) {
+		delete p_msg;
+	}
+	pthread_mutex_lock(&m_mutex);
+	while (!m_dq_control.empty()) {
+		delete m_dq_control.front();
+		m_dq_control.pop_front();
+	}
+	for (size_t lane = 0; lane < m_vec_dq_p_msg.size(); lane++) {
+		while (!m_vec_dq_p_msg[lane].empty()) {
+			delete m_vec_dq_p_msg[lane].front();
+			m_vec_dq_p_msg[lane].pop_front();
+		}
+	}
+	pthread_mutex_unlock(&m_mutex);
+	pthread_mutex_lock(&m_conflate_mutex);
+	map<CONFLATE_KEY, CConflate>::iterator iter;
+	for (iter = m_map_conflate.begin(); iter != m_map_conflate.end(); ++iter) {
+		delete iter->second.p_latest;
+	}
+	m_map_conflate.clear();
+	pthread_mutex_unlock(&m_conflate_mutex);
+	// 水位は通知せずに戻す。（デストラクタから呼ばれる）
+	__atomic_store_n(&m_count, 0, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&m_high_state, 0, __ATOMIC_SEQ_CST);
+	return;
+}
+
+// スレッドキューが空か否かを返す。
+bool CThreadQueue::empty()
+{
+	if (m_mode == MODE_LOCKFREE) {
+		if (!m_control_list.empty()) {
+			return(false);
+		}
+		for (int lane = 0; lane < m_lanes; lane++) {
+			if (!m_list[lane].empty()) {
+				return(false);
+			}
+		}
+		return(true);
+	}
+	pthread_mutex_lock(&m_mutex);
+	bool bool_ret = m_dq_control.empty();
+	for (int lane = 0; bool_ret && (lane < m_lanes); lane++) {
+		if (!m_vec_dq_p_msg[lane].empty()) {
+			bool_ret = false;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&m_mutex);
+	return(bool_ret);
+}
+
+// キューの方式を設定する。
+int CThreadQueue::setMode(MODE mode)
+{
+	if (!empty()) {
+		return(-1);
+	}
+	if ((mode == MODE_LOCKFREE) && (m_capacity != 0) && (m_full == FULL_DROP_OLDEST)) {
+		return(-1);
+	}
+	m_mode = mode;
+	return(0);
+}
+
+// レーンを設定する。
+int CThreadQueue::setLanes(int lanes, DRAIN drain, const int *p_weights)
+{
+	if ((lanes < (LANE_NORMAL + 1)) || (lanes > MAX_LANES)) {
+		return(-1);
+	}
+	if (p_weights) {
+		for (int lane = 0; lane < lanes; lane++) {
+			if (p_weights[lane] < 1) {
+				return(-1);
+			}
+		}
+	}
+	if ((m_lanes != 0) && !empty()) {
+		return(-1);
+	}
+	m_lanes = lanes;
+	m_drain = drain;
+	for (int lane = 0; lane < lanes; lane++) {
+		m_weight[lane] = p_weights ? p_weights[lane] : (1 << (lanes - 1 - lane));
+	}
+	m_rr_lane   = lanes - 1;	// 最初の取り出しでレーン０に移る。
+	m_rr_credit = 0;
+	pthread_mutex_lock(&m_mutex);
+	m_vec_dq_p_msg.resize(lanes);
+	pthread_mutex_unlock(&m_mutex);
+	return(0);
+}
+
+// レーンに溜まっているメッセージ数を返す。
+unsigned long CThreadQueue::getDepth(int lane)
+{
+	if ((lane < 0) || (lane >= m_lanes)) {
+		return(0);
+	}
+	if (m_mode == MODE_LOCKFREE) {
+		return(m_list[lane].depth());
+	}
+	pthread_mutex_lock(&m_mutex);
+	unsigned long depth = m_vec_dq_p_msg[lane].size();
+	pthread_mutex_unlock(&m_mutex);
+	return(depth);
+}
+
+// 容量を設定する。
+int CThreadQueue::setCapacity(unsigned long capacity, FULL full)
+{
+	if ((full < FULL_BLOCK) || (full > FULL_DROP_NEWEST)) {
+		return(-1);
+	}
+	if (!empty()) {
+		return(-1);
+	}
+	if ((capacity != 0) && (full == FULL_DROP_OLDEST)) {
+		// ロックフリー方式では送信元が取り出せないので、ミューテック方式にする。
+		m_mode = MODE_MUTEX;
+	}
+	m_capacity   = capacity;
+	m_full       = full;
+	m_bool_count = (m_capacity != 0) || (m_high != 0) || m_bool_peak;
+	return(0);
+}
+
+// 水位を設定する。
+int CThreadQueue::setWatermark(unsigned long high, unsigned long low, WATERMARK_FUNC p_func, void *vp_arg)
+{
+	if ((high != 0) && ((low >= high) || (p_func == NULL))) {
+		return(-1);
+	}
+	if (!empty()) {
+		return(-1);
+	}
+	m_high             = high;
+	m_low              = low;
+	m_p_watermark      = p_func;
+	m_vp_watermark_arg = vp_arg;
+	m_bool_count       = (m_capacity != 0) || (m_high != 0) || m_bool_peak;
+	return(0);
+}
+
+// 滞留数の最大値を記録するか否かを設定する。
+int CThreadQueue::setPeak(bool bool_peak)
+{
+	if (!empty()) {
+		return(-1);
+	}
+	m_bool_peak  = bool_peak;
+	m_bool_count = (m_capacity != 0) || (m_high != 0) || m_bool_peak;
+	return(0);
+}
+
+// 溜まっているメッセージ数（全レーンの合計）を返す。
+unsigned long CThreadQueue::size()
+{
+	if (m_bool_count) {
+		return(__atomic_load_n(&m_count, __ATOMIC_RELAXED));
+	}
+	unsigned long count = (m_mode == MODE_LOCKFREE) ? m_control_list.depth() : 0;
+	for (int lane = 0; lane < m_lanes; lane++) {
+		count += getDepth(lane);
+	}
+	if (m_mode == MODE_MUTEX) {
+		pthread_mutex_lock(&m_mutex);
+		count += m_dq_control.size();
+		pthread_mutex_unlock(&m_mutex);
+	}
+	return(count);
+}
+
+// 空きを待っている送信元を起こし、以降は待たせない。
+void CThreadQueue::close()
+{
+	pthread_mutex_lock(&m_space_mutex);
+	m_bool_closed = true;
+	pthread_cond_broadcast(&m_space_cond);
+	pthread_mutex_unlock(&m_space_mutex);
+}
+
+// close()を解除する。
+void CThreadQueue::open()
+{
+	pthread_mutex_lock(&m_space_mutex);
+	m_bool_closed = false;
+	pthread_mutex_unlock(&m_space_mutex);
+}
+
+// ロックフリーのリスト（Dmitry Vyukov 氏の intrusive MPSC queue による）
+CThreadQueue::CMpscList::CMpscList()
+: m_p_head(&m_stub)
+, m_pushed(0)
+, m_p_tail(&m_stub)
+, m_popped(0)
+{
+}
+
+// 登録（複数スレッドから同時に呼び出し可）
+void CThreadQueue::CMpscList::push(CThreadMsg *p_msg)
+{
+	link(p_msg);
+	// レーン毎の滞留数（getDepth()）のため、送信側のアトミック操作が１回増える。
+	// m_p_head と同じく送信元の間で競合するので、その分 push()は遅くなる。
+	__atomic_add_fetch(&m_pushed, 1, __ATOMIC_RELAXED);
+}
+
+// 繋ぐ。（番兵は登録数に数えない）
+void CThreadQueue::CMpscList::link(CThreadMsg *p_msg)
+{
+	p_msg->m_p_next_msg = NULL;
+	CThreadMsg *p_prev = __atomic_exchange_n(&m_p_head, p_msg, __ATOMIC_SEQ_CST);
+	// ここで中断されると、一時的に p_msg 以降を取り出せない。（pop()が NULLを返す）
+	__atomic_store_n(&p_prev->m_p_next_msg, p_msg, __ATOMIC_RELEASE);
+}
+
+// 取り出し（受信先スレッドのみ）
+CThreadMsg* CThreadQueue::CMpscList::pop()
+{
+	CThreadMsg *p_tail = m_p_tail;
+	CThreadMsg *p_next = __atomic_load_n(&p_tail->m_p_next_msg, __ATOMIC_ACQUIRE);
+	if (p_tail == &m_stub) {
+		if (p_next == NULL) {
+			return(NULL);
+		}
+		m_p_tail = p_next;
+		p_tail = p_next;
+		p_next = __atomic_load_n(&p_next->m_p_next_msg, __ATOMIC_ACQUIRE);
+	}
+	if (p_next) {
+		m_p_tail = p_next;
+		__atomic_store_n(&m_popped, m_popped + 1, __ATOMIC_RELAXED);
+		return(p_tail);
+	}
+	if (p_tail != __atomic_load_n(&m_p_head, __ATOMIC_ACQUIRE)) {
+		// 登録途中の送信元がいる。
+		return(NULL);
+	}
+	// 最後の１つを取り出すため、番兵を後ろに繋ぐ。
+	link(&m_stub);
+	p_next = __atomic_load_n(&p_tail->m_p_next_msg, __ATOMIC_ACQUIRE);
+	if (p_next) {
+		m_p_tail = p_next;
+		__atomic_store_n(&m_popped, m_popped + 1, __ATOMIC_RELAXED);
+		return(p_tail);
+	}
+	return(NULL);
+}
+
+// 溜まっている数（概数。どのスレッドからも呼び出し可）
+unsigned long CThreadQueue::CMpscList::depth() const
+{
+	unsigned long popped = __atomic_load_n(&m_popped, __ATOMIC_RELAXED);
+	unsigned long pushed = __atomic_load_n(&m_pushed, __ATOMIC_RELAXED);
+	return((pushed > popped) ? (pushed - popped) : 0);
+}
+
+// 空か否か（受信先スレッドのみ）
+// 登録途中の送信元がいる場合は、空ではないと判断する。
+bool CThreadQueue::CMpscList::empty()
+{
+	return((m_p_tail == &m_stub) &&
+		   (__atomic_load_n(&m_p_head, __ATOMIC_SEQ_CST) == &m_stub));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// スレッド通知クラス
+////////////////////////////////////////////////////////////////////////////////
+
+// コンストラクタ
+CThreadNotifier::CThreadNotifier()
+{
+#ifdef CTB_EVENTFD
+	m_fd[FD_READ] = m_fd[FD_WRITE] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	assert(m_fd[FD_READ] != (-1));
+#else
+	int ret = pipe(m_fd);
+	assert(ret == 0);
+	// drain()で読み切るため、読み込み側は非ブロッキングにする。
+	fcntl(m_fd[FD_READ], F_SETFL, fcntl(m_fd[FD_READ], F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+// デストラクタ
+CThreadNotifier::~CThreadNotifier()
+{
+	close(m_fd[FD_READ]);
+	if (m_fd[FD_WRITE] != m_fd[FD_READ]) {
+		close(m_fd[FD_WRITE]);
+	}
+}
+
+// 待ち状態のスレッドに通知する。
+int CThreadNotifier::notify()
+{
+#ifdef CTB_EVENTFD
+	uint64_t value = 1;
+	if (write(m_fd[FD_WRITE], &value, sizeof(value)) != sizeof(value)) {
+		return(-1);
+	}
+#else
+	// 内容は無意味
+	if (write(m_fd[FD_WRITE], "!", 1) != 1) {
+		return(-1);
+	}
+#endif
+	return(0);
+}
+
+// 溜まっている通知を全て読み捨てる。
+void CThreadNotifier::drain()
+{
+#ifdef CTB_EVENTFD
+	uint64_t value;
+	// カウンタは１回の読み込みでクリアされる。
+	if (read(m_fd[FD_READ], &value, sizeof(value)) != sizeof(value)) {
+		return;
+	}
+#else
+	char buf[256];
+	while (read(m_fd[FD_READ], buf, sizeof(buf)) == sizeof(buf)) {
+		;
+	}
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 時計クラス
+////////////////////////////////////////////////////////////////////////////////
+
+// 標準の時計を返す。
+CClock* CClock::getDefault()
+{
+	static CMonotonicClock g_clock;
+	return(&g_clock);
+}
+
+// 現在時刻を返す。
+long long CMonotonicClock::now() const
+{
+	return(CTimerCBList::getTime());
+}
+
+// コンストラクタ
+CVirtualClock::CVirtualClock(long long nsec_start)
+: m_now(nsec_start)
+{
+	pthread_mutex_init(&m_mutex, NULL);
+}
+
+// デストラクタ
+CVirtualClock::~CVirtualClock()
+{
+	pthread_mutex_destroy(&m_mutex);
+}
+
+// 現在時刻を返す。
+long long CVirtualClock::now() const
+{
+	return(__atomic_load_n(&m_now, __ATOMIC_ACQUIRE));
+}
+
+// タイマ制御ブロックリストが使い始める。
+void CVirtualClock::attach(CTimerCBList *p_list)
+{
+	pthread_mutex_lock(&m_mutex);
+	m_vec_p_list.push_back(p_list);
+	pthread_mutex_unlock(&m_mutex);
+}
+
+// タイマ制御ブロックリストが使い終わる。
+void CVirtualClock::detach(CTimerCBList *p_list)
+{
+	pthread_mutex_lock(&m_mutex);
+	m_vec_p_list.erase(std::remove(m_vec_p_list.begin(), m_vec_p_list.end(), p_list), m_vec_p_list.end());
+	pthread_mutex_unlock(&m_mutex);
+}
+
+// 時刻を設定する。
+void CVirtualClock::set(long long nsec_time)
+{
+	if (nsec_time <= now()) {
+		return;
+	}
+	__atomic_store_n(&m_now, nsec_time, __ATOMIC_RELEASE);
+	notify();
+}
+
+// 時刻を進める。
+void CVirtualClock::advance(long long nsec_elapsed_time)
+{
+	if (nsec_elapsed_time <= 0) {
+		return;
+	}
+	__atomic_add_fetch(&m_now, nsec_elapsed_time, __ATOMIC_ACQ_REL);
+	notify();
+}
+
+// 時刻を進めたことを知らせる。
+void CVirtualClock::notify()
+{
+	pthread_mutex_lock(&m_mutex);
+	vector<CTimerCBList*>::iterator iter;
+	for (iter = m_vec_p_list.begin(); iter != m_vec_p_list.end(); ++iter) {
+		(*iter)->kick();
+	}
+	pthread_mutex_unlock(&m_mutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// タイマ制御ブロックリストクラス
+////////////////////////////////////////////////////////////////////////////////
+
+// コンストラクタ
+CTimerCBList::CTimerCBList()
+: m_cur_tick(toTick(getTime(), false))
+, m_p_free_node(NULL)
+, m_timer_fd(-1)
+, m_armed_tick(0)
+, m_p_clock(CClock::getDefault())
+, m_p_notifier(NULL)
+{
+	for (int level = 0; level < WHEEL_LEVELS; level++) {
+		m_bitmap[level] = 0;
+	}
+#ifdef CTB_TIMERFD
+	m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+#endif
+	pthread_mutex_init(&m_mutex, NULL);
+}
+
+// デストラクタ
+CTimerCBList::~CTimerCBList()
+{
+	vector<CNode*>::iterator iter;
+	for (iter = m_vec_p_chunk.begin(); iter != m_vec_p_chunk.end(); ++iter) {
+		for (int i = 0; i < NODE_CHUNK; i++) {
+			delete (*iter)[i].m_p_msg;	// 預かったままのメッセージ
+		}
+		delete [] *iter;
+	}
+	m_p_clock->detach(this);
+	if (m_timer_fd != (-1)) {
+		close(m_timer_fd);
+	}
+	pthread_mutex_destroy(&m_mutex);
+}
+
+// 現在時刻（CLOCK_MONOTONIC）をナノ秒で返す。
+long long CTimerCBList::getTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((static_cast<long long>(now.tv_sec) * 1000000000LL) + now.tv_nsec);
+}
+
+// 時計を設定する。
+int CTimerCBList::setClock(CClock *p_clock, CThreadNotifier *p_notifier)
+{
+	if (p_clock == NULL) {
+		p_clock = CClock::getDefault();
+	}
+	pthread_mutex_lock(&m_mutex);
+	if (!m_map_p_node.empty()) {
+		pthread_mutex_unlock(&m_mutex);
+		return(CThreadBase::ERR_CONTEXT);
+	}
+	CClock *p_old_clock = m_p_clock;
+	m_p_clock    = p_clock;
+	m_p_notifier = p_notifier;
+	m_cur_tick   = toTick(m_p_clock->now(), false);
+	pthread_mutex_unlock(&m_mutex);
+	// 時計のロックはタイマ制御ブロックリストのロックより先に取る。（kick()と同じ順）
+	if (p_old_clock != p_clock) {
+		p_old_clock->detach(this);
+		p_clock->attach(this);
+	}
+	return(CThreadBase::ERR_OK);
+}
+
+// 時刻が進んだことを、待っているスレッドに知らせる。
+void CTimerCBList::kick()
+{
+	pthread_mutex_lock(&m_mutex);
+	if (m_timer_fd != (-1)) {
+#ifdef CTB_TIMERFD
+		// timerfd を直ちに発火させる。（過去の時刻を設定）
+		struct itimerspec spec;
+		spec.it_interval.tv_sec  = 0;
+		spec.it_interval.tv_nsec = 0;
+		spec.it_value.tv_sec     = 0;
+		spec.it_value.tv_nsec    = 1;
+		timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+#endif
+		m_armed_tick = 0;
+	} else if (m_p_notifier) {
+		m_p_notifier->notify();
+	}
+	pthread_mutex_unlock(&m_mutex);
+}
+
+// タイマ制御ブロックを作り、リストに登録する。
+int CTimerCBList::set(int msec_elapsed_time, int timer_id, int msec_period, CTimerHandle *p_handle, int msec_slack)
+{
+	if (msec_elapsed_time <= 0)	{	return(CThreadBase::ERR_PARAM);	}
+	if (msec_period < 0)		{	return(CThreadBase::ERR_PARAM);	}
+	return(setNs(msec_elapsed_time * 1000000LL, timer_id, msec_period * 1000000LL, p_handle, msec_slack * 1000000LL));
+}
+
+// タイマ制御ブロックを作り、リストに登録する。（ナノ秒単位）
+int CTimerCBList::setNs(long long nsec_elapsed_time, int timer_id, long long nsec_period, CTimerHandle *p_handle, long long nsec_slack)
+{
+	if (nsec_elapsed_time <= 0)	{	return(CThreadBase::ERR_PARAM);	}
+	if (timer_id < 0)			{	return(CThreadBase::ERR_PARAM);	}
+	if (nsec_period < 0)		{	return(CThreadBase::ERR_PARAM);	}
+	if (nsec_slack < 0)			{	return(CThreadBase::ERR_PARAM);	}
+	return(insert(now() + nsec_elapsed_time, timer_id, nsec_period, nsec_slack, p_handle));
+}
+
+// タイマ制御ブロックを、リストに登録する。
+int CTimerCBList::set(CTimerCB &rTimerCB, CTimerHandle *p_handle)
+{
+	// 目標時刻は gettimeofday()の時刻なので、残り時間に直す。
+	CTimeVal current_time(CTimeVal::CURRENT);
+	long long usec = (static_cast<long long>(rTimerCB.m_target_time.tv_sec - current_time.tv_sec) * 1000000)
+				   + (rTimerCB.m_target_time.tv_usec - current_time.tv_usec);
+	if (usec < 0) {
+		usec = 0;
+	}
+	return(insert(now() + (usec * 1000), rTimerCB.m_timer_id, rTimerCB.m_msec_period * 1000000LL, 0, p_handle));
+}
+
+// メッセージを預けるタイマを登録する。
+int CTimerCBList::setMsg(long long nsec_deadline, int timer_id, CThreadMsg *p_msg, CTimerHandle *p_handle)
+{
+	if (p_msg == NULL) {
+		return(CThreadBase::ERR_PARAM);
+	}
+	return(insert(nsec_deadline, timer_id, 0, 0, p_handle, p_msg));
+}
+
+// タイマを登録する。
+int CTimerCBList::insert(long long deadline, int timer_id, long long nsec_period, long long nsec_slack, CTimerHandle *p_handle, CThreadMsg *p_msg)
+{
+	pthread_mutex_lock(&m_mutex);
+	CNode *p_node = allocNode();
+	p_node->m_deadline		= deadline;
+	p_node->m_nsec_period	= nsec_period;
+	p_node->m_nsec_slack	= nsec_slack;
+	p_node->m_p_msg			= p_msg;
+	p_node->m_expire		= toExpire(deadline, nsec_slack);
+	p_node->m_timer_id		= timer_id;
+	p_node->m_p_id_prev		= NULL;
+	if (p_handle) {
+		p_handle->m_p_list     = this;
+		p_handle->m_index      = p_node->m_index;
+		p_handle->m_generation = p_node->m_generation;
+	}
+	// タイマIDの索引の先頭に繋ぐ。
+	CNode *&p_head = m_map_p_node[timer_id];
+	p_node->m_p_id_next = p_head;
+	if (p_head) {
+		p_head->m_p_id_prev = p_node;
+	}
+	p_head = p_node;
+	add(p_node);
+	// timerfd より早ければ（又は止まっていれば）、待っているスレッドを起こせるよう合わせ直す。
+	if ((m_timer_fd != (-1)) && ((m_armed_tick == 0) || (p_node->m_expire < m_armed_tick))) {
+		setFD(p_node->m_expire);
+	}
+	pthread_mutex_unlock(&m_mutex);
+	return(CThreadBase::ERR_OK);
+}
+
+// リストからタイマ制御ブロックを削除する。
+int CTimerCBList::cancel(int timer_id)
+{
+	// timer_id が (-1)であれば全キャンセル（(-1)未満の内部用タイマは除く）
+	pthread_mutex_lock(&m_mutex);
+	map<int, CNode*>::iterator iter;
+	map<int, CNode*>::iterator iter_end;
+	if (timer_id == (-1)) {
+		iter     = m_map_p_node.lower_bound(0);
+		iter_end = m_map_p_node.end();
+	} else {
+		iter     = m_map_p_node.find(timer_id);
+		iter_end = iter;
+		if (iter_end != m_map_p_node.end()) {
+			++iter_end;
+		}
+	}
+	while (iter != iter_end) {
+		CNode *p_node = iter->second;
+		while (p_node) {
+			CNode *p_next = p_node->m_p_id_next;
+			unlink(p_node);
+			freeNode(p_node);
+			p_node = p_next;
+		}
+		m_map_p_node.erase(iter++);
+	}
+	pthread_mutex_unlock(&m_mutex);
+	return(CThreadBase::ERR_OK);
+}
+
+// タイマハンドルが指すタイマだけを削除する。
+int CTimerCBList::cancel(const CTimerHandle& handle)
+{
+	int ret = CThreadBase::ERR_PARAM;
+	pthread_mutex_lock(&m_mutex);
+	CNode *p_node = findNode(handle);
+	if (p_node && (p_node->m_timer_id >= (-1))) {	// (-1)未満は内部用
+		remove(p_node);
+		ret = CThreadBase::ERR_OK;
+	}
+	pthread_mutex_unlock(&m_mutex);
+	return(ret);
+}
+
+// タイマハンドルが指す、メッセージを預けたタイマだけを削除する。
+int CTimerCBList::cancelMsg(const CTimerHandle& handle)
+{
+	int ret = CThreadBase::ERR_PARAM;
+	pthread_mutex_lock(&m_mutex);
+	CNode *p_node = findNode(handle);
+	if (p_node && p_node->m_p_msg) {
+		remove(p_node);		// メッセージも解放する。
+		ret = CThreadBase::ERR_OK;
+	}
+	pthread_mutex_unlock(&m_mutex);
+	return(ret);
+}
+
+// タイマハンドルが指す、登録中のタイマを返す。（m_mutex取得済みで呼び出す）
+CTimerCBList::CNode* CTimerCBList::findNode(const CTimerHandle& handle)
+{
+	// 他のリストが発行したハンドルは、位置が同じでも別のタイマ
+	if (!handle.isSet() || (handle.m_p_list != this)) {
+		return(NULL);
+	}
+	size_t chunk = handle.m_index / NODE_CHUNK;
+	if (chunk >= m_vec_p_chunk.size()) {
+		return(NULL);
+	}
+	CNode *p_node = &m_vec_p_chunk[chunk][handle.m_index % NODE_CHUNK];
+	// 解放済みのタイマは世代番号が進んでいる。
+	if (p_node->m_generation != handle.m_generation) {
+		return(NULL);
+	}
+	return(p_node);
+}
+
+// タイムアウトしたタイマ制御ブロックを１つ取り出す。
+bool CTimerCBList::timeout(int *p_timer_id, CTimerHandle *p_handle, CThreadMsg **pp_msg, long long *p_nsec_late)
+{
+	bool bool_ret = false;
+	pthread_mutex_lock(&m_mutex);
+	if (m_expired.empty()) {
+		advance(toTick(now(), false));
+	}
+	if (!m_expired.empty()) {
+		CNode *p_node = static_cast<CNode*>(m_expired.m_p_next);
+		if (p_timer_id) {
+			*p_timer_id = p_node->m_timer_id;
+		}
+		if (p_handle) {
+			p_handle->m_p_list     = this;
+			p_handle->m_index      = p_node->m_index;
+			p_handle->m_generation = p_node->m_generation;
+		}
+		if (pp_msg) {
+			*pp_msg = p_node->m_p_msg;
+			p_node->m_p_msg = NULL;
+		}
+		if (p_nsec_late) {
+			long long nsec_late = now() - p_node->m_deadline;
+			*p_nsec_late = (nsec_late > 0) ? nsec_late : 0;
+		}
+		bool_ret = true;
+		if (p_node->m_nsec_period > 0) {
+			// 周期起動は、同じタイマを次の周期で登録し直す。
+			unlink(p_node);
+			p_node->m_deadline += p_node->m_nsec_period;
+			p_node->m_expire    = toExpire(p_node->m_deadline, p_node->m_nsec_slack);
+			add(p_node);
+		} else {
+			remove(p_node);
+		}
+	}
+	pthread_mutex_unlock(&m_mutex);
+	return(bool_ret);
+}
+
+// 次に起きるべき時刻を返す。
+long long CTimerCBList::next_time()
+{
+	long long target_time = 0;
+	TICK tick;
+	pthread_mutex_lock(&m_mutex);
+	if (!m_expired.empty()) {
+		target_time = static_cast<long long>(m_cur_tick - 1) * TICK_NSEC;	// 既に過ぎている
+	} else if (nextTick(&tick)) {
+		target_time = static_cast<long long>(tick) * TICK_NSEC;
+	}
+	pthread_mutex_unlock(&m_mutex);
+	return(target_time);
+}
+
+// timerfd を次に起きるべき時刻に合わせる。
+void CTimerCBList::arm()
+{
+	if (m_timer_fd == (-1)) {
+		return;
+	}
+	TICK tick = 0;
+	pthread_mutex_lock(&m_mutex);
+	if (!m_expired.empty()) {
+		tick = m_cur_tick - 1;		// 既に過ぎている
+	} else if (!nextTick(&tick)) {
+		tick = 0;					// タイマ登録がなければ止める。
+	}
+	if (tick != m_armed_tick) {
+		setFD(tick);
+	}
+	pthread_mutex_unlock(&m_mutex);
+}
+
+// timerfd の通知を読み捨てる。
+void CTimerCBList::drain()
+{
+#ifdef CTB_TIMERFD
+	uint64_t value;
+	if (read(m_timer_fd, &value, sizeof(value)) != sizeof(value)) {
+		return;
+	}
+	// 発火した timerfd は止まっているので、次の arm()で必ず設定し直す。
+	pthread_mutex_lock(&m_mutex);
+	m_armed_tick = 0;
+	pthread_mutex_unlock(&m_mutex);
+#endif
+}
+
+// timerfd を指定したティックに設定する。（０は停止／m_mutex取得済みで呼び出す）
+void CTimerCBList::setFD(TICK tick)
+{
+#ifdef CTB_TIMERFD
+	// timerfd は CLOCK_MONOTONIC なので、それ以外の時計の時刻は置き換える。
+	// （０は停止。時刻が来ていれば１を設定して直ちに発火させる）
+	long long nsec = static_cast<long long>(tick) * TICK_NSEC;
+	if ((tick != 0) && (m_p_clock != CClock::getDefault())) {
+		long long nsec_remain = nsec - now();
+		if (nsec_remain <= 0) {
+			nsec = 1;
+		} else if (m_p_clock->isVirtual()) {
+			nsec = 0;					// 時刻が進むまで（kick()されるまで）止める。
+		} else {
+			nsec = getTime() + nsec_remain;
+		}
+	} else if ((tick != 0) && (nsec == 0)) {
+		nsec = 1;
+	}
+	struct itimerspec spec;
+	spec.it_interval.tv_sec  = 0;
+	spec.it_interval.tv_nsec = 0;
+	spec.it_value.tv_sec     = static_cast<time_t>(nsec / 1000000000LL);
+	spec.it_value.tv_nsec    = static_cast<long>(nsec % 1000000000LL);
+	timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+	m_armed_tick = tick;
+#endif
+}
+
+// ナノ秒をティックに変換する。
+CTimerCBList::TICK CTimerCBList::toTick(long long nsec, bool bool_round_up)
+{
+	if (nsec <= 0) {
+		return(0);
+	}
+	return(bool_round_up ? ((nsec + TICK_NSEC - 1) / TICK_NSEC) : (nsec / TICK_NSEC));
+}
+
+// 猶予を考慮して、タイムアウトするティックを決める。
+// 猶予の範囲で、下位のビットがなるべく多く０になるティックを選ぶ。
+// （範囲が重なるタイマは同じティックになりやすい）
+CTimerCBList::TICK CTimerCBList::toExpire(long long deadline, long long nsec_slack)
+{
+	TICK expire = toTick(deadline, true);
+	if (nsec_slack <= 0) {
+		return(expire);
+	}
+	TICK limit = toTick(deadline + nsec_slack, false);
+	if (limit <= expire) {
+		return(expire);
+	}
+	// 範囲内で異なる最上位のビットより下を０にする。
+	int bit = 63 - __builtin_clzll(expire ^ limit);
+	return(limit & ~((static_cast<TICK>(1) << bit) - 1));
+}
+
+// タイマをホイールに入れる。（m_mutex取得済みで呼び出す）
+// タイムアウトまでのティック数で段を決め、タイムアウトするティックでスロットを決める。
+void CTimerCBList::add(CNode *p_node)
+{
+	CLink *p_list = &m_expired;
+	p_node->m_level = (-1);
+	if (p_node->m_expire >= m_cur_tick) {
+		const TICK max_diff = (static_cast<TICK>(1) << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+		TICK diff = p_node->m_expire - m_cur_tick;
+		int level = 0;
+		while ((level < (WHEEL_LEVELS - 1)) && (diff >> (WHEEL_BITS * (level + 1)))) {
+			level++;
+		}
+		// 最上段を超える場合は、最上段の最後に入れ、下ろす時に入れ直す。
+		TICK expire = (diff > max_diff) ? (m_cur_tick + max_diff) : p_node->m_expire;
+		int slot = static_cast<int>((expire >> (WHEEL_BITS * level)) & WHEEL_MASK);
+		p_node->m_level = level;
+		p_node->m_slot  = slot;
+		p_list = &m_slot[level][slot];
+		m_bitmap[level] |= (1ULL << slot);
+	}
+	// 末尾に繋ぐ。
+	p_node->m_p_prev = p_list->m_p_prev;
+	p_node->m_p_next = p_list;
+	p_list->m_p_prev->m_p_next = p_node;
+	p_list->m_p_prev = p_node;
+}
+
+// タイマをホイール（又はタイムアウト済みのリスト）から外す。（m_mutex取得済みで呼び出す）
+void CTimerCBList::unlink(CNode *p_node)
+{
+	p_node->m_p_prev->m_p_next = p_node->m_p_next;
+	p_node->m_p_next->m_p_prev = p_node->m_p_prev;
+	p_node->m_p_prev = p_node;
+	p_node->m_p_next = p_node;
+	if ((p_node->m_level >= 0) && m_slot[p_node->m_level][p_node->m_slot].empty()) {
+		m_bitmap[p_node->m_level] &= ~(1ULL << p_node->m_slot);
+	}
+}
+
+// タイマを削除する。（m_mutex取得済みで呼び出す）
+void CTimerCBList::remove(CNode *p_node)
+{
+	unlink(p_node);
+	if (p_node->m_p_id_prev) {
+		p_node->m_p_id_prev->m_p_id_next = p_node->m_p_id_next;
+	} else if (p_node->m_p_id_next) {
+		m_map_p_node[p_node->m_timer_id] = p_node->m_p_id_next;
+	} else {
+		m_map_p_node.erase(p_node->m_timer_id);
+	}
+	if (p_node->m_p_id_next) {
+		p_node->m_p_id_next->m_p_id_prev = p_node->m_p_id_prev;
+	}
+	freeNode(p_node);
+}
+
+// 管理表からタイマを確保する。（m_mutex取得済みで呼び出す）
+CTimerCBList::CNode* CTimerCBList::allocNode()
+{
+	if (m_p_free_node == NULL) {
+		// 空きがなければ、管理表を広げる。
+		unsigned int base = static_cast<unsigned int>(m_vec_p_chunk.size() * NODE_CHUNK);
+		CNode *p_chunk = new CNode[NODE_CHUNK];
+		m_vec_p_chunk.push_back(p_chunk);
+		for (int i = (NODE_CHUNK - 1); i >= 0; i--) {
+			p_chunk[i].m_index      = base + i;
+			p_chunk[i].m_generation = 1;
+			p_chunk[i].m_p_msg      = NULL;
+			p_chunk[i].m_p_id_next  = m_p_free_node;
+			m_p_free_node = &p_chunk[i];
+		}
+	}
+	CNode *p_node = m_p_free_node;
+	m_p_free_node = p_node->m_p_id_next;
+	return(p_node);
+}
+
+// タイマを管理表に返す。（m_mutex取得済みで呼び出す）
+// 世代番号を進め、古いタイマハンドルを無効にする。（０は未設定のため飛ばす）
+void CTimerCBList::freeNode(CNode *p_node)
+{
+	if (p_node->m_p_msg) {
+		delete p_node->m_p_msg;		// 取り出されずに削除された。
+		p_node->m_p_msg = NULL;
+	}
+	if (++p_node->m_generation == 0) {
+		p_node->m_generation = 1;
+	}
+	p_node->m_p_id_next = m_p_free_node;
+	m_p_free_node = p_node;
+}
+
+// 上の段のスロットのタイマを、下の段に入れ直す。（m_mutex取得済みで呼び出す）
+void CTimerCBList::cascade(int level, int slot)
+{
+	CLink *p_list = &m_slot[level][slot];
+	while (!p_list->empty()) {
+		CNode *p_node = static_cast<CNode*>(p_list->m_p_next);
+		unlink(p_node);
+		add(p_node);
+	}
+}
+
+// 指定したティックまで進め、タイムアウトしたタイマをタイムアウト済みのリストに移す。
+// タイマのないティックは飛ばすので、長く待っていても処理はタイマ数に比例する。
+// （m_mutex取得済みで呼び出す）
+void CTimerCBList::advance(TICK now)
+{
+	while (m_cur_tick <= now) {
+		TICK tick;
+		if (!nextTick(&tick) || (tick > now)) {
+			m_cur_tick = now + 1;
+			break;
+		}
+		m_cur_tick = tick;
+		// 段の区切りであれば、上の段から下ろす。
+		for (int level = 1; level < WHEEL_LEVELS; level++) {
+			if (m_cur_tick & ((static_cast<TICK>(1) << (WHEEL_BITS * level)) - 1)) {
+				break;
+			}
+			cascade(level, static_cast<int>((m_cur_tick >> (WHEEL_BITS * level)) & WHEEL_MASK));
+		}
+		// 最下段のスロットは、全てこのティックでタイムアウトする。
+		CLink *p_list = &m_slot[0][m_cur_tick & WHEEL_MASK];
+		while (!p_list->empty()) {
+			CNode *p_node = static_cast<CNode*>(p_list->m_p_next);
+			unlink(p_node);
+			p_node->m_p_prev = m_expired.m_p_prev;
+			p_node->m_p_next = &m_expired;
+			m_expired.m_p_prev->m_p_next = p_node;
+			m_expired.m_p_prev = p_node;
+			p_node->m_level = (-1);
+		}
+		m_cur_tick++;
+	}
+}
+
+// 次に処理が必要なティック（タイムアウト又は下の段に移す）を返す。
+// （m_mutex取得済みで呼び出す）
+bool CTimerCBList::nextTick(TICK *p_tick) const
+{
+	bool bool_found = false;
+	for (int level = 0; level < WHEEL_LEVELS; level++) {
+		if (m_bitmap[level] == 0) {
+			continue;
+		}
+		// この段のスロットを次に処理するティック（段の区切りに切り上げ）
+		TICK unit  = static_cast<TICK>(1) << (WHEEL_BITS * level);
+		TICK start = (m_cur_tick + unit - 1) & ~(unit - 1);
+		int  index = static_cast<int>((start >> (WHEEL_BITS * level)) & WHEEL_MASK);
+		unsigned long long bitmap = m_bitmap[level];
+		if (index) {
+			bitmap = (bitmap >> index) | (bitmap << (WHEEL_SIZE - index));
+		}
+		TICK tick = start + (static_cast<TICK>(__builtin_ctzll(bitmap)) * unit);
+		if (!bool_found || (tick < *p_tick)) {
+			*p_tick = tick;
+			bool_found = true;
+		}
+	}
+	return(bool_found);
+}
+
+#if __cplusplus >= 201103L
+////////////////////////////////////////////////////////////////////////////////
+// フューチャの共有状態クラス
+////////////////////////////////////////////////////////////////////////////////
+
+// コンストラクタ
+CFutureState::CFutureState()
+: m_ref(0)
+, m_status(STS_PENDING)
+, m_waiting(0)
+, m_p_reply_thread(NULL)
+, m_p_reply_msg(NULL)
+{
+	pthread_mutex_init(&m_mutex, NULL);
+#ifdef CTB_COND_MONOTONIC
+	// タイムアウトは時刻合わせの影響を受けないよう、CLOCK_MONOTONIC で待つ。
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&m_cond, &attr);
+	pthread_condattr_destroy(&attr);
+#else
+	pthread_cond_init(&m_cond, NULL);
+#endif
+}
+
+// デストラクタ
+CFutureState::~CFutureState()
+{
+	delete m_p_reply_msg;	// 完了せずに解放された場合のみ残っている。
+	pthread_cond_destroy(&m_cond);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+// 完了を待つ。
+int CFutureState::wait(int msec_timeout)
+{
+	int sts = status();
+	if (sts != STS_PENDING) {
+		return(sts);
+	}
+	struct timespec abstime;
+	if (msec_timeout >= 0) {
+#ifdef CTB_COND_MONOTONIC
+		long long target_time = CTimerCBList::getTime() + (msec_timeout * 1000000LL);
+		abstime.tv_sec  = static_cast<time_t>(target_time / 1000000000LL);
+		abstime.tv_nsec = static_cast<long>(target_time % 1000000000LL);
+#else
+		CTimeVal target_time(CTimeVal::CURRENT);
+		target_time.addMS(msec_timeout);
+		abstime.tv_sec  = target_time.tv_sec;
+		abstime.tv_nsec = target_time.tv_usec * 1000;
+#endif
+	}
+	pthread_mutex_lock(&m_mutex);
+	// 待ちを宣言してから状態を確認する。（finish()と対）
+	__atomic_store_n(&m_waiting, 1, __ATOMIC_SEQ_CST);
+	// 宣言と状態の読み出しが入れ替わると、起こされずに待ち続けることがある。
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	while ((sts = status()) == STS_PENDING) {
+		if (msec_timeout < 0) {
+			pthread_cond_wait(&m_cond, &m_mutex);
+		} else if (pthread_cond_timedwait(&m_cond, &m_mutex, &abstime) == ETIMEDOUT) {
+			sts = status();
+			break;
+		}
+	}
+	pthread_mutex_unlock(&m_mutex);
+	return((sts == STS_PENDING) ? static_cast<int>(CThreadBase::ERR_TIMEOUT) : sts);
+}
+
+// 正常で完了させる。
+bool CFutureState::completeOK()
+{
+	return(complete(CThreadBase::ERR_OK));
+}
+
+// 応答なしで完了させる。
+bool CFutureState::abandon()
+{
+	return(complete(CThreadBase::ERR_TERMINATE));
+}
+
+// 完了処理を終了する。
+void CFutureState::finish(int sts)
+{
+	__atomic_store_n(&m_status, sts, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	// wait()で待っているスレッドがある時だけ起こす。（wait()と対）
+	if (__atomic_load_n(&m_waiting, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&m_mutex);
+		pthread_cond_broadcast(&m_cond);
+		pthread_mutex_unlock(&m_mutex);
+	}
+	// 応答メッセージは完了させた１つのスレッドだけが送る。（確保済みなので領域を確保しない）
+	CThreadMsg *p_msg = __atomic_exchange_n(&m_p_reply_msg, static_cast<CThreadMsg*>(NULL), __ATOMIC_ACQ_REL);
+	if (p_msg) {
+		m_p_reply_thread->postMsg(p_msg);
+	}
+}
+
+// 正常で完了処理を終了する。
+void CFutureState::finishOK()
+{
+	finish(CThreadBase::ERR_OK);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// スレッド配置クラス
+////////////////////////////////////////////////////////////////////////////////
+
+// コンストラクタ
+CThreadPlacement::CThreadPlacement()
+: m_cpus(0)
+, m_node(NODE_ANY)
+, m_bool_node_pool(false)
+, m_policy(POLICY_INHERIT)
+, m_priority(0)
+, m_stack_size(0)
+{
+#if defined(__linux__)
+	CPU_ZERO(&m_cpuset);
+#endif
+}
+
+// 動かす CPU を追加する。
+int CThreadPlacement::addCPU(int cpu)
+{
+#if defined(__linux__)
+	if ((cpu < 0) || (cpu >= CPU_SETSIZE)) {
+		return(-1);
+	}
+	if (!CPU_ISSET(cpu, &m_cpuset)) {
+		CPU_SET(cpu, &m_cpuset);
+		m_cpus++;
+	}
+	return(0);
+#else
+	return(-1);
+#endif
+}
+
+// 動かす NUMA ノードを指定する。
+int CThreadPlacement::setNode(int node, bool bool_node_pool)
+{
+#if defined(__linux__)
+	if ((node < 0) || (bool_node_pool && (node >= CThreadMsgPool::MAX_NODE))) {
+		return(-1);
+	}
+	// ノードの CPU は "0-3,8-11" の形式で並んでいる。
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL) {
+		return(-1);
+	}
+	int first, last;
+	while (fscanf(fp, "%d", &first) == 1) {
+		last = first;
+		int c = fgetc(fp);
+		if (c == '-') {
+			if (fscanf(fp, "%d", &last) != 1) {
+				break;
+			}
+			c = fgetc(fp);
+		}
+		for (int cpu = first; cpu <= last; cpu++) {
+			addCPU(cpu);
+		}
+		if (c != ',') {
+			break;
+		}
+	}
+	fclose(fp);
+	m_node           = node;
+	m_bool_node_pool = bool_node_pool;
+	return(0);
+#else
+	return(-1);
+#endif
+}
+
+// スケジューリングポリシーと優先度を指定する。
+int CThreadPlacement::setSchedule(int policy, int priority)
+{
+	int min = sched_get_priority_min(policy);
+	int max = sched_get_priority_max(policy);
+	if ((min == (-1)) || (max == (-1)) || (priority < min) || (priority > max)) {
+		return(-1);
+	}
+	m_policy   = policy;
+	m_priority = priority;
+	return(0);
+}
+
+// スタックサイズを指定する。
+int CThreadPlacement::setStackSize(size_t stack_size)
+{
+	if (stack_size < static_cast<size_t>(PTHREAD_STACK_MIN)) {
+		return(-1);
+	}
+	m_stack_size = stack_size;
+	return(0);
+}
+
+// スレッド名を指定する。
+int CThreadPlacement::setName(const string& name)
+{
+	if (name.size() > static_cast<size_t>(MAX_NAME)) {
+		return(-1);
+	}
+	m_name = name;
+	return(0);
+}
+
+// 何も指定していないか否か
+bool CThreadPlacement::empty() const
+{
+	return((m_cpus == 0) && (m_node == NODE_ANY) && (m_policy == POLICY_INHERIT) &&
+		   (m_stack_size == 0) && m_name.empty());
+}
+
+// スレッド属性に適用する。
+int CThreadPlacement::applyAttr(pthread_attr_t *p_pthread_attr) const
+{
+	int ret;
+	if (m_stack_size) {
+		ret = pthread_attr_setstacksize(p_pthread_attr, m_stack_size);
+		if (ret) {
+			return(ret);
+		}
+	}
+	if (m_policy != POLICY_INHERIT) {
+		struct sched_param param;
+		param.sched_priority = m_priority;
+		ret = pthread_attr_setinheritsched(p_pthread_attr, PTHREAD_EXPLICIT_SCHED);
+		if (ret == 0) {
+			ret = pthread_attr_setschedpolicy(p_pthread_attr, m_policy);
+		}
+		if (ret == 0) {
+			ret = pthread_attr_setschedparam(p_pthread_attr, &param);
+		}
+		if (ret) {
+			return(ret);
+		}
+	}
+	return(0);
+}
+
+// 起動したスレッドに適用する。
+int CThreadPlacement::applyThread(pthread_t pthread) const
+{
+#if defined(__linux__)
+	int ret;
+	if (m_cpus) {
+		ret = pthread_setaffinity_np(pthread, sizeof(m_cpuset), &m_cpuset);
+		if (ret) {
+			return(ret);
+		}
+	}
+	if (!m_name.empty()) {
+		ret = pthread_setname_np(pthread, m_name.c_str());
+		if (ret) {
+			return(ret);
+		}
+	}
+#endif
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// スレッドベースクラス（キュー、タイマ付き）
+////////////////////////////////////////////////////////////////////////////////
+
+// 例外のハンドラ
+void callback_unexpected()
+{
+	cerr << "callback unexpected handler." << endl;
+	cerr << "this thread = " << pthread_self() << endl;
+}
+
+// 処理中のスレッド（アクタの場合はワーカが処理中のアクタ）
+static __thread CThreadBase *t_p_self = NULL;
+
+// スタートルーチン
+void* start_routine(void* arg)
+{
+	set_unexpected(callback_unexpected);
+	return((reinterpret_cast<CThreadBase*>(arg))->run());
+}
+
+// コンストラクタ
+CThreadBase::CThreadBase()
+: m_pthread(0)
+, m_pthread_copy(0)
+, m_bool_shutdown(false)
+, m_thread_no(-1)
+, m_parent(NULL)
+, m_p_pthread_attr(NULL)
+, m_bool_abort(false)
+, m_waiting(0)
+, m_batch_size(DEFAULT_BATCH_SIZE)
+, m_vp_ret(NULL)
+, m_p_scheduler(NULL)
+, m_bool_initiated(false)
+, m_bool_finished(false)
+, m_actor_running(0)
+, m_listener_busy(0)
+, m_watermark_seq(0)
+, m_timer_fired(0)
+, m_timer_wakeups(0)
+, m_timer_internal(0)
+, m_p_metrics(NULL)
+, m_call_timer_id(TIMER_ID_CALL)
+{
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_mutex_init(&m_listener_mutex, NULL);
+	pthread_cond_init(&m_listener_cond, NULL);
+	setMsgHandler(&CThreadBase::onQueueWatermarkMsg);
+#if __cplusplus >= 201103L
+	setMsgHandler(&CThreadBase::onTaskMsg);
+#endif
+}
+
+// デストラクタ
+CThreadBase::~CThreadBase()
+{
+	stop();	// もし生きてたら止める。
+	setInstanceInfo(STS_DESTROY);
+	for (size_t i = 0; i < m_vec_p_handler.size(); i++) {
+		delete m_vec_p_handler[i];
+	}
+#if __cplusplus >= 201103L
+	map<int, CFutureState*>::iterator iter;
+	for (iter = m_map_p_call.begin(); iter != m_map_p_call.end(); ++iter) {
+		iter->second->release();
+	}
+#endif
+	delete m_p_metrics;
+	pthread_cond_destroy(&m_listener_cond);
+	pthread_mutex_destroy(&m_listener_mutex);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+// スレッド属性を設定する。
+int CThreadBase::setAttribute(const int thread_no, CThreadBase* parent, pthread_attr_t* p_pthread_attr)
+{
+	if (m_pthread != 0) {
+		return(ERR_CONTEXT);
+	}
+	m_thread_no	= thread_no;
+	m_parent	= parent;
+	if (p_pthread_attr) {
+		m_pthread_attr   = *p_pthread_attr;
+		m_p_pthread_attr = &m_pthread_attr;
+	}
+	int ret;
+	ret = setInstanceInfo(STS_READY);
+	return(ret);
+}
+
+// スレッド属性を設定する。（配置指定）
+int CThreadBase::setAttribute(const int thread_no, CThreadBase* parent, const CThreadPlacement& placement)
+{
+	int ret = setAttribute(thread_no, parent);
+	if (ret) {
+		return(ret);
+	}
+	return(setPlacement(placement));
+}
+
+// スレッドの配置を設定する。
+int CThreadBase::setPlacement(const CThreadPlacement& placement)
+{
+	if (m_pthread != 0) {
+		return(ERR_CONTEXT);
+	}
+	m_placement = placement;
+	return(ERR_OK);
+}
+
+// ファイルディスクリプタの監視方式を設定する。
+int CThreadBase::setReactorMode(CFileDescriptor::MODE mode)
+{
+	if (m_pthread != 0) {
+		return(ERR_CONTEXT);
+	}
+	if (m_FDs.setMode(mode)) {
+		return(ERR_CONTEXT);
+	}
+	return(ERR_OK);
+}
+
+// スレッドキューの方式を設定する。
+int CThreadBase::setQueueMode(CThreadQueue::MODE mode)
+{
+	if (m_pthread != 0) {
+		return(ERR_CONTEXT);
+	}
+	if (m_queue.setMode(mode)) {
+		return(ERR_CONTEXT);
+	}
+	return(ERR_OK);
+}
+
+// スレッドキューのレーン（優先度）を設定する。
+int CThreadBase::setQueueLanes(int lanes, CThreadQueue::DRAIN drain, const int *p_weights)
+{
+	if (m_pthread != 0) {
+		return(ERR_CONTEXT);
+	}
+	if (m_queue.setLanes(lanes, drain, p_weights)) {
+		return(ERR_PARAM);
+	}
+	return(ERR_OK);
+}
+
+// スレッドキューの容量を設定する。
+int CThreadBase::setQueueCapacity(unsigned long capacity, CThreadQueue::FULL full)
+{
+	if (m_pthread != 0) {
+		return(ERR_CONTEXT);
+	}
+	if (m_queue.setCapacity(capacity, full)) {
+		return(ERR_PARAM);
+	}
+	return(ERR_OK);
+}
+
+// スレッドキューの水位を設定する。
+int CThreadBase::setQueueWatermark(unsigned long high, unsigned long low)
+{
+	if (m_pthread != 0) {
+		return(ERR_CONTEXT);
+	}
+	if (m_queue.setWatermark(high, low, &CThreadBase::notifyWatermark, this)) {
+		return(ERR_PARAM);
+	}
+	return(ERR_OK);
+}
+
+// スレッドキューの水位の変化を通知するスレッドを登録する。
+int CThreadBase::addQueueListener(CThreadBase *p_listener)
+{
+	if (p_listener == NULL) {
+		return(ERR_PARAM);
+	}
+	pthread_mutex_lock(&m_listener_mutex);
+	if (find(m_vec_p_listener.begin(), m_vec_p_listener.end(), p_listener) == m_vec_p_listener.end()) {
+		m_vec_p_listener.push_back(p_listener);
+	}
+	bool bool_high = isQueueHigh();
+	unsigned long long seq = ++m_watermark_seq;
+	pthread_mutex_unlock(&m_listener_mutex);
+	// p_listener は呼び出し元が生かしているので、そのまま送ってよい。
+	if (bool_high) {
+		p_listener->postMsg(new CQueueWatermarkMsg(this, true, seq), true);
+	}
+	return(ERR_OK);
+}
+
+// addQueueListener()の登録を外す。
+int CThreadBase::removeQueueListener(CThreadBase *p_listener)
+{
+	int ret = ERR_PARAM;
+	pthread_mutex_lock(&m_listener_mutex);
+	vector<CThreadBase*>::iterator iter = find(m_vec_p_listener.begin(), m_vec_p_listener.end(), p_listener);
+	if (iter != m_vec_p_listener.end()) {
+		m_vec_p_listener.erase(iter);
+		ret = ERR_OK;
+	}
+	// 写した一覧で送っている途中の通知が終わるのを待つ。（戻った後は削除されてよい）
+	while (m_listener_busy > 0) {
+		pthread_cond_wait(&m_listener_cond, &m_listener_mutex);
+	}
+	pthread_mutex_unlock(&m_listener_mutex);
+	return(ret);
+}
+
+// 一度に処理するメッセージ数を設定する。
+int CThreadBase::setBatchSize(int batch_size)
+{
+	if (batch_size < 1) {
+		return(ERR_PARAM);
+	}
+	if (m_pthread != 0) {
+		return(ERR_CONTEXT);
+	}
+	m_batch_size = batch_size;
+	return(ERR_OK);
+}
+
+// 実行統計を取るか否かを設定する。
+int CThreadBase::setMetrics(bool bool_metrics)
+{
+	if (m_pthread != 0) {
+		return(ERR_CONTEXT);
+	}
+	if (m_queue.setPeak(bool_metrics)) {
+		return(ERR_CONTEXT);
+	}
+	if (bool_metrics && (m_p_metrics == NULL)) {
+		m_p_metrics = new METRICS();	// 全て０
+	} else if (!bool_metrics) {
+		delete m_p_metrics;
+		m_p_metrics = NULL;
+	}
+	return(ERR_OK);
+}
+
+// 実行統計を取得する。
+int CThreadBase::getMetrics(METRICS *p_metrics)
+{
+	if (p_metrics == NULL) {
+		return(ERR_PARAM);
+	}
+	if (m_p_metrics == NULL) {
+		return(ERR_CONTEXT);
+	}
+	p_metrics->queue_depth = m_queue.size();
+	p_metrics->queue_peak  = m_queue.getPeak();
+	p_metrics->processed   = __atomic_load_n(&m_p_metrics->processed, __ATOMIC_RELAXED);
+	p_metrics->wakeups     = __atomic_load_n(&m_p_metrics->wakeups,   __ATOMIC_RELAXED);
+	loadHistogram(&m_p_metrics->latency,    &p_metrics->latency);
+	loadHistogram(&m_p_metrics->msg_time,   &p_metrics->msg_time);
+	loadHistogram(&m_p_metrics->timer_time, &p_metrics->timer_time);
+	loadHistogram(&m_p_metrics->event_time, &p_metrics->event_time);
+	loadHistogram(&m_p_metrics->timer_late, &p_metrics->timer_late);
+	return(ERR_OK);
+}
+
+// スレッド番号を指定して実行統計を取得する。
+int CThreadBase::getMetrics(const int thread_no, METRICS *p_metrics)
+{
+	int thread_status;
+	CThreadBase *p_thread_base = getInstance(thread_no, &thread_status);
+	if ((p_thread_base == NULL) || (thread_status == STS_DESTROY)) {
+		return(ERR_PARAM);
+	}
+	return(p_thread_base->getMetrics(p_metrics));
+}
+
+// 実行統計の分布に加える。
+// 書き込むのは自スレッドだけなので、読み出し側が欠けた値を読まないようアトミックに置き換えるだけでよい。
+void CThreadBase::addSample(HISTOGRAM *p_histogram, long long nsec)
+{
+	unsigned long long value = (nsec > 0) ? static_cast<unsigned long long>(nsec) : 0;
+	// 区分は 2 を底とした桁数（0 は区分 0）
+	int bucket = (value == 0) ? 0 : (64 - __builtin_clzll(value));
+	if (bucket >= NUM_BUCKET) {
+		bucket = NUM_BUCKET - 1;
+	}
+	__atomic_store_n(&p_histogram->bucket[bucket], p_histogram->bucket[bucket] + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&p_histogram->nsec_total, p_histogram->nsec_total + value, __ATOMIC_RELAXED);
+	if (value > p_histogram->nsec_max) {
+		__atomic_store_n(&p_histogram->nsec_max, value, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&p_histogram->count, p_histogram->count + 1, __ATOMIC_RELAXED);
+}
+
+// 実行統計の分布を読む。
+void CThreadBase::loadHistogram(const HISTOGRAM *p_src, HISTOGRAM *p_dst)
+{
+	p_dst->count      = __atomic_load_n(&p_src->count,      __ATOMIC_RELAXED);
+	p_dst->nsec_total = __atomic_load_n(&p_src->nsec_total, __ATOMIC_RELAXED);
+	p_dst->nsec_max   = __atomic_load_n(&p_src->nsec_max,   __ATOMIC_RELAXED);
+	for (int i = 0; i < NUM_BUCKET; i++) {
+		p_dst->bucket[i] = __atomic_load_n(&p_src->bucket[i], __ATOMIC_RELAXED);
+	}
+}
+
+// タイマが使う時計を設定する。
+int CThreadBase::setClock(CClock *p_clock)
+{
+	if (m_pthread != 0) {
+		return(ERR_CONTEXT);
+	}
+	return(m_TimerCBList.setClock(p_clock, &m_notifier));
+}
+
+// アクタとして動かすスケジューラを設定する。
+int CThreadBase::setScheduler(CActorScheduler *p_scheduler)
+{
+	if (m_pthread != 0) {
+		return(ERR_CONTEXT);
+	}
+	m_p_scheduler = p_scheduler;
+	return(ERR_OK);
+}
+
+// スレッドを起動する。
+int CThreadBase::start()
+{
+	if (m_pthread != 0) {
+		return(ERR_CONTEXT);
+	}
+	int ret;
+	ret = onPreThreadCreate();
+	if (ret) {
+		return(ret);
+	}
+	if (m_p_scheduler) {
+		if (!m_placement.empty()) {
+			return(ERR_CONTEXT);
+		}
+		return(startActor());
+	}
+	// 配置はスレッド属性の写しに適用する。（setAttribute()の属性は変えない）
+	pthread_attr_t	pthread_attr;
+	pthread_attr_t*	p_pthread_attr = m_p_pthread_attr;
+	bool bool_attr_init = false;
+	if (!m_placement.empty()) {
+		if (m_p_pthread_attr) {
+			pthread_attr = *m_p_pthread_attr;
+		} else {
+			pthread_attr_init(&pthread_attr);
+			bool_attr_init = true;
+		}
+		p_pthread_attr = &pthread_attr;
+		ret = m_placement.applyAttr(p_pthread_attr);
+		if (ret) {
+			if (bool_attr_init) {
+				pthread_attr_destroy(&pthread_attr);
+			}
+			return(ret);
+		}
+	}
+	m_queue.open();
+	pthread_mutex_lock(&m_mutex);
+	ret = pthread_create(&m_pthread, p_pthread_attr, start_routine, (void*)this);
+	m_pthread_copy = m_pthread;
+	if (ret == 0) {
+		// CPU とスレッド名は、run()が動き出す前（m_mutex 取得中）に設定する。
+		ret = m_placement.applyThread(m_pthread);
+		if (ret) {
+			m_bool_abort = true;
+		}
+	}
+	pthread_mutex_unlock(&m_mutex);
+	if (bool_attr_init) {
+		pthread_attr_destroy(&pthread_attr);
+	}
+	if (m_bool_abort) {
+		pthread_join(m_pthread, NULL);
+		m_bool_abort = false;
+		m_pthread = 0;
+		m_queue.close();
+	}
+	if (ret) {
+		return(ret);
+	}
+	return(ret);
+}
+
+// スレッドを終了する。
+int CThreadBase::stop(bool bool_join, bool bool_immediately, void* vp_ret)
+{
+	return(stop_join(true, bool_join, bool_immediately, vp_ret));
+}
+
+// スレッド終了を待つ。
+int CThreadBase::join()
+{
+	return(stop_join(false, true));
+}
+
+// スレッド終了、スレッド終了待ち合わせ。
+int CThreadBase::stop_join(bool bool_stop, bool bool_join, bool bool_immediately, void* vp_ret)
+{
+	if (m_pthread == 0) {
+		return(ERR_CONTEXT);
+	}
+	if (isSelf()) {
+		return(ERR_CONTEXT);
+	}
+	if (bool_stop) {
+		shutdown(bool_immediately, vp_ret);
+	}
+	if (bool_join) {
+		if (m_p_scheduler) {
+			m_p_scheduler->join(this);
+		} else {
+			pthread_join(m_pthread, NULL);
+		}
+		m_pthread = 0;
+		onPostThreadJoin();
+	}
+	return(ERR_OK);
+}
+
+// 自スレッドにスレッド終了メッセージをキューイングする。
+void CThreadBase::shutdown(bool bool_immediately, void* vp_ret)
+{
+	if (active() == false) {
+		return;
+	}
+	CStopMsg *p_stop_msg = new CStopMsg(vp_ret);
+	postMsg(p_stop_msg, bool_immediately);
+
+	m_bool_shutdown = true;
+	setInstanceInfo(STS_SHUTDOWN);
+}
+
+// スレッドのレーンを指定して、メッセージをキューイングする。
+int CThreadBase::postMsgToLane(CThreadMsg *p_msg, int lane)
+{
+	int ret = putMsgToLane(p_msg, lane);
+	if ((ret != ERR_OK) && (ret != ERR_SYSTEM)) {
+		delete p_msg;
+	}
+	return(ret);
+}
+
+// スレッドにメッセージをキューイングする。
+int CThreadBase::postMsg(CThreadMsg *p_msg, bool bool_high_prior)
+{
+	int ret = putMsg(p_msg, bool_high_prior);
+	if ((ret != ERR_OK) && (ret != ERR_SYSTEM)) {
+		// エラーの時はメッセージを削除する。
+		// postMsg()したメッセージは、責任を持って削除する。
+		// 呼び出し側に負担をかけない。
+		delete p_msg;
+	}
+	return(ret);
+}
+
+// スレッドのレーンにメッセージをキューイングする。（異常時も削除しない）
+int CThreadBase::putMsgToLane(CThreadMsg *p_msg, int lane)
+{
+	int ret = ERR_OK;
+	if (p_msg == NULL) {
+		return(ERR_PARAM);
+	}
+	if (active() == false) {
+		if (m_pthread == 0) {
+			ret = ERR_CONTEXT;
+		} else {
+			ret = ERR_TERMINATE;
+		}
+		return(ret);
+	}
+	if (m_p_metrics) {
+		p_msg->m_nsec_posted = CTimerCBList::getTime();
+	}
+	// 自スレッドから待つと戻れない。終了と水位の通知は止めない。
+	bool bool_force = isSelf() ||
+					  msg_cast<CStopMsg>(p_msg) || msg_cast<CQueueWatermarkMsg>(p_msg);
+	switch (m_queue.putLane(p_msg, lane, bool_force)) {
+	case CThreadQueue::PUT_OK:
+		break;
+	case CThreadQueue::PUT_FULL:
+		return(ERR_BUSY);
+	case CThreadQueue::PUT_CLOSED:
+		return(ERR_TERMINATE);
+	default:
+		return(ERR_PARAM);
+	}
+	return(wakeup());
+}
+
+// 待ち状態であれば通知して起こす。
+int CThreadBase::wakeup()
+{
+	// 自スレッドへのキューイングは通知不要。
+	// run()は待ち状態に入る前に必ずキューを確認する。
+	if (isSelf()) {
+		return(ERR_OK);
+	}
+	// スレッドへの通知
+	// 待ち状態の時だけ通知する。起きているスレッドはキューが空になるまで処理する。
+	// 複数の送信元が同時に来ても、フラグを落とした１つだけが通知する。
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&m_waiting, __ATOMIC_RELAXED) &&
+		__atomic_exchange_n(&m_waiting, 0, __ATOMIC_SEQ_CST)) {
+		if (m_notifier.notify()) {
+			return(ERR_SYSTEM);
+		}
+	}
+	return(ERR_OK);
+}
+
+// 自スレッド（アクタの場合は処理中のワーカ）から呼ばれたか否か
+bool CThreadBase::isSelf() const
+{
+	return(t_p_self == this);
+}
+
+// 水位の変化を登録されたスレッドに送る。
+// 送信元（高水位）か受信先（低水位）のスレッドで呼ばれる。
+void CThreadBase::notifyWatermark(void *vp_arg, bool /*bool_high*/)
+{
+	CThreadBase *p_this = static_cast<CThreadBase*>(vp_arg);
+	// 状態は変化を通知した時点ではなく、番号を振る時点のものを送る。
+	// 通知が前後しても、受信側で番号の古いものを捨てれば最後の状態に揃う。
+	// 送る先の水位の通知が戻ってきても止まらないよう、写してからロックを外して送る。
+	// 送っている間は removeQueueListener()が待つので、送る先は削除されない。
+	pthread_mutex_lock(&p_this->m_listener_mutex);
+	vector<CThreadBase*> vec_p_listener(p_this->m_vec_p_listener);
+	bool bool_high = p_this->isQueueHigh();
+	unsigned long long seq = ++p_this->m_watermark_seq;
+	p_this->m_listener_busy++;
+	pthread_mutex_unlock(&p_this->m_listener_mutex);
+	for (size_t i = 0; i < vec_p_listener.size(); i++) {
+		vec_p_listener[i]->postMsg(new CQueueWatermarkMsg(p_this, bool_high, seq), true);
+	}
+	pthread_mutex_lock(&p_this->m_listener_mutex);
+	if (--p_this->m_listener_busy == 0) {
+		pthread_cond_broadcast(&p_this->m_listener_cond);
+	}
+	pthread_mutex_unlock(&p_this->m_listener_mutex);
+}
+
+// 水位通知メッセージを受信した。
+int CThreadBase::onQueueWatermarkMsg(CQueueWatermarkMsg *p_msg)
+{
+	// 送信元は削除されているかもしれないので参照しない。
+	// 追い越された古い通知は捨てる。
+	unsigned long long& seq = m_map_watermark_seq[p_msg->m_p_thread];
+	if (p_msg->m_seq < seq) {
+		return(ERR_OK);
+	}
+	seq = p_msg->m_seq;
+	return(onQueueWatermark(p_msg->m_p_thread, p_msg->m_bool_high));
+}
+
+// 指定時間後に、スレッドにメッセージをキューイングする。
+int CThreadBase::postMsgAfter(CThreadMsg *p_msg, int msec_delay, CTimerHandle *p_handle)
+{
+	if (msec_delay < 0) {
+		delete p_msg;
+		return(ERR_PARAM);
+	}
+	return(postMsgAt(p_msg, now() + (msec_delay * 1000000LL), p_handle));
+}
+
+// 指定時刻に、スレッドにメッセージをキューイングする。
+int CThreadBase::postMsgAt(CThreadMsg *p_msg, long long nsec_deadline, CTimerHandle *p_handle)
+{
+	if (p_msg == NULL) {
+		return(ERR_PARAM);
+	}
+	if (active() == false) {
+		delete p_msg;
+		return((m_pthread == 0) ? ERR_CONTEXT : ERR_TERMINATE);
+	}
+	int ret = m_TimerCBList.setMsg(nsec_deadline, TIMER_ID_MSG, p_msg, p_handle);
+	if (ret) {
+		delete p_msg;
+		return(ret);
+	}
+	// timerfd がなければ、待ち時間を計算し直させる。
+	if (m_TimerCBList.getFD() == (-1)) {
+		wakeup();
+	}
+	return(ERR_OK);
+}
+
+// タスクプールでタスクを実行し、完了をメッセージで受け取る。
+int CThreadBase::submitTask(CTaskPool *p_pool, CPoolTask *p_task)
+{
+	if (p_task == NULL) {
+		return(ERR_PARAM);
+	}
+	int ret = ERR_OK;
+	if (p_pool == NULL) {
+		ret = ERR_PARAM;
+	} else if (active() == false) {
+		ret = (m_pthread == 0) ? ERR_CONTEXT : ERR_TERMINATE;
+	} else {
+		ret = p_pool->submit(p_task, this);
+	}
+	if (ret != ERR_OK) {
+		delete p_task;
+	}
+	return(ret);
+}
+
+#if __cplusplus >= 201103L
+// タスクメッセージを実行する。
+int CThreadBase::onTaskMsg(CTaskMsg *p_msg)
+{
+	p_msg->run();
+	return(ERR_OK);
+}
+#endif
+
+#if __cplusplus >= 201103L
+// 要求をキューイングする。
+int CThreadBase::postCall(CFutureState *p_state, CThreadMsg *p_msg, bool bool_high_prior)
+{
+	int ret = putMsg(p_msg, bool_high_prior);
+	if ((ret != ERR_OK) && (ret != ERR_SYSTEM)) {
+		// キューイングできなかった理由で完了させてから削除する。
+		p_state->complete(ret);
+		delete p_msg;
+	}
+	return(ret);
+}
+
+// 要求をタスクプールに投入する。
+int CThreadBase::postPoolCall(CTaskPool *p_pool, CFutureState *p_state, CTaskMsg *p_msg)
+{
+	int ret = p_pool->push(p_msg);
+	if (ret != ERR_OK) {
+		// 投入できなかった理由で完了させてから削除する。
+		p_state->complete(ret);
+		delete p_msg;
+	}
+	return(ret);
+}
+
+// 要求のタイムアウトを監視する。
+int CThreadBase::setCallTimer(CFutureState *p_state, int msec_timeout)
+{
+	int timer_id = m_call_timer_id;
+	m_call_timer_id = (m_call_timer_id == INT_MIN) ? static_cast<int>(TIMER_ID_CALL) : (m_call_timer_id - 1);
+	CTimerCB TimerCB(msec_timeout, timer_id);
+	m_TimerCBList.set(TimerCB);
+	p_state->addRef();
+	m_map_p_call[timer_id] = p_state;
+	return(timer_id);
+}
+
+// 要求のタイムアウトの監視を終了する。（応答を受け取った）
+void CThreadBase::endCall(int timer_id)
+{
+	map<int, CFutureState*>::iterator iter = m_map_p_call.find(timer_id);
+	if (iter == m_map_p_call.end()) {
+		return;
+	}
+	m_TimerCBList.cancel(timer_id);
+	iter->second->release();
+	m_map_p_call.erase(iter);
+}
+
+// 要求がタイムアウトした。
+void CThreadBase::onCallTimeout(int timer_id)
+{
+	map<int, CFutureState*>::iterator iter = m_map_p_call.find(timer_id);
+	if (iter == m_map_p_call.end()) {
+		return;
+	}
+	CFutureState *p_state = iter->second;
+	m_map_p_call.erase(iter);
+	// 既に完了していれば、応答メッセージが届くので何もしない。
+	// 完了させた場合は、応答メッセージが自スレッドにキューイングされる。
+	p_state->complete(ERR_TIMEOUT);
+	p_state->release();
+}
+#endif
+
+// まとめて取り出したメッセージを受信した時に呼び出される。
+int CThreadBase::onMsgBatch(CThreadMsg **pp_msg, int num)
+{
+	for (int i = 0; i < num; i++) {
+		dispatchMsg(pp_msg[i]);
+	}
+	return(ERR_OK);
+}
+
+// 実行時間を計ってメッセージを振り分ける。
+int CThreadBase::dispatchMsgMetrics(CThreadMsg *p_msg)
+{
+	long long nsec_start = CTimerCBList::getTime();
+	int ret = invokeMsg(p_msg);
+	addSample(&m_p_metrics->msg_time, CTimerCBList::getTime() - nsec_start);
+	return(ret);
+}
+
+// スレッドのrun関数。
+void* CThreadBase::run()
+{
+	// 起動側スレッドがスレッド識別子を取り込むのを待ち合わせる。
+	pthread_mutex_lock(&m_mutex);
 	pthread_mutex_unlock(&m_mutex);
+	if (m_bool_abort) {
+		return(NULL);
+	}
+	if (m_placement.isNodePool()) {
+		CThreadMsgPool::setNode(m_placement.getNode());
+	}
+	t_p_self = this;
 	setInstanceInfo(STS_RUNNING);
-	void* vp_ret = NULL;
+	m_vp_ret = NULL;
 	bool bool_stop = false;
 	if (onThreadInitiate()) {
 		bool_stop = true;
 	} else {
-		appendFD(m_pipe[PIPE_READ], true, false);
+		openReactor();
+	}
+	while (!bool_stop) {
+		bool_stop = !step(true);
+	}
+	terminate();
+	return(m_vp_ret);
+}
+
+// イベント待ちの準備をする。
+void CThreadBase::openReactor()
+{
+	m_FDs.open();
+	// 通知と timerfd は fd_set を使わずに処理するので、FD_SETSIZE 以上でも登録する。
+	m_FDs.append(m_notifier.getFD(), true, false, false, true);
+	if (m_TimerCBList.getFD() != (-1)) {
+		m_FDs.append(m_TimerCBList.getFD(), true, false, false, true);
+	}
+	m_vec_p_batch.resize(m_batch_size);
+}
+
+// １回分の処理をする。
+bool CThreadBase::step(bool bool_block)
+{
+	int timer_id;
+	unsigned long long fired = 0;
+	unsigned long long internal = 0;
+	CTimerHandle timer_handle;
+	CThreadMsg *p_timer_msg;
+	long long nsec_late;
+	while (m_TimerCBList.timeout(&timer_id, &timer_handle, &p_timer_msg, m_p_metrics ? &nsec_late : NULL)) {
+		// 統計はユーザのタイマだけを数える。（(-1)未満は内部用）
+		if (timer_id < (-1)) {
+			internal++;
+		} else {
+			fired++;
+		}
+		if (m_p_metrics) {
+			addSample(&m_p_metrics->timer_late, nsec_late);
+		}
+		if (p_timer_msg) {
+			// 預かっていたメッセージをキューイングする。
+			if (putMsg(p_timer_msg, false) != ERR_OK) {
+				delete p_timer_msg;
+			}
+			continue;
+		}
+#if __cplusplus >= 201103L
+		if (timer_id <= TIMER_ID_CALL) {
+			onCallTimeout(timer_id);
+			continue;
+		}
+#endif
+		// 内部用タイマのハンドルは getTimerHandle()で見せない。
+		m_timer_handle = timer_handle;
+		if (m_p_metrics) {
+			long long nsec_start = CTimerCBList::getTime();
+			onTimer(timer_id);
+			addSample(&m_p_metrics->timer_time, CTimerCBList::getTime() - nsec_start);
+			continue;
+		}
+		onTimer(timer_id);
+	}
+	if (fired > 0) {
+		__atomic_store_n(&m_timer_fired,   m_timer_fired + fired, __ATOMIC_RELAXED);
+		__atomic_store_n(&m_timer_wakeups, m_timer_wakeups + 1,   __ATOMIC_RELAXED);
+	}
+	if (internal > 0) {
+		__atomic_store_n(&m_timer_internal, m_timer_internal + internal, __ATOMIC_RELAXED);
+	}
+
+	if (!bool_block) {
+		// アクタは待たずに、発生済みのイベントだけを処理する。
+		// 待つのはスケジューラ（アクタのエポールを監視している）
+		struct timeval time_span;
+		time_span.tv_sec  = 0;
+		time_span.tv_usec = 0;
+		int	result = m_FDs.wait(&time_span);
+		if (m_p_metrics) {
+			__atomic_store_n(&m_p_metrics->wakeups, m_p_metrics->wakeups + 1, __ATOMIC_RELAXED);
+		}
+		if (result > 0) {
+			dispatchEvents(result);
+		}
+	} else {
+		// 待ち状態を宣言してからキューを確認する。（通知の取りこぼし防止）
+		__atomic_store_n(&m_waiting, 1, __ATOMIC_SEQ_CST);
+		if (m_queue.empty()) {
+			// timerfd があれば、タイムアウトは timerfd で起こされる。
+			struct timeval time_span;
+			struct timeval *p_time_span = NULL;
+			if (m_TimerCBList.getFD() != (-1)) {
+				m_TimerCBList.arm();
+			} else {
+				long long next_time = m_TimerCBList.next_time();
+				long long nsec = next_time - m_TimerCBList.now();
+				if (nsec < 0) {
+					nsec = 0;
+				}
+				// 仮想時計は、時刻が進むまで（通知されるまで）待つ。
+				if ((next_time != 0) && ((nsec == 0) || !m_TimerCBList.getClock()->isVirtual())) {
+					// 早く起きすぎないよう、マイクロ秒未満は切り上げる。
+					long long usec = (nsec + 999) / 1000;
+					time_span.tv_sec  = static_cast<time_t>(usec / 1000000);
+					time_span.tv_usec = static_cast<suseconds_t>(usec % 1000000);
+					p_time_span = &time_span;
+				}
+			}
+
+			int	result = m_FDs.wait(p_time_span);
+			__atomic_store_n(&m_waiting, 0, __ATOMIC_RELAXED);
+			if (m_p_metrics) {
+				__atomic_store_n(&m_p_metrics->wakeups, m_p_metrics->wakeups + 1, __ATOMIC_RELAXED);
+			}
+			if (result > 0) {
+				dispatchEvents(result);
+			} else {
+				// タイムアウト
+				if ((result == 0) || (errno == EINTR)) {
+					return(true);
+				} else {
+					assert(false);
+				}
+			}
+		} else {
+			__atomic_store_n(&m_waiting, 0, __ATOMIC_RELAXED);
+		}
+	}
+
+	// まとめて取り出し、続けて処理する。
+	int num = m_queue.getBatch(&m_vec_p_batch[0], m_batch_size);
+	if (num == 0) {
+		// 送信元が登録途中の場合はありうる。
+		return(true);
+	}
+
+	// 終了メッセージ
+	// 終了メッセージ以降は処理しない。
+	bool bool_continue = true;
+	int count = 0;
+	for ( ; count < num; count++) {
+		if (CStopMsg *p_stop_msg = msg_cast<CStopMsg>(m_vec_p_batch[count])) {
+			m_vp_ret = p_stop_msg->m_vp_ret;
+			bool_continue = false;
+			break;
+		}
+	}
+
+	if (m_p_metrics && (count > 0)) {
+		long long nsec_now = CTimerCBList::getTime();
+		for (int i = 0; i < count; i++) {
+			if (m_vec_p_batch[i]->m_nsec_posted != 0) {
+				addSample(&m_p_metrics->latency, nsec_now - m_vec_p_batch[i]->m_nsec_posted);
+			}
+		}
+		__atomic_store_n(&m_p_metrics->processed, m_p_metrics->processed + count, __ATOMIC_RELAXED);
+	}
+
+	// 以下、派生先定義メッセージ
+	if (count > 0) {
+		onMsgBatch(&m_vec_p_batch[0], count);
+		// 返り値によって何かする？
+	}
+
+	// メッセージの削除は、ここで一括して行う。
+	for (int i = 0; i < num; i++) {
+		delete m_vec_p_batch[i];
+	}
+	return(bool_continue);
+}
+
+// 発生したイベントを処理する。
+void CThreadBase::dispatchEvents(int result)
+{
+	// 派生先の処理時間（実行統計を取る場合、最初に呼び出す前に時刻を読む）
+	long long nsec_start = 0;
+	if (m_FDs.isEpoll()) {
+		// エポールモードは、イベントが発生したものだけを処理する。
+		// 派生先が異常を返したら、残りのイベントは次の待ちで処理する。（select()モードと同じ）
+		bool bool_abort = false;
+		for (int i = 0; i < result; i++) {
+			int fd;
+			bool bool_read, bool_write, bool_except;
+			if (m_FDs.getEvent(i, &fd, &bool_read, &bool_write, &bool_except)) {
+				continue;
+			}
+			if (fd == m_notifier.getFD()) {
+				m_notifier.drain();
+				continue;
+			}
+			if (fd == m_TimerCBList.getFD()) {
+				m_TimerCBList.drain();
+				continue;
+			}
+			if (bool_abort) {
+				continue;	// レベルトリガなので、次の待ちで改めて通知される。
+			}
+			if (nsec_start == 0) {
+				nsec_start = m_p_metrics ? CTimerCBList::getTime() : (-1);
+			}
+			if (onEventFD(fd, bool_read, bool_write, bool_except) != ERR_OK) {
+				bool_abort = true;
+			}
+		}
+		if (m_FDs.isReady()) {
+			onEvent(&m_FDs.m_readfds, &m_FDs.m_writefds, &m_FDs.m_exceptfds);
+			m_FDs.clearReady();
+		}
+		if (nsec_start > 0) {
+			addSample(&m_p_metrics->event_time, CTimerCBList::getTime() - nsec_start);
+		}
+		return;
+	}
+	if (FD_ISSET(m_notifier.getFD(), &m_FDs.m_readfds)) {
+		FD_CLR  (m_notifier.getFD(), &m_FDs.m_readfds);	// 派生先に渡すときゴミは残さない！
+		result--;
+		m_notifier.drain();
+	}
+	if ((m_TimerCBList.getFD() != (-1)) && FD_ISSET(m_TimerCBList.getFD(), &m_FDs.m_readfds)) {
+		FD_CLR  (m_TimerCBList.getFD(), &m_FDs.m_readfds);
+		result--;
+		m_TimerCBList.drain();
+	}
+	if (result > 0) {
+		// 派生先が登録したファイルディスクリプタにイベントが発生した時に呼び出す。
+		nsec_start = m_p_metrics ? CTimerCBList::getTime() : 0;
+		onEvent(m_FDs.m_p_readfds, m_FDs.m_p_writefds, m_FDs.m_p_exceptfds);
+		if (nsec_start > 0) {
+			addSample(&m_p_metrics->event_time, CTimerCBList::getTime() - nsec_start);
+		}
+	}
+}
+
+// 終了処理をする。
+void CThreadBase::terminate()
+{
+	onThreadTerminate();
+	// 空きを待っている送信元を戻す。
+	m_queue.close();
+	removeFD(m_notifier.getFD());
+	if (m_TimerCBList.getFD() != (-1)) {
+		removeFD(m_TimerCBList.getFD());
+	}
+	m_FDs.close();
+	setInstanceInfo(STS_STOP);	// 正確にはまだSTOPしてないが。
+}
+
+// アクタを起動する。
+int CThreadBase::startActor()
+{
+	// スケジューラはアクタのエポールを監視する。
+	m_FDs.open();
+	if (!m_FDs.isEpoll() || (m_TimerCBList.getFD() == (-1))) {
+		m_FDs.close();
+		return(ERR_CONTEXT);
+	}
+	openReactor();
+	m_vp_ret         = NULL;
+	m_bool_initiated = false;
+	m_bool_finished  = false;
+	m_queue.open();
+	pthread_mutex_lock(&m_mutex);
+	// スレッドは作らないが、起動済みと分かるよう識別子を入れておく。
+	m_pthread = m_pthread_copy = pthread_self();
+	pthread_mutex_unlock(&m_mutex);
+	// 最初の処理（onThreadInitiate()）を予約する。
+	m_notifier.notify();
+	int ret = m_p_scheduler->attach(this);
+	if (ret) {
+		m_queue.close();
+		removeFD(m_notifier.getFD());
+		removeFD(m_TimerCBList.getFD());
+		m_FDs.close();
+		m_pthread = 0;
+	}
+	return(ret);
+}
+
+// アクタの処理をする。（ワーカから呼ばれる）
+bool CThreadBase::runActor()
+{
+	t_p_self = this;
+	__atomic_store_n(&m_waiting, 0, __ATOMIC_RELAXED);
+	bool bool_continue = true;
+	if (!m_bool_initiated) {
+		m_bool_initiated = true;
+		setInstanceInfo(STS_RUNNING);
+		if (onThreadInitiate()) {
+			bool_continue = false;
+		}
+	}
+	if (bool_continue) {
+		bool_continue = step(false);
+	}
+	if (bool_continue) {
+		park();
+	} else {
+		// エポールを閉じる前に、スケジューラの監視から外す。
+		m_p_scheduler->detach(this);
+		terminate();
 	}
+	t_p_self = NULL;
+	return(bool_continue);
+}
 
-	while (!bool_stop) {
-		int ret;
-
-		int timer_id;
-		while (m_TimerCBList.timeout(&timer_id)) {
-			onTimer(timer_id);
+// アクタの処理を終える時に、続きがあれば起こされるようにする。
+void CThreadBase::park()
+{
+	// 待ち状態を宣言してからキューを確認する。（通知の取りこぼし防止）
+	__atomic_store_n(&m_waiting, 1, __ATOMIC_SEQ_CST);
+	if (!m_queue.empty()) {
+		// 残りは他のアクタの後に処理する。
+		// 送信元が先に通知していれば、通知し直さない。
+		if (__atomic_exchange_n(&m_waiting, 0, __ATOMIC_SEQ_CST)) {
+			m_notifier.notify();
 		}
+	}
+	m_TimerCBList.arm();
+}
 
-		if (m_queue.empty()) {
-			CTimeVal time_span(CTimeVal::CLEAR);
-			CTimeVal next_time = m_TimerCBList.next_time();
-			if (next_time.isSet()) {
-				CTimeVal current_time(CTimeVal::CURRENT);
-				if (next_time > current_time) {
-					time_span = next_time.getSpan(current_time);
-				}
-			} else {
-				time_span.tv_sec	= 60*60*24*365;	// １年待ち（実装の都合）
-				time_span.tv_usec	= 0;
-			}
+////////////////////////////////////////////////////////////////////////////////
+// 状態収集スレッド クラス インスタンス管理
+////////////////////////////////////////////////////////////////////////////////
+pthread_mutex_t	CThreadBase::g_class_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-			m_FDs.rebuild();
+// 管理テーブル
+// スレッド番号で引くハッシュ表（オープンアドレス法）と、登録順の配列を持つ。
+// 表は作り直す時に丸ごと新しくし、公開した表の中身は登録の追加以外では変えない。
+struct CThreadBase::_ThreadTable
+{
+	size_t			capacity;		// ハッシュ表の大きさ（２のべき乗）
+	_ThreadCB**		pp_hash;		// ハッシュ表（空きは NULL）
+	size_t			max_index;		// 登録順の配列の大きさ
+	_ThreadCB**		pp_index;		// 登録順の配列
+	size_t			num;			// 登録数（アトミックに読み書きする）
+	_ThreadTable*	p_retired;		// 大きくする前の表（解放しないで繋いでおく）
 
-			int	result = select(m_FDs.m_maxfd_plus1,
-								m_FDs.m_p_readfds,
-								m_FDs.m_p_writefds,
-								m_FDs.m_p_exceptfds,
-								&time_span);
-			if (result > 0) {
-				if (FD_ISSET(m_pipe[PIPE_READ], &m_FDs.m_readfds)) {
-					FD_CLR  (m_pipe[PIPE_READ], &m_FDs.m_readfds);	// 派生先に渡すときゴミは残さない！
-					result--;
-					char buf;
-					assert(read(m_pipe[PIPE_READ], &buf, 1) == 1);
-					assert(buf == '!');
-				}
-				if (result > 0) {
-					// 派生先が登録したファイルディスクリプタにイベントが発生した時に呼び出す。
-					ret = onEvent(m_FDs.m_p_readfds, m_FDs.m_p_writefds, m_FDs.m_p_exceptfds);
-				}
-			} else {
-				// タイムアウト
-				if (result == 0) {
-					continue;
-				} else {
-					assert(false);
-				}
-			}
-		}
+	// スレッド番号のハッシュ値
+	size_t hash(int thread_no) const
+	{
+		return((static_cast<unsigned int>(thread_no) * 2654435761U) & (capacity - 1));
+	}
+};
 
-		CThreadMsg *p_msg;
-		ret = m_queue.get(&p_msg);
-		if (ret) {
-			// これはないはずだが！
-			continue;
-		}
+CThreadBase::_ThreadTable*	CThreadBase::g_p_thread_table = NULL;
 
-		// 終了メッセージ
-		if (CStopMsg *p_stop_msg = dynamic_cast<CStopMsg*>(p_msg)) {
-			vp_ret = p_stop_msg->m_vp_ret;
-			bool_stop = true;
-		} else {
-			// 以下、派生先定義メッセージ
-			ret = onMsg(p_msg);
-			// ret によって何かする？
+// スレッド番号で管理テーブルを引く。
+CThreadBase::_ThreadCB* CThreadBase::findThreadCB(const int thread_no)
+{
+	_ThreadTable *p_table = __atomic_load_n(&g_p_thread_table, __ATOMIC_ACQUIRE);
+	if (p_table == NULL) {
+		return(NULL);
+	}
+	for (size_t i = p_table->hash(thread_no); ; i = (i + 1) & (p_table->capacity - 1)) {
+		_ThreadCB *p_cb = __atomic_load_n(&p_table->pp_hash[i], __ATOMIC_ACQUIRE);
+		if (p_cb == NULL) {
+			return(NULL);
 		}
-
-		// メッセージの削除は、ここで一括して行う。
-		if (p_msg) {
-			delete p_msg;
+		if (p_cb->thread_no == thread_no) {
+			return(p_cb);
 		}
 	}
-	onThreadTerminate();
-	setInstanceInfo(STS_STOP);	// 正確にはまだSTOPしてないが。
-	return(vp_ret);
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// 状態収集スレッド クラス インスタンス管理
-////////////////////////////////////////////////////////////////////////////////
-pthread_mutex_t	CThreadBase::g_class_mutex = PTHREAD_MUTEX_INITIALIZER;
-vector<CThreadBase::_ThreadCB> CThreadBase::g_vectorThreadCB;
-
 // スレッド番号からインスタンスを返す。
 CThreadBase* CThreadBase::getInstance(const int thread_no, int* p_thread_status)
 {
-	pthread_mutex_lock(&g_class_mutex);
-	size_t index = 0;
-	for ( ; index < g_vectorThreadCB.size(); index++) {
-		if (g_vectorThreadCB[index].thread_no == thread_no) {
-			break;
-		}
+	CThreadBase* p_thread_base = NULL;
+	int thread_status = STS_UNKNOWN;
+	_ThreadCB *p_cb = findThreadCB(thread_no);
+	if (p_cb) {
+		p_thread_base = p_cb->p_thread_base;
+		thread_status = __atomic_load_n(&p_cb->thread_status, __ATOMIC_ACQUIRE);
 	}
-	pthread_mutex_unlock(&g_class_mutex);
-	return(getInstanceByIndex(index, p_thread_status));
+	if (p_thread_status) {
+		*p_thread_status = thread_status;
+	}
+	return(p_thread_base);
 }
 
 // 登録位置からインスタンスを返す。
@@ -462,12 +3030,12 @@ CThreadBase* CThreadBase::getInstanceByIndex(const size_t index, int* p_thread_s
 {
 	CThreadBase* p_thread_base = NULL;
 	int thread_status = STS_UNKNOWN;
-	pthread_mutex_lock(&g_class_mutex);
-	if ((index >= 0) && (index < g_vectorThreadCB.size())) {
-		p_thread_base = g_vectorThreadCB[index].p_thread_base;
-		thread_status = g_vectorThreadCB[index].thread_status;
+	_ThreadTable *p_table = __atomic_load_n(&g_p_thread_table, __ATOMIC_ACQUIRE);
+	if (p_table && (index < __atomic_load_n(&p_table->num, __ATOMIC_ACQUIRE))) {
+		_ThreadCB *p_cb = p_table->pp_index[index];
+		p_thread_base = p_cb->p_thread_base;
+		thread_status = __atomic_load_n(&p_cb->thread_status, __ATOMIC_ACQUIRE);
 	}
-	pthread_mutex_unlock(&g_class_mutex);
 	if (p_thread_status) {
 		*p_thread_status = thread_status;
 	}
@@ -482,23 +3050,642 @@ int CThreadBase::setInstanceInfo(const int thread_status) const
 	if (m_thread_no == (-1)) {
 		return(ERR_OK);
 	}
+	// 登録済みなら状態だけ変える。（ロックを取らない）
+	_ThreadCB *p_cb = findThreadCB(m_thread_no);
+	if (p_cb) {
+		__atomic_store_n(&p_cb->thread_status, thread_status, __ATOMIC_RELEASE);
+		return(ret);
+	}
 	pthread_mutex_lock(&g_class_mutex);
-	size_t index = 0;
-	for ( ; index < g_vectorThreadCB.size(); index++) {
-		if (g_vectorThreadCB[index].thread_no == m_thread_no) {
-			// 状態変更！
-			g_vectorThreadCB[index].thread_status = thread_status;
-			break;
+	p_cb = findThreadCB(m_thread_no);
+	if (p_cb) {
+		// 同時に登録された。
+		__atomic_store_n(&p_cb->thread_status, thread_status, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&g_class_mutex);
+		return(ret);
+	}
+	p_cb = new _ThreadCB;
+	p_cb->thread_no		= m_thread_no;
+	p_cb->p_thread_base	= const_cast<CThreadBase*>(this);
+	p_cb->thread_status	= thread_status;
+
+	_ThreadTable *p_table = g_p_thread_table;
+	size_t num = p_table ? p_table->num : 0;
+	if ((p_table == NULL) || ((num + 1) * 2 > p_table->capacity)) {
+		// 半分を超えたら倍の大きさで作り直し、できてから差し替える。
+		_ThreadTable *p_new = new _ThreadTable;
+		p_new->capacity  = p_table ? (p_table->capacity * 2) : 64;
+		p_new->pp_hash   = new _ThreadCB*[p_new->capacity]();
+		p_new->max_index = p_new->capacity / 2;
+		p_new->pp_index  = new _ThreadCB*[p_new->max_index];
+		p_new->num       = num;
+		p_new->p_retired = p_table;
+		for (size_t i = 0; i < num; i++) {
+			_ThreadCB *p_old = p_table->pp_index[i];
+			size_t h = p_new->hash(p_old->thread_no);
+			while (p_new->pp_hash[h]) {
+				h = (h + 1) & (p_new->capacity - 1);
+			}
+			p_new->pp_hash[h]  = p_old;
+			p_new->pp_index[i] = p_old;
 		}
+		__atomic_store_n(&g_p_thread_table, p_new, __ATOMIC_RELEASE);
+		p_table = p_new;
 	}
-	if (index == g_vectorThreadCB.size()) {
-		CThreadBase::_ThreadCB ThreadCB;
-		ThreadCB.thread_no		= m_thread_no;
-		ThreadCB.p_thread_base	= const_cast<CThreadBase*>(this);
-		ThreadCB.thread_status	= thread_status;
-		g_vectorThreadCB.push_back(ThreadCB);
+	// 登録順の配列に入れてから、数とハッシュ表で公開する。
+	p_table->pp_index[num] = p_cb;
+	__atomic_store_n(&p_table->num, num + 1, __ATOMIC_RELEASE);
+	size_t h = p_table->hash(m_thread_no);
+	while (p_table->pp_hash[h]) {
+		h = (h + 1) & (p_table->capacity - 1);
 	}
+	__atomic_store_n(&p_table->pp_hash[h], p_cb, __ATOMIC_RELEASE);
 	pthread_mutex_unlock(&g_class_mutex);
 	return(ret);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// アクタスケジューラクラス
+////////////////////////////////////////////////////////////////////////////////
+
+// コンストラクタ
+CActorScheduler::CActorScheduler()
+: m_epfd(-1)
+, m_stop_fd(-1)
+, m_actors(0)
+{
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_cond, NULL);
+#ifdef CTB_ACTOR
+	m_epfd    = epoll_create1(EPOLL_CLOEXEC);
+	m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if ((m_epfd != (-1)) && (m_stop_fd != (-1))) {
+		// 終了の通知は読み捨てないので、全てのワーカに届く。
+		struct epoll_event event;
+		event.events   = EPOLLIN;
+		event.data.ptr = NULL;
+		if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_stop_fd, &event) == 0) {
+			return;
+		}
+	}
+	if (m_stop_fd != (-1)) {
+		close(m_stop_fd);
+		m_stop_fd = (-1);
+	}
+	if (m_epfd != (-1)) {
+		close(m_epfd);
+		m_epfd = (-1);
+	}
+#endif
+}
+
+// デストラクタ
+CActorScheduler::~CActorScheduler()
+{
+	stop();	// もし動いていたら止める。
+	if (m_stop_fd != (-1)) {
+		close(m_stop_fd);
+	}
+	if (m_epfd != (-1)) {
+		close(m_epfd);
+	}
+	pthread_cond_destroy(&m_cond);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+// ワーカスレッドを起動する。
+int CActorScheduler::start(int workers, pthread_attr_t *p_pthread_attr)
+{
+	if (workers < 1) {
+		return(CThreadBase::ERR_PARAM);
+	}
+	if ((m_epfd == (-1)) || !m_vec_worker.empty()) {
+		return(CThreadBase::ERR_CONTEXT);
+	}
+	for (int i = 0; i < workers; i++) {
+		pthread_t pthread;
+		int ret = pthread_create(&pthread, p_pthread_attr, worker_routine, (void*)this);
+		if (ret) {
+			stop();
+			return(ret);
+		}
+		m_vec_worker.push_back(pthread);
+	}
+	return(CThreadBase::ERR_OK);
+}
+
+// ワーカスレッドを終了する。
+int CActorScheduler::stop()
+{
+	if (m_vec_worker.empty()) {
+		return(CThreadBase::ERR_CONTEXT);
+	}
+	// ワーカからは待てない。
+	for (size_t i = 0; i < m_vec_worker.size(); i++) {
+		if (pthread_equal(m_vec_worker[i], pthread_self())) {
+			return(CThreadBase::ERR_CONTEXT);
+		}
+	}
+#ifdef CTB_ACTOR
+	uint64_t value = 1;
+	if (write(m_stop_fd, &value, sizeof(value)) != sizeof(value)) {
+		return(CThreadBase::ERR_SYSTEM);
+	}
+	for (size_t i = 0; i < m_vec_worker.size(); i++) {
+		pthread_join(m_vec_worker[i], NULL);
+	}
+	m_vec_worker.clear();
+	// 再び start()できるよう、終了の通知を読み捨てる。
+	if (read(m_stop_fd, &value, sizeof(value)) != sizeof(value)) {
+		return(CThreadBase::ERR_SYSTEM);
+	}
+#endif
+	return(CThreadBase::ERR_OK);
+}
+
+// アクタを登録する。
+int CActorScheduler::attach(CThreadBase *p_actor)
+{
+#ifdef CTB_ACTOR
+	__atomic_add_fetch(&m_actors, 1, __ATOMIC_RELAXED);
+	// １つのワーカだけに渡すよう、一度通知したら止める。（処理後に rearm）
+	struct epoll_event event;
+	event.events   = EPOLLIN | EPOLLONESHOT;
+	event.data.ptr = p_actor;
+	// 登録し終えるまでは起動側が持ち、その後で最初に処理するワーカに渡す。
+	__atomic_store_n(&p_actor->m_actor_running, ACTOR_RUNNING, __ATOMIC_RELAXED);
+	if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, p_actor->m_FDs.getEpollFD(), &event) == 0) {
+		// 手放す前に通知したワーカは処理せずに戻るので、監視を再開して通知し直す。
+		// （最初の処理は予約済みなので、再開すると直ちに通知される）
+		while (!release(p_actor)) {
+			epoll_ctl(m_epfd, EPOLL_CTL_MOD, p_actor->m_FDs.getEpollFD(), &event);
+		}
+		return(CThreadBase::ERR_OK);
+	}
+	__atomic_sub_fetch(&m_actors, 1, __ATOMIC_RELAXED);
+	return(CThreadBase::ERR_SYSTEM);
+#else
+	return(CThreadBase::ERR_CONTEXT);
+#endif
+}
+
+// 通知されたアクタを受け取る。
+// EPOLLONESHOT で１つのワーカにしか渡らないが、持ち主が監視を再開してから
+// 手放すまでの間に通知されることがある。その場合は待たずに、持ち主に続けて処理させる。
+bool CActorScheduler::acquire(CThreadBase *p_actor)
+{
+	int state = ACTOR_IDLE;
+	for (;;) {
+		if (__atomic_compare_exchange_n(&p_actor->m_actor_running, &state, ACTOR_RUNNING,
+										false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			return(true);
+		}
+		if (state == ACTOR_IDLE) {
+			continue;	// 持ち主が手放した。
+		}
+		if (__atomic_compare_exchange_n(&p_actor->m_actor_running, &state, ACTOR_PENDING,
+										false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			return(false);
+		}
+	}
+}
+
+// アクタを手放す。
+// 手放す前に通知されていれば（ACTOR_PENDING）、持ったままにする。
+bool CActorScheduler::release(CThreadBase *p_actor)
+{
+	int state = ACTOR_RUNNING;
+	if (__atomic_compare_exchange_n(&p_actor->m_actor_running, &state, ACTOR_IDLE,
+									false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+		return(true);
+	}
+	__atomic_store_n(&p_actor->m_actor_running, ACTOR_RUNNING, __ATOMIC_RELAXED);
+	return(false);
+}
+
+// アクタの登録を外す。
+void CActorScheduler::detach(CThreadBase *p_actor)
+{
+#ifdef CTB_ACTOR
+	struct epoll_event event;	// 2.6.9 より前のカーネル用
+	epoll_ctl(m_epfd, EPOLL_CTL_DEL, p_actor->m_FDs.getEpollFD(), &event);
+#endif
+}
+
+// アクタが終了したことを知らせる。
+void CActorScheduler::finish(CThreadBase *p_actor)
+{
+	pthread_mutex_lock(&m_mutex);
+	p_actor->m_bool_finished = true;
+	__atomic_sub_fetch(&m_actors, 1, __ATOMIC_RELAXED);
+	pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+}
+
+// アクタの終了を待つ。
+void CActorScheduler::join(CThreadBase *p_actor)
+{
+	pthread_mutex_lock(&m_mutex);
+	while (!p_actor->m_bool_finished) {
+		pthread_cond_wait(&m_cond, &m_mutex);
+	}
+	pthread_mutex_unlock(&m_mutex);
+}
+
+// ワーカスレッドのスタートルーチン
+void* CActorScheduler::worker_routine(void *vp_arg)
+{
+	static_cast<CActorScheduler*>(vp_arg)->work();
+	return(NULL);
+}
+
+// ワーカスレッドの処理
+void CActorScheduler::work()
+{
+#ifdef CTB_ACTOR
+	for (;;) {
+		struct epoll_event event;
+		int result = epoll_wait(m_epfd, &event, 1, -1);
+		if (result <= 0) {
+			continue;	// EINTR
+		}
+		CThreadBase *p_actor = static_cast<CThreadBase*>(event.data.ptr);
+		if (p_actor == NULL) {
+			break;
+		}
+		// 前に処理したワーカ（又は起動側）から受け取り、その更新を見る。
+		if (!acquire(p_actor)) {
+			continue;
+		}
+		for (;;) {
+			if (!p_actor->runActor()) {
+				// 終了したアクタには、以降触らない。（join()へは finish()で渡す）
+				finish(p_actor);
+				break;
+			}
+			// 監視を再開する。イベントが残っていれば、直ちに（他のワーカにも）通知される。
+			// 再開した後に手放す。手放す前に通知されていれば、このワーカが続けて処理する。
+			event.events   = EPOLLIN | EPOLLONESHOT;
+			event.data.ptr = p_actor;
+			epoll_ctl(m_epfd, EPOLL_CTL_MOD, p_actor->m_FDs.getEpollFD(), &event);
+			if (release(p_actor)) {
+				break;
+			}
+		}
+	}
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// タスクプールクラス
+////////////////////////////////////////////////////////////////////////////////
+
+// ワークスティーリング両頭待ち行列（Chase-Lev）
+// 末尾への追加と末尾からの取り出しは持ち主のワーカだけが行い、
+// 他のワーカは先頭から盗む。（CAS は先頭の１つを取り合う時だけ）
+class CWorkDeque
+{
+public:
+	CWorkDeque()
+	: m_top(0)
+	, m_bottom(0)
+	, m_p_array(new CArray(INITIAL_SIZE))
+	{}
+
+	~CWorkDeque()
+	{
+		delete m_p_array;
+		for (size_t i = 0; i < m_vec_p_retired.size(); i++) {
+			delete m_vec_p_retired[i];
+		}
+	}
+
+	// 末尾に追加する。（持ち主のみ）
+	void push(CThreadMsg *p_msg)
+	{
+		long b = __atomic_load_n(&m_bottom, __ATOMIC_RELAXED);
+		long t = __atomic_load_n(&m_top, __ATOMIC_ACQUIRE);
+		CArray *p_array = __atomic_load_n(&m_p_array, __ATOMIC_RELAXED);
+		if (b - t > p_array->m_size - 1) {
+			// 倍の大きさに移す。古い配列は盗む側が読んでいるかもしれないので、終了まで残す。
+			CArray *p_new = new CArray(p_array->m_size * 2);
+			for (long i = t; i < b; i++) {
+				p_new->put(i, p_array->get(i));
+			}
+			m_vec_p_retired.push_back(p_array);
+			__atomic_store_n(&m_p_array, p_new, __ATOMIC_RELEASE);
+			p_array = p_new;
+		}
+		p_array->put(b, p_msg);
+		__atomic_store_n(&m_bottom, b + 1, __ATOMIC_RELEASE);
+	}
+
+	// 末尾から取り出す。（持ち主のみ／空なら NULL）
+	CThreadMsg* take()
+	{
+		long b = __atomic_load_n(&m_bottom, __ATOMIC_RELAXED) - 1;
+		CArray *p_array = __atomic_load_n(&m_p_array, __ATOMIC_RELAXED);
+		__atomic_store_n(&m_bottom, b, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		long t = __atomic_load_n(&m_top, __ATOMIC_RELAXED);
+		CThreadMsg *p_msg = NULL;
+		if (t <= b) {
+			p_msg = p_array->get(b);
+			if (t == b) {
+				// 最後の１つは、盗む側と取り合う。
+				if (!__atomic_compare_exchange_n(&m_top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+					p_msg = NULL;
+				}
+				__atomic_store_n(&m_bottom, b + 1, __ATOMIC_RELAXED);
+			}
+		} else {
+			__atomic_store_n(&m_bottom, b + 1, __ATOMIC_RELAXED);
+		}
+		return(p_msg);
+	}
+
+	// 先頭から盗む。（空か、取り合いに負けたら NULL）
+	CThreadMsg* steal()
+	{
+		long t = __atomic_load_n(&m_top, __ATOMIC_ACQUIRE);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		long b = __atomic_load_n(&m_bottom, __ATOMIC_ACQUIRE);
+		if (t >= b) {
+			return(NULL);
+		}
+		CArray *p_array = __atomic_load_n(&m_p_array, __ATOMIC_ACQUIRE);
+		CThreadMsg *p_msg = p_array->get(t);
+		if (!__atomic_compare_exchange_n(&m_top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+			return(NULL);
+		}
+		return(p_msg);
+	}
+
+private:
+	CWorkDeque(const CWorkDeque&);
+	CWorkDeque& operator=(const CWorkDeque&);
+
+	enum { INITIAL_SIZE = 256 };	// ２のべき乗
+
+	// 環状配列
+	struct CArray {
+		long			m_size;
+		CThreadMsg**	m_pp_msg;
+		explicit CArray(long size) : m_size(size), m_pp_msg(new CThreadMsg*[size]) {}
+		~CArray() { delete[] m_pp_msg; }
+		CThreadMsg* get(long i) const { return(__atomic_load_n(&m_pp_msg[i & (m_size - 1)], __ATOMIC_RELAXED)); }
+		void put(long i, CThreadMsg *p_msg) { __atomic_store_n(&m_pp_msg[i & (m_size - 1)], p_msg, __ATOMIC_RELAXED); }
+	};
+
+	long				m_top;				// 先頭（盗む側が進める）
+	char				m_pad[64 - sizeof(long)];	// 先頭と末尾を別のキャッシュラインに置く。
+	long				m_bottom;			// 末尾（持ち主だけが動かす）
+	CArray*				m_p_array;			// 環状配列
+	vector<CArray*>		m_vec_p_retired;	// 移し替える前の配列
+};
+
+// ワーカ
+struct CTaskPool::CWorker
+{
+	CTaskPool*			p_pool;		// 所属するタスクプール
+	pthread_t			pthread;	// スレッド識別子
+	CWorkDeque			deque;		// 待ち行列
+	unsigned int		seed;		// 盗む相手を選ぶ乱数
+	unsigned long long	executed;	// 実行したタスク数（自ワーカだけが更新）
+	unsigned long long	stolen;		// 盗んだタスク数（同上）
+};
+
+// 処理中のワーカ（ワーカスレッド以外は NULL）
+static __thread void *t_vp_pool_worker = NULL;
+
+// コンストラクタ
+CTaskPool::CTaskPool()
+: m_pending(0)
+, m_sleepers(0)
+, m_bool_stop(false)
+, m_bool_running(false)
+{
+	pthread_mutex_init(&m_inject_mutex, NULL);
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_cond, NULL);
+	m_stats.executed = 0;
+	m_stats.stolen   = 0;
+}
+
+// デストラクタ
+CTaskPool::~CTaskPool()
+{
+	stop();	// もし動いていたら止める。
+	pthread_cond_destroy(&m_cond);
+	pthread_mutex_destroy(&m_mutex);
+	pthread_mutex_destroy(&m_inject_mutex);
+}
+
+// ワーカスレッドを起動する。
+int CTaskPool::start(int workers, pthread_attr_t *p_pthread_attr)
+{
+	if (workers < 1) {
+		return(CThreadBase::ERR_PARAM);
+	}
+	if (!m_vec_p_worker.empty()) {
+		return(CThreadBase::ERR_CONTEXT);
+	}
+	// 盗む相手を全て揃えてから起動する。
+	for (int i = 0; i < workers; i++) {
+		CWorker *p_worker = new CWorker;
+		p_worker->p_pool   = this;
+		p_worker->pthread  = 0;
+		p_worker->seed     = static_cast<unsigned int>(i + 1);
+		p_worker->executed = 0;
+		p_worker->stolen   = 0;
+		m_vec_p_worker.push_back(p_worker);
+	}
+	pthread_mutex_lock(&m_inject_mutex);
+	m_bool_running = true;
+	pthread_mutex_unlock(&m_inject_mutex);
+	for (int i = 0; i < workers; i++) {
+		int ret = pthread_create(&m_vec_p_worker[i]->pthread, p_pthread_attr, worker_routine, m_vec_p_worker[i]);
+		if (ret) {
+			shutdown(i);
+			return(ret);
+		}
+	}
+	return(CThreadBase::ERR_OK);
+}
+
+// ワーカスレッドを終了する。
+int CTaskPool::stop()
+{
+	if (m_vec_p_worker.empty()) {
+		return(CThreadBase::ERR_CONTEXT);
+	}
+	// ワーカからは待てない。
+	CWorker *p_self = static_cast<CWorker*>(t_vp_pool_worker);
+	if (p_self && (p_self->p_pool == this)) {
+		return(CThreadBase::ERR_CONTEXT);
+	}
+	shutdown(m_vec_p_worker.size());
+	return(CThreadBase::ERR_OK);
+}
+
+// 先頭から workers 個のワーカスレッドを止めて、全てのワーカを削除する。
+void CTaskPool::shutdown(size_t workers)
+{
+	// 以降はワーカ外から投入できない。投入済みのタスクは実行してから止まる。
+	pthread_mutex_lock(&m_inject_mutex);
+	m_bool_running = false;
+	pthread_mutex_unlock(&m_inject_mutex);
+	pthread_mutex_lock(&m_mutex);
+	m_bool_stop = true;
+	pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+	for (size_t i = 0; i < workers; i++) {
+		pthread_join(m_vec_p_worker[i]->pthread, NULL);
+	}
+	for (size_t i = 0; i < m_vec_p_worker.size(); i++) {
+		m_stats.executed += m_vec_p_worker[i]->executed;
+		m_stats.stolen   += m_vec_p_worker[i]->stolen;
+		delete m_vec_p_worker[i];
+	}
+	m_vec_p_worker.clear();
+	m_bool_stop = false;
+}
+
+// タスクを投入する。
+int CTaskPool::submit(CPoolTask *p_task, CThreadBase *p_reply_thread)
+{
+	if (p_task == NULL) {
+		return(CThreadBase::ERR_PARAM);
+	}
+	p_task->m_p_reply_thread = p_reply_thread;
+	return(push(p_task));
+}
+
+// 統計情報を取得する。
+void CTaskPool::getStats(STATS *p_stats) const
+{
+	*p_stats = m_stats;
+	for (size_t i = 0; i < m_vec_p_worker.size(); i++) {
+		p_stats->executed += __atomic_load_n(&m_vec_p_worker[i]->executed, __ATOMIC_RELAXED);
+		p_stats->stolen   += __atomic_load_n(&m_vec_p_worker[i]->stolen,   __ATOMIC_RELAXED);
+	}
+}
+
+// メッセージを投入する。
+int CTaskPool::push(CThreadMsg *p_msg)
+{
+	CWorker *p_self = static_cast<CWorker*>(t_vp_pool_worker);
+	if (p_self && (p_self->p_pool == this)) {
+		// ワーカ内から投入したものは、自分の待ち行列に積む。
+		p_self->deque.push(p_msg);
+	} else {
+		pthread_mutex_lock(&m_inject_mutex);
+		if (!m_bool_running) {
+			pthread_mutex_unlock(&m_inject_mutex);
+			return(CThreadBase::ERR_CONTEXT);
+		}
+		m_deq_p_inject.push_back(p_msg);
+		pthread_mutex_unlock(&m_inject_mutex);
+	}
+	// 数を増やしてから待ち状態を確認する。（ワーカは逆順で確認する）
+	__atomic_add_fetch(&m_pending, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&m_sleepers, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&m_mutex);
+		pthread_cond_signal(&m_cond);
+		pthread_mutex_unlock(&m_mutex);
+	}
+	return(CThreadBase::ERR_OK);
+}
+
+// 実行するメッセージを探す。
+CThreadMsg* CTaskPool::find(CWorker *p_worker)
+{
+	CThreadMsg *p_msg = p_worker->deque.take();
+	if (p_msg == NULL) {
+		pthread_mutex_lock(&m_inject_mutex);
+		if (!m_deq_p_inject.empty()) {
+			p_msg = m_deq_p_inject.front();
+			m_deq_p_inject.pop_front();
+		}
+		pthread_mutex_unlock(&m_inject_mutex);
+	}
+	if (p_msg == NULL) {
+		// 乱数で選んだワーカから順に盗む。（盗む側が同じ相手に集中しないように）
+		size_t workers = m_vec_p_worker.size();
+		unsigned int x = p_worker->seed;
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		p_worker->seed = x;
+		for (size_t i = 0; (i < workers) && (p_msg == NULL); i++) {
+			CWorker *p_victim = m_vec_p_worker[(x + i) % workers];
+			if (p_victim != p_worker) {
+				p_msg = p_victim->deque.steal();
+			}
+		}
+		if (p_msg) {
+			__atomic_store_n(&p_worker->stolen, p_worker->stolen + 1, __ATOMIC_RELAXED);
+		}
+	}
+	if (p_msg) {
+		__atomic_sub_fetch(&m_pending, 1, __ATOMIC_SEQ_CST);
+	}
+	return(p_msg);
+}
+
+// メッセージを実行する。
+void CTaskPool::execute(CThreadMsg *p_msg)
+{
+#if __cplusplus >= 201103L
+	// submitTask(p_pool, func, on_reply)：完了はフューチャから要求元に届く。
+	if (CTaskMsg *p_task_msg = msg_cast<CTaskMsg>(p_msg)) {
+		p_task_msg->run();
+		delete p_task_msg;
+		return;
+	}
+#endif
+	CPoolTask *p_task = static_cast<CPoolTask*>(p_msg);
+	p_task->runTask();
+	if (p_task->m_p_reply_thread) {
+		// キューイングできなければ postMsg()が削除する。
+		p_task->m_p_reply_thread->postMsg(p_task);
+	} else {
+		delete p_task;
+	}
+}
+
+// ワーカスレッドのスタートルーチン
+void* CTaskPool::worker_routine(void *vp_arg)
+{
+	CWorker *p_worker = static_cast<CWorker*>(vp_arg);
+	p_worker->p_pool->work(p_worker);
+	return(NULL);
+}
+
+// ワーカスレッドの処理
+void CTaskPool::work(CWorker *p_worker)
+{
+	t_vp_pool_worker = p_worker;
+	for (;;) {
+		CThreadMsg *p_msg = find(p_worker);
+		if (p_msg) {
+			execute(p_msg);
+			__atomic_store_n(&p_worker->executed, p_worker->executed + 1, __ATOMIC_RELAXED);
+			continue;
+		}
+		// 待ち状態を宣言してから数を確認する。（通知の取りこぼし防止）
+		// 数が残っていれば、投入途中か取り合いに負けただけなので、探し直す。
+		pthread_mutex_lock(&m_mutex);
+		__atomic_add_fetch(&m_sleepers, 1, __ATOMIC_SEQ_CST);
+		while ((__atomic_load_n(&m_pending, __ATOMIC_SEQ_CST) <= 0) && !m_bool_stop) {
+			pthread_cond_wait(&m_cond, &m_mutex);
+		}
+		__atomic_sub_fetch(&m_sleepers, 1, __ATOMIC_SEQ_CST);
+		bool bool_stop = m_bool_stop && (__atomic_load_n(&m_pending, __ATOMIC_SEQ_CST) <= 0);
+		pthread_mutex_unlock(&m_mutex);
+		if (bool_stop) {
+			break;
+		}
+	}
+	t_vp_pool_worker = NULL;
+}
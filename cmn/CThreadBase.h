@@ -8,11 +8,20 @@
  * このファイルは、スレッドベースクラスとその構成要素である、
  * 下記クラスの定義をします。
  * 
+ * ・スレッドメッセージプールクラス<BR>
  * ・スレッドメッセージベースクラス<BR>
  * ・スレッド終了メッセージクラス<BR>
+ * ・タスクメッセージクラス<BR>
+ * ・プールタスクメッセージクラス<BR>
  * ・スレッドキュークラス<BR>
+ * ・スレッド通知クラス<BR>
+ * ・時計クラス<BR>
  * ・タイマ制御ブロッククラス<BR>
  * ・タイマ制御ブロックリストクラス<BR>
+ * ・フューチャ、プロミス、要求メッセージクラス（C++11 以降）<BR>
+ * ・スレッド配置クラス<BR>
+ * ・アクタスケジューラクラス<BR>
+ * ・タスクプールクラス<BR>
  * 
  * @author  渡辺正勝
  *
@@ -29,16 +38,138 @@
 #include <sys/time.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 #include <string>
 #include <deque>
 #include <list>
 #include <vector>
+#include <map>
 #include <algorithm>
+#include <new>
+#if __cplusplus >= 201103L
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#endif
 #include "CTimeVal.h"
 #include "CFileDescriptor.h"
 
 using namespace std;
 
+// 例外を投げない関数の指定
+#if __cplusplus >= 201103L
+#define CTB_NOTHROW		noexcept
+#else
+#define CTB_NOTHROW		throw()
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// スレッドメッセージプールクラス
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @class CThreadMsgPool CThreadBase.h
+ * @brief スレッドメッセージプールクラス
+ * 
+ * スレッドメッセージの領域を再利用するアロケータです。<BR>
+ * CThreadMsg の operator new／delete から呼び出されるので、
+ * 派生クラスは何もしなくてもプールから確保されます。<BR>
+ * <BR>
+ * 領域はサイズ（ALIGN 単位）毎に分けて、スレッド毎の空きリストで管理します。<BR>
+ * 確保と解放は自スレッドの空きリストだけを操作するので、ロックを取りません。<BR>
+ * メッセージは送信元で確保し、受信先で解放されるので、受信先の空きリストが
+ * LOCAL_MAX を超えると BATCH 個まとめて共有の置き場に返し、
+ * 送信元の空きリストが空になると、置き場から BATCH 個まとめて補充します。<BR>
+ * 置き場は NUMA ノード毎に分かれていて、setNode()で自スレッドが使う置き場を選べます。
+ * （受信先で解放された領域は、同じノードのスレッドが再利用します）<BR>
+ * MAX_SIZE を超えるメッセージは、プールせずに malloc()／free()します。<BR>
+ * <BR>
+ * CTB_NO_MSG_POOL を定義してコンパイルすると、プールを使用しません。
+ * （valgrind 等でメモリを調べる場合）
+ * 
+ */
+class CThreadMsgPool
+{
+public:
+	/// @brief 固定値
+	enum {
+		ALIGN		= 16,					///< サイズの単位（バイト）
+		MAX_SIZE	= 512,					///< プールする最大サイズ（バイト）
+		NUM_CLASS	= MAX_SIZE / ALIGN,		///< サイズ区分の数
+		BATCH		= 64,					///< 置き場とやり取りする個数
+		LOCAL_MAX	= BATCH * 2,			///< スレッド毎の空きリストの上限
+		DEPOT_MAX	= 64,					///< 置き場に置けるまとまりの数（サイズ区分毎）
+		MAX_NODE	= 8						///< 置き場を分ける NUMA ノード数
+	};
+
+	/// @brief 統計情報
+	typedef struct {
+		unsigned long long	hit;			///< 空きリストから確保した数
+		unsigned long long	miss;			///< malloc()で確保した数
+	} STATS;
+
+	/**
+	 * @brief 領域を確保する。
+	 *
+	 * @param	size	サイズ
+	 * @retval	領域のポインタ（確保できない場合は std::bad_alloc を投げる）
+	 */
+	static void* allocate(size_t size);
+
+	/**
+	 * @brief 領域を解放する。
+	 *
+	 * 確保したスレッドとは別のスレッドからも呼び出せます。
+	 *
+	 * @param	p		領域のポインタ
+	 * @param	size	確保した時のサイズ
+	 * @retval	なし
+	 */
+	static void  deallocate(void *p, size_t size);
+
+	/**
+	 * @brief サイズの分からない領域を解放する。
+	 *
+	 * 空きリストには返さずに解放します。（コンストラクタが例外を投げた場合など）
+	 *
+	 * @param	p		領域のポインタ
+	 * @retval	なし
+	 */
+	static void  discard(void *p);
+
+	/**
+	 * @brief 統計情報を取得する。
+	 *
+	 * 全スレッド（終了したスレッドを含む）の合計です。
+	 *
+	 * @param	p_stats	統計情報の格納先
+	 * @retval	なし
+	 */
+	static void  getStats(STATS *p_stats);
+
+	/**
+	 * @brief 自スレッドが使う置き場のノード番号を設定する。
+	 *
+	 * 設定しない場合はノード０の置き場を使います。
+	 * 通常は CThreadPlacement::setNode()で指定したスレッドが起動時に設定します。
+	 *
+	 * @param	node	ノード番号（0 〜 MAX_NODE - 1）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	static int   setNode(int node);
+
+private:
+	class CCache;
+
+	static CCache* getCache();
+	static void    destroyCache(void *vp);
+	static void    createKey();
+	static void    refill(CCache *p_cache, int index);
+	static void    release(CCache *p_cache, int index);
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // スレッドメッセージベースクラスとその派生クラス（スレッド間通信用）
 ////////////////////////////////////////////////////////////////////////////////
@@ -47,20 +178,196 @@ using namespace std;
  * @class CThreadMsg CThreadBase.h
  * @brief スレッドメッセージベースクラス
  *
- * スレッド間通信に使用するメッセージは、このクラスから派生させます。
+ * スレッド間通信に使用するメッセージは、このクラスから派生させます。<BR>
+ * 型IDを使用する場合は、CThreadMsgT テンプレートから派生させます。<BR>
+ * <BR>
+ * 状態通知のように最新の値だけが意味を持つメッセージは、
+ * setConflateKey()でキーを付けると、まとめられます。
+ * キューイングした時に同じ型ID、同じキーのメッセージがまだ取り出されていなければ、
+ * 元のメッセージの位置のまま、新しいメッセージに置き換えます。
  * 
  */
 class CThreadMsg
 {
 public:
+	/// @brief 型ID（0 は型IDなし）
+	enum { MSG_TYPE_NONE = 0 };
+
 	/// @brief コンストラクタ
 	CThreadMsg()
+	: m_msg_type(MSG_TYPE_NONE)
+	, m_conflate_key(0)
+	, m_p_next_msg(NULL)
+	, m_nsec_posted(0)
 	{};
 
 	/// @brief デストラクタ
 	virtual ~CThreadMsg() {};
+
+	/**
+	 * @brief 型IDを返す。
+	 *
+	 * @param	なし
+	 * @retval	型ID（CThreadMsgT から派生していなければ MSG_TYPE_NONE）
+	 */
+	int getMsgType() const { return(m_msg_type); }
+
+	/**
+	 * @brief 新しい型IDを払い出す。
+	 *
+	 * CThreadMsgT が型毎に一度だけ呼び出します。1 から順に払い出します。
+	 *
+	 * @param	なし
+	 * @retval	型ID
+	 */
+	static int newMsgType();
+
+	/**
+	 * @brief まとめるためのキーを設定する。
+	 *
+	 * キューイング前に設定して下さい。型IDが同じメッセージの間だけでまとめます。
+	 * （型IDなしのメッセージはまとめません）
+	 *
+	 * @param	key		キー（０はまとめない）
+	 * @retval	なし
+	 */
+	void setConflateKey(unsigned long key) { m_conflate_key = key; }
+
+	/**
+	 * @brief まとめるためのキーを返す。
+	 *
+	 * @param	なし
+	 * @retval	キー（０はまとめない）
+	 */
+	unsigned long getConflateKey() const { return(m_conflate_key); }
+
+	/**
+	 * @brief まだ取り出されていないメッセージを置き換える時に呼び出される。
+	 *
+	 * 送信元のスレッドで、置き換える（新しい）メッセージに対して呼び出されます。
+	 * 元のメッセージから引き継ぐものがあれば、オーバーライドします。
+	 * p_old は呼び出し後に解放されます。
+	 *
+	 * @param	p_old	置き換えられるメッセージ（同じ型）
+	 * @retval	なし
+	 */
+	virtual void onConflate(CThreadMsg * /*p_old*/) { return; }
+
+#ifndef CTB_NO_MSG_POOL
+	/// @brief メッセージプールから確保する。
+	static void* operator new(size_t size) { return(CThreadMsgPool::allocate(size)); }
+
+	/// @brief メッセージプールに返す。（size は実際の型のサイズ）
+	static void  operator delete(void *p, size_t size) { CThreadMsgPool::deallocate(p, size); }
+
+	/// @brief メッセージプールから確保する。（確保できなければ NULL を返す）
+	static void* operator new(size_t size, const std::nothrow_t&) CTB_NOTHROW
+	{
+		try {
+			return(CThreadMsgPool::allocate(size));
+		} catch (...) {
+			return(NULL);
+		}
+	}
+
+	/// @brief 上記で確保し、コンストラクタが例外を投げた時に返す。
+	static void  operator delete(void *p, const std::nothrow_t&) CTB_NOTHROW { CThreadMsgPool::discard(p); }
+
+	/// @brief 指定の領域に構築する。（領域の解放は呼び出し側で行う。delete しないこと）
+	static void* operator new(size_t /*size*/, void *p) CTB_NOTHROW { return(p); }
+
+	/// @brief 上記で構築し、コンストラクタが例外を投げた時に呼び出される。（何もしない）
+	static void  operator delete(void * /*p*/, void * /*place*/) CTB_NOTHROW { return; }
+#endif
+
+protected:
+	/// @brief 型ID
+	int			m_msg_type;
+
+private:
+	friend class CThreadQueue;
+	friend class CThreadBase;
+
+	/// @brief まとめるためのキー（０はまとめない）
+	unsigned long	m_conflate_key;
+
+	/// @brief 次のメッセージ（スレッドキューが使用する）
+	CThreadMsg*	m_p_next_msg;
+
+	/// @brief キューイングした時刻（実行統計を取るスレッド宛てのみ／ナノ秒）
+	long long	m_nsec_posted;
+
+	/// @brief 払い出した型IDの数
+	static int	g_msg_type_count;
+};
+
+/**
+ * @class CThreadMsgT CThreadBase.h
+ * @brief 型ID付きスレッドメッセージテンプレート
+ *
+ * メッセージクラス T に型IDを付けます。（CRTP）<BR>
+ * 	class CMyMsg : public CThreadMsgT<CMyMsg> { ... };<BR>
+ * 	class CMyMsg : public CThreadMsgT<CMyMsg, CMyBaseMsg> { ... };<BR>
+ * 型IDを使うと、dynamic_cast の代わりに msg_cast で判別でき、
+ * CThreadBase::setMsgHandler()で登録したハンドラに直接振り分けられます。<BR>
+ * 型IDは完全一致で判別します。T から更に派生したクラスは、
+ * 改めて CThreadMsgT を使わない限り T の型IDのままです。
+ * 
+ */
+template <class T, class BASE = CThreadMsg>
+class CThreadMsgT : public BASE
+{
+public:
+	/// @brief 型IDを返す。（型毎に一意）
+	static int msgType()
+	{
+		static const int type = CThreadMsg::newMsgType();
+		return(type);
+	}
+
+	/// @brief コンストラクタ（BASE のコンストラクタに引数を渡す）
+	CThreadMsgT()
+	: BASE()
+	{ this->m_msg_type = msgType(); };
+	template <class A1>
+	CThreadMsgT(const A1& a1)
+	: BASE(a1)
+	{ this->m_msg_type = msgType(); };
+	template <class A1, class A2>
+	CThreadMsgT(const A1& a1, const A2& a2)
+	: BASE(a1, a2)
+	{ this->m_msg_type = msgType(); };
+	template <class A1, class A2, class A3>
+	CThreadMsgT(const A1& a1, const A2& a2, const A3& a3)
+	: BASE(a1, a2, a3)
+	{ this->m_msg_type = msgType(); };
+	template <class A1, class A2, class A3, class A4>
+	CThreadMsgT(const A1& a1, const A2& a2, const A3& a3, const A4& a4)
+	: BASE(a1, a2, a3, a4)
+	{ this->m_msg_type = msgType(); };
+
+	/// @brief デストラクタ
+	virtual ~CThreadMsgT() {};
 };
 
+/**
+ * @brief 型IDでメッセージを判別する。
+ *
+ * dynamic_cast<T*>(p_msg) の代わりに使用します。
+ * T は CThreadMsgT から派生したクラスに限ります。
+ *
+ * @param	p_msg	スレッドメッセージのポインタ
+ * @retval	T のポインタ（型IDが一致しなければ NULL）
+ */
+template <class T>
+inline T* msg_cast(CThreadMsg *p_msg)
+{
+	if (p_msg && (p_msg->getMsgType() == T::msgType())) {
+		return(static_cast<T*>(p_msg));
+	}
+	return(NULL);
+}
+
 /**
  * @class CStopMsg CThreadBase.h
  * @brief スレッド終了メッセージクラス
@@ -70,7 +377,7 @@ public:
  * スレッド終了メッセージは、通常 CThreadBase::stop()関数内で送信されます。
  * 
  */
-class CStopMsg : public CThreadMsg
+class CStopMsg : public CThreadMsgT<CStopMsg>
 {
 public:
 	/// @brief スレッド終了時の返り値
@@ -85,6 +392,148 @@ public:
 	virtual ~CStopMsg() {};
 };
 
+class CThreadBase;
+
+/**
+ * @class CQueueWatermarkMsg CThreadBase.h
+ * @brief キュー水位通知メッセージクラス
+ *
+ * スレッドキューの滞留数が高水位以上になった時、低水位以下に戻った時に、
+ * CThreadBase::addQueueListener()で登録したスレッドに送られます。<BR>
+ * 受信したスレッドでは CThreadBase::onQueueWatermark()が呼ばれます。<BR>
+ * 受信した時には送信元のスレッドが削除されているかもしれないので、
+ * m_p_thread は識別にだけ使用し、参照しません。
+ *
+ */
+class CQueueWatermarkMsg : public CThreadMsgT<CQueueWatermarkMsg>
+{
+public:
+	/// @brief 水位が変化したスレッド（識別用）
+	CThreadBase*	m_p_thread;
+
+	/// @brief 送った時点で高水位以上だったか否か
+	bool			m_bool_high;
+
+	/// @brief 送信元での通し番号（古い通知を捨てるのに使用する）
+	unsigned long long	m_seq;
+
+	/// @brief コンストラクタ
+	CQueueWatermarkMsg(CThreadBase *p_thread=NULL, bool bool_high=false, unsigned long long seq=0)
+	: m_p_thread(p_thread)
+	, m_bool_high(bool_high)
+	, m_seq(seq)
+	{};
+
+	/// @brief デストラクタ
+	virtual ~CQueueWatermarkMsg() {};
+};
+
+#if __cplusplus >= 201103L
+/**
+ * @class CTaskMsg CThreadBase.h
+ * @brief タスクメッセージクラス
+ *
+ * 引数なしで呼び出せる関数オブジェクト（ラムダ式等）を運ぶメッセージ。<BR>
+ * CThreadBase::postTask()で生成され、受信したスレッドで呼び出されます。<BR>
+ * INLINE_SIZE バイト以下の関数オブジェクトはメッセージ内に格納するので、
+ * メッセージ（メッセージプールから確保）以外の領域を確保しません。<BR>
+ * それより大きい場合は、関数オブジェクトだけ new で確保します。
+ * 
+ */
+class CTaskMsg : public CThreadMsgT<CTaskMsg>
+{
+public:
+	/// @brief メッセージ内に格納できる関数オブジェクトのサイズ（バイト）
+	enum { INLINE_SIZE = 48 };
+
+	/// @brief コンストラクタ
+	template <class F>
+	explicit CTaskMsg(F&& f)
+	{
+		typedef typename std::decay<F>::type FUNC;
+		typedef std::integral_constant<bool,
+					(sizeof(FUNC) <= INLINE_SIZE) &&
+					(alignof(FUNC) <= alignof(std::max_align_t))> IS_INLINE;
+		init<FUNC>(std::forward<F>(f), IS_INLINE());
+	};
+
+	/// @brief デストラクタ
+	virtual ~CTaskMsg() { m_p_destroy(m_buf); };
+
+	/// @brief 関数オブジェクトを呼び出す。
+	void run() { m_p_invoke(m_buf); };
+
+private:
+	typedef void (*FUNC_PTR)(void*);
+
+	// メッセージ内に格納する。
+	template <class FUNC, class F>
+	void init(F&& f, std::true_type)
+	{
+		new (m_buf) FUNC(std::forward<F>(f));
+		m_p_invoke  = &invokeInline<FUNC>;
+		m_p_destroy = &destroyInline<FUNC>;
+	};
+
+	// 関数オブジェクトだけ new で確保する。
+	template <class FUNC, class F>
+	void init(F&& f, std::false_type)
+	{
+		*reinterpret_cast<FUNC**>(m_buf) = new FUNC(std::forward<F>(f));
+		m_p_invoke  = &invokeHeap<FUNC>;
+		m_p_destroy = &destroyHeap<FUNC>;
+	};
+
+	template <class FUNC> static void invokeInline(void *p)  { (*static_cast<FUNC*>(p))(); }
+	template <class FUNC> static void destroyInline(void *p) { static_cast<FUNC*>(p)->~FUNC(); }
+	template <class FUNC> static void invokeHeap(void *p)    { (**static_cast<FUNC**>(p))(); }
+	template <class FUNC> static void destroyHeap(void *p)   { delete *static_cast<FUNC**>(p); }
+
+	/// @brief 関数オブジェクトの格納領域
+	alignas(std::max_align_t) unsigned char	m_buf[INLINE_SIZE];
+
+	/// @brief 呼び出し関数
+	FUNC_PTR	m_p_invoke;
+
+	/// @brief 破棄関数
+	FUNC_PTR	m_p_destroy;
+};
+#endif
+
+/**
+ * @class CPoolTask CThreadBase.h
+ * @brief プールタスクメッセージクラス
+ *
+ * タスクプール（CTaskPool）で実行する処理を持つメッセージです。<BR>
+ * CThreadBase::submitTask()で投入すると、プールのワーカスレッドで runTask()を
+ * 呼び出した後、投入したスレッドにメッセージとしてキューイングします。
+ * 結果はメンバに格納し、投入したスレッドのハンドラで受け取って下さい。<BR>
+ * runTask()は複数のワーカで並行して呼ばれるので、スレッドの状態には触らないで下さい。
+ * 
+ * 	class CParseTask : public CThreadMsgT<CParseTask, CPoolTask>
+ * 	{ public: void runTask() { ...; m_result = ...; } ... };
+ * 	submitTask(&pool, new CParseTask(...));	// 完了は onParseTask(CParseTask*)で受け取る。
+ *
+ */
+class CPoolTask : public CThreadMsg
+{
+public:
+	/// @brief コンストラクタ
+	CPoolTask() : m_p_reply_thread(NULL) {};
+
+	/// @brief デストラクタ
+	virtual ~CPoolTask() {};
+
+	/// @brief プールのワーカスレッドで実行する処理
+	virtual void runTask() = 0;
+
+private:
+	friend class CTaskPool;
+
+	/// @brief 完了を受け取るスレッド（NULL は削除する）
+	CThreadBase*	m_p_reply_thread;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // スレッドキュークラス
 ////////////////////////////////////////////////////////////////////////////////
@@ -95,14 +544,83 @@ public:
  * 
  * スレッドセーフなキュークラスです。<BR>
  * スレッドメッセージベースクラスのポインタをキューイングします。<BR>
- * パラメータの指定により、先頭にもキューイングできます。（優先処理）
- * 
+ * <BR>
+ * キューは優先度別のレーンに分かれています。（デフォルトは２レーン）<BR>
+ * レーン０（LANE_HIGH）が最優先で、put()の bool_front はレーン０に、
+ * それ以外はレーン１（LANE_NORMAL）に入れます。レーン２以降は通常より低い優先度です。<BR>
+ * 各レーンの中は到着順（FIFO）です。取り出し方は setLanes()で選びます。<BR>
+ * ・DRAIN_STRICT（デフォルト）：常に優先度の高いレーンから取り出す。<BR>
+ * ・DRAIN_WEIGHTED：レーン０を含む全レーンから、重みの数ずつ順番に取り出す。
+ * （高優先が続いても、低いレーンは止まらない）<BR>
+ * 高優先で登録した制御メッセージ（終了、水位通知）は、レーンとは別の制御用の
+ * 待ち行列に入れ、取り出し方に関わらず最初に取り出します。<BR>
+ * <BR>
+ * 下記の２つの方式があります。<BR>
+ * ・ロックフリー方式（デフォルト）<BR>
+ * 　メッセージ内のリンクで繋ぐ、複数送信元／単一受信先のキューをレーン毎に持ちます。<BR>
+ * 　put()はロックを取らず、送信元が多くても競合しません。<BR>
+ * 　get()、empty()、removeAll()は受信先スレッドだけが呼び出せます。<BR>
+ * ・ミューテック方式<BR>
+ * 　レーン毎の両頭待ち行列をミューテックで排他します。<BR>
+ * <BR>
+ * setCapacity()で容量（全レーンの合計）を設定すると、溢れた時の動作を選べます。<BR>
+ * ・FULL_BLOCK：空きができるまで送信元を待たせる。<BR>
+ * ・FULL_FAIL：登録せずに PUT_FULL を返す。<BR>
+ * ・FULL_DROP_OLDEST：最も低いレーンの最も古いメッセージを捨てて登録する。<BR>
+ * ・FULL_DROP_NEWEST：登録するメッセージを捨てる。<BR>
+ * setWatermark()で高水位と低水位を設定すると、滞留数がそれを跨いだ時に
+ * 設定した関数を呼び出します。<BR>
+ * <BR>
+ * キー（CThreadMsg::setConflateKey()）の付いたメッセージは、同じ型ID、同じキーの
+ * メッセージが取り出されずに残っていれば、それを置き換えます。<BR>
+ * 最初のメッセージはそのままキューに残し、新しいメッセージは別に預かります。
+ * 最初のメッセージを取り出した時に、預かっていた最新のメッセージと入れ替えます。
+ * 置き換えは滞留数を増やさず、容量の制限も受けません。
+ *
  */
 class CThreadQueue
 {
 public:
+	/// @brief キューの方式
+	typedef enum {
+				MODE_LOCKFREE,	///< ロックフリー方式
+				MODE_MUTEX		///< ミューテック方式
+			} MODE;
+
+	/// @brief レーン
+	enum {
+		LANE_HIGH	= 0,		///< 優先（put()の bool_front）
+		LANE_NORMAL	= 1,		///< 通常
+		MAX_LANES	= 8			///< レーン数の上限
+	};
+
+	/// @brief レーンからの取り出し方
+	typedef enum {
+				DRAIN_STRICT,	///< 優先度の高いレーンから
+				DRAIN_WEIGHTED	///< 重み付きラウンドロビン
+			} DRAIN;
+
+	/// @brief 容量を超えた時の動作
+	typedef enum {
+				FULL_BLOCK,			///< 空きができるまで待つ
+				FULL_FAIL,			///< 登録しない（PUT_FULL）
+				FULL_DROP_OLDEST,	///< 最も古いメッセージを捨てる（ミューテック方式）
+				FULL_DROP_NEWEST	///< 登録するメッセージを捨てる
+			} FULL;
+
+	/// @brief 登録の返り値
+	enum {
+		PUT_OK		=  0,		///< 正常（捨てた場合も含む）
+		PUT_ERROR	= -1,		///< パラメータエラー
+		PUT_FULL	= -2,		///< 容量を超えたので登録しなかった（FULL_FAIL）
+		PUT_CLOSED	= -3		///< 待っている間に閉じられた（FULL_BLOCK）
+	};
+
+	/// @brief 水位の変化を通知する関数（bool_high は高水位以上になったか否か）
+	typedef void (*WATERMARK_FUNC)(void *vp_arg, bool bool_high);
+
 	/// @brief コンストラクタ
-	CThreadQueue();
+	CThreadQueue(MODE mode=MODE_LOCKFREE);
 
 	/// @brief デストラクタ
 	virtual ~CThreadQueue();
@@ -119,6 +637,19 @@ public:
 	 */
 	int  put(CThreadMsg *p_msg, bool bool_front=false);
 
+	/**
+	 * @brief スレッドメッセージのポインタを、レーンを指定して登録する。
+	 *
+	 * 容量を超えて捨てたメッセージは、本関数内で解放します。（PUT_OK を返す）
+	 *
+	 * @param	p_msg		スレッドメッセージのポインタ
+	 * @param	lane		レーン（０が最優先。レーン数以上は最も低いレーン）
+	 * @param	bool_force	真の場合は容量に関わらず登録する。（待たない、捨てない）
+	 * @retval	PUT_OK		正常
+	 * @retval	PUT_OK以外	異常
+	 */
+	int  putLane(CThreadMsg *p_msg, int lane, bool bool_force=false);
+
 	/**
 	 * @brief スレッドメッセージのポインタを取り出す。
 	 *
@@ -130,6 +661,18 @@ public:
 	 */
 	int  get(CThreadMsg **pp_msg);
 
+	/**
+	 * @brief スレッドメッセージのポインタをまとめて取り出す。
+	 *
+	 * スレッドキューの先頭から最大 max_num 個のメッセージのポインタを取り出す。
+	 * ミューテック方式では、１回の排他で取り出す。
+	 *
+	 * @param	pp_msg		スレッドメッセージのポインタの配列
+	 * @param	max_num		配列の要素数
+	 * @retval	取り出した数（０は空）
+	 */
+	int  getBatch(CThreadMsg **pp_msg, int max_num);
+
 	/**
 	 * @brief キューイングされている全てのメッセージを削除します。
 	 *
@@ -147,41 +690,532 @@ public:
 	 */
 	bool empty();
 
-private:
-	/// @brief 両頭待ち行列
-	deque<CThreadMsg*>	m_dq_p_msg;
+	/**
+	 * @brief キューの方式を設定する。
+	 *
+	 * キューが空の時（使用前）に呼び出して下さい。
+	 *
+	 * @param	mode	キューの方式
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setMode(MODE mode);
 
-	/// @brief ミューテック
-	pthread_mutex_t		m_mutex;
-};
+	/**
+	 * @brief キューの方式を返す。
+	 *
+	 * @param	なし
+	 * @retval	キューの方式
+	 */
+	MODE getMode() const { return(m_mode); }
 
-////////////////////////////////////////////////////////////////////////////////
-// タイマ制御ブロッククラス、タイマ制御ブロックリストクラス
-////////////////////////////////////////////////////////////////////////////////
+	/**
+	 * @brief レーンを設定する。
+	 *
+	 * キューが空の時（使用前）に呼び出して下さい。
+	 *
+	 * @param	lanes		レーン数（２〜MAX_LANES）
+	 * @param	drain		取り出し方
+	 * @param	p_weights	レーン毎の重み（DRAIN_WEIGHTED／１以上／NULL は上のレーンから 2^n）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setLanes(int lanes, DRAIN drain=DRAIN_STRICT, const int *p_weights=NULL);
 
-/**
- * @class CTimerCB CThreadBase.h
- * @brief タイマ制御ブロッククラス
- * 
- * タイマ処理に必要な情報をまとめています。
- * 
- */
-class CTimerCB
-{
-public:
-	/// @brief 目標時刻
-	CTimeVal	m_target_time;
+	/**
+	 * @brief レーン数を返す。
+	 *
+	 * @param	なし
+	 * @retval	レーン数
+	 */
+	int  getLanes() const { return(m_lanes); }
 
-	/// @brief タイマID
-	int		m_timer_id;
+	/**
+	 * @brief レーンに溜まっているメッセージ数を返す。
+	 *
+	 * どのスレッドからも呼び出せます。（ロックフリー方式では概数）
+	 *
+	 * @param	lane	レーン
+	 * @retval	メッセージ数
+	 */
+	unsigned long getDepth(int lane);
 
-	/// @brief 周期（周期起動で使用）
-	int		m_msec_period;
+	/**
+	 * @brief 容量を設定する。
+	 *
+	 * キューが空の時（使用前）に呼び出して下さい。
+	 * FULL_DROP_OLDEST は送信元が古いメッセージを取り除くので、ミューテック方式に切り替えます。
+	 *
+	 * @param	capacity	容量（全レーンの合計／０は無制限）
+	 * @param	full		容量を超えた時の動作
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setCapacity(unsigned long capacity, FULL full=FULL_BLOCK);
 
-	/// @brief 削除フラグ
-	bool	m_remove;
+	/**
+	 * @brief 容量を返す。
+	 *
+	 * @param	なし
+	 * @retval	容量（０は無制限）
+	 */
+	unsigned long getCapacity() const { return(m_capacity); }
 
-	/// @brief コンストラクタ（デフォルト値付き）
+	/**
+	 * @brief 水位を設定する。
+	 *
+	 * キューが空の時（使用前）に呼び出して下さい。
+	 * 滞留数が高水位以上になった時は登録した送信元のスレッドで、
+	 * 低水位以下に戻った時は取り出した受信先のスレッドで、p_func を呼び出します。
+	 * p_func はどちらのスレッドからも呼ばれるので、短くスレッドセーフにして下さい。
+	 *
+	 * @param	high		高水位（０は通知しない）
+	 * @param	low			低水位（高水位未満）
+	 * @param	p_func		通知する関数
+	 * @param	vp_arg		p_func に渡す引数
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setWatermark(unsigned long high, unsigned long low, WATERMARK_FUNC p_func, void *vp_arg);
+
+	/**
+	 * @brief 高水位以上か否かを返す。（低水位以下に戻るまで真）
+	 *
+	 * @param	なし
+	 * @retval	真		高水位以上
+	 * @retval	偽		それ以外
+	 */
+	bool isHigh() const { return(__atomic_load_n(&m_high_state, __ATOMIC_ACQUIRE) != 0); }
+
+	/**
+	 * @brief 溜まっているメッセージ数（全レーンの合計）を返す。
+	 *
+	 * どのスレッドからも呼び出せます。（ロックフリー方式では概数）
+	 *
+	 * @param	なし
+	 * @retval	メッセージ数
+	 */
+	unsigned long size();
+
+	/**
+	 * @brief 容量を超えて捨てた（又は登録しなかった）メッセージ数を返す。
+	 *
+	 * @param	なし
+	 * @retval	メッセージ数
+	 */
+	unsigned long long getDropped() const { return(__atomic_load_n(&m_dropped, __ATOMIC_RELAXED)); }
+
+	/**
+	 * @brief まとめた（置き換えた）メッセージ数を返す。
+	 *
+	 * @param	なし
+	 * @retval	メッセージ数
+	 */
+	unsigned long long getConflated() const { return(__atomic_load_n(&m_conflated, __ATOMIC_RELAXED)); }
+
+	/**
+	 * @brief 滞留数の最大値を記録するか否かを設定する。
+	 *
+	 * キューが空の時（使用前）に呼び出して下さい。
+	 * 記録する場合は滞留数を数えるので、size()も概数ではなくなります。
+	 *
+	 * @param	bool_peak	真の場合は記録する
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setPeak(bool bool_peak);
+
+	/**
+	 * @brief 滞留数の最大値を返す。
+	 *
+	 * @param	なし
+	 * @retval	メッセージ数（記録していなければ０）
+	 */
+	unsigned long getPeak() const { return(__atomic_load_n(&m_peak, __ATOMIC_RELAXED)); }
+
+	/**
+	 * @brief 空きを待っている送信元を起こし、以降は待たせない。
+	 *
+	 * 受信先スレッドの終了時に呼び出します。待っていた送信元には PUT_CLOSED を返します。
+	 *
+	 * @param	なし
+	 * @retval	なし
+	 */
+	void close();
+
+	/**
+	 * @brief close()を解除する。
+	 *
+	 * @param	なし
+	 * @retval	なし
+	 */
+	void open();
+
+private:
+	/**
+	 * @brief ロックフリーのリスト（複数送信元／単一受信先）
+	 *
+	 * メッセージの m_p_next_msg で繋ぎます。
+	 * 送信側（m_p_head）と受信側（m_p_tail）は別のキャッシュラインに置きます。
+	 */
+	class CMpscList
+	{
+	public:
+		CMpscList();
+		void push(CThreadMsg *p_msg);
+		CThreadMsg* pop();
+		bool empty();
+		unsigned long depth() const;
+	private:
+		void link(CThreadMsg *p_msg);
+		CThreadMsg*		m_p_head;		///< 最後に登録されたメッセージ（送信側）
+		unsigned long	m_pushed;		///< 登録数（送信側）
+		char			m_pad[64];		///< 送信側と受信側を分ける
+		CThreadMsg*		m_p_tail;		///< 次に取り出すメッセージ（受信側）
+		unsigned long	m_popped;		///< 取り出し数（受信側）
+		CThreadMsg		m_stub;			///< 番兵
+	};
+
+	/// @brief レーンから１つ取り出す。（ミューテック方式は m_mutex取得済みで呼び出す）
+	CThreadMsg* popLane(int lane);
+
+	/// @brief 取り出し方に従って１つ取り出す。（同上）
+	CThreadMsg* pop();
+
+	/// @brief 制御用の待ち行列に入れるメッセージか否か（高優先の終了、水位通知）
+	static bool isControl(CThreadMsg *p_msg);
+
+	/// @brief 登録するメッセージを捨てた（reserve()の返り値）
+	enum { PUT_DROPPED = 1 };
+
+	/// @brief 容量を確保する。（確保できなければ PUT_OK 以外。PUT_DROPPED は解放済み）
+	int  reserve(CThreadMsg *p_msg);
+
+	/// @brief 空きができるまで待つ。（閉じられたら偽）
+	bool waitSpace();
+
+	/// @brief 最も低いレーンの最も古いメッセージを外す。（m_mutex取得済みで呼び出す）
+	CThreadMsg* removeOldest();
+
+	/// @brief まとめるキーが付いているか否か
+	static bool isKeyed(const CThreadMsg *p_msg)
+	{
+		return((p_msg->m_conflate_key != 0) && (p_msg->m_msg_type != CThreadMsg::MSG_TYPE_NONE));
+	}
+
+	/// @brief 取り出されていない同じキーのメッセージを置き換える。（なければ偽。bool_insert は登録する）
+	bool conflate(CThreadMsg *p_msg, bool bool_insert);
+
+	/// @brief 取り出したメッセージを、預かっている最新のメッセージと入れ替える。
+	CThreadMsg* takeLatest(CThreadMsg *p_msg);
+
+	/// @brief 登録した。（高水位の確認）
+	void pushed(unsigned long count);
+
+	/// @brief 取り出した。（待っている送信元を起こし、低水位を確認）
+	void popped(unsigned long num);
+
+	/// @brief キューの方式
+	MODE				m_mode;
+
+	/// @brief レーン数
+	int					m_lanes;
+
+	/// @brief 取り出し方
+	DRAIN				m_drain;
+
+	/// @brief レーン毎の重み（DRAIN_WEIGHTED）
+	int					m_weight[MAX_LANES];
+
+	/// @brief 取り出し中のレーンと残りの数（DRAIN_WEIGHTED／受信側）
+	int					m_rr_lane;
+	int					m_rr_credit;
+
+	/// @brief レーン毎の両頭待ち行列（ミューテック方式）
+	vector< deque<CThreadMsg*> >	m_vec_dq_p_msg;
+
+	/// @brief ミューテック（ミューテック方式）
+	pthread_mutex_t		m_mutex;
+
+	/// @brief レーン毎のリスト（ロックフリー方式）
+	CMpscList			m_list[MAX_LANES];
+
+	/// @brief 制御メッセージのリスト（ロックフリー方式）と両頭待ち行列（ミューテック方式）
+	CMpscList			m_control_list;
+	deque<CThreadMsg*>	m_dq_control;
+
+	/// @brief 容量（０は無制限）と、超えた時の動作
+	unsigned long		m_capacity;
+	FULL				m_full;
+
+	/// @brief 水位と通知する関数
+	unsigned long		m_high;
+	unsigned long		m_low;
+	WATERMARK_FUNC		m_p_watermark;
+	void*				m_vp_watermark_arg;
+
+	/// @brief 滞留数を数えるか否か（容量か水位を設定した場合、最大値を記録する場合のみ）
+	bool				m_bool_count;
+
+	/// @brief 滞留数（登録前に確保し、取り出した後に戻す）
+	unsigned long		m_count;
+
+	/// @brief 滞留数の最大値を記録するか否かと、その最大値
+	bool				m_bool_peak;
+	unsigned long		m_peak;
+
+	/// @brief 高水位以上の状態か否か
+	int					m_high_state;
+
+	/// @brief 捨てた（又は登録しなかった）メッセージ数
+	unsigned long long	m_dropped;
+
+	/// @brief 空きを待っている送信元の数と、その待ち合わせ（FULL_BLOCK）
+	int					m_blocked;
+	bool				m_bool_closed;
+	pthread_mutex_t		m_space_mutex;
+	pthread_cond_t		m_space_cond;
+
+	/// @brief まとめるキー（型ID、キー）
+	typedef pair<int, unsigned long>	CONFLATE_KEY;
+
+	/// @brief キュー内のメッセージと、それを置き換える最新のメッセージ
+	struct CConflate {
+		CThreadMsg*		p_queued;
+		CThreadMsg*		p_latest;
+	};
+
+	/// @brief 取り出されていないキー付きメッセージ
+	map<CONFLATE_KEY, CConflate>	m_map_conflate;
+
+	/// @brief ミューテック（上記の排他）
+	pthread_mutex_t		m_conflate_mutex;
+
+	/// @brief まとめたメッセージ数
+	unsigned long long	m_conflated;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// スレッド通知クラス
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @class CThreadNotifier CThreadBase.h
+ * @brief スレッド通知クラス
+ * 
+ * メッセージがキューイングされたことを、待ち状態のスレッドに通知します。<BR>
+ * Linuxでは eventfd を使用します。（ファイルディスクリプタは１つ）<BR>
+ * eventfd はカウンタなので、何度通知されても drain()の１回の読み込みで済みます。<BR>
+ * それ以外の環境ではパイプを使用します。
+ * 
+ */
+class CThreadNotifier
+{
+public:
+	/// @brief コンストラクタ
+	CThreadNotifier();
+
+	/// @brief デストラクタ
+	virtual ~CThreadNotifier();
+
+	/**
+	 * @brief 監視用のファイルディスクリプタを返す。
+	 *
+	 * @param	なし
+	 * @retval	ファイルディスクリプタ
+	 */
+	int  getFD() const { return(m_fd[FD_READ]); }
+
+	/**
+	 * @brief 待ち状態のスレッドに通知する。
+	 *
+	 * @param	なし
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  notify();
+
+	/**
+	 * @brief 溜まっている通知を全て読み捨てる。
+	 *
+	 * @param	なし
+	 * @retval	なし
+	 */
+	void drain();
+
+private:
+	/// @brief ファイルディスクリプタ（eventfd の場合は両方同じ）
+	enum {
+		FD_READ		= 0,	///< 読み込み用
+		FD_WRITE	= 1,	///< 書き込み用
+		FD_SIZE		= 2		///< サイズ
+	};
+	int		m_fd[FD_SIZE];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// 時計クラス
+////////////////////////////////////////////////////////////////////////////////
+
+class CTimerCBList;
+
+/**
+ * @class CClock CThreadBase.h
+ * @brief 時計クラス
+ * 
+ * タイマが使う時刻（ナノ秒）の取得元です。<BR>
+ * 標準は CMonotonicClock（CLOCK_MONOTONIC）で、試験では CVirtualClock に
+ * 差し替えると、実際に待たずに時刻を進められます。
+ * 
+ */
+class CClock
+{
+public:
+	/// @brief デストラクタ
+	virtual ~CClock() {};
+
+	/**
+	 * @brief 現在時刻を返す。
+	 * 
+	 * @param	なし
+	 * @retval	現在時刻（ナノ秒）
+	 */
+	virtual long long now() const = 0;
+
+	/**
+	 * @brief 仮想時計か否か
+	 * 
+	 * 仮想時計の時刻は、実際の時間の経過では進みません。
+	 * 
+	 * @param	なし
+	 * @retval	true	仮想時計
+	 * @retval	false	実際の時計
+	 */
+	virtual bool isVirtual() const { return(false); }
+
+	/// @brief タイマ制御ブロックリストが使い始める。（時刻を進めた時に知らせる）
+	virtual void attach(CTimerCBList * /*p_list*/) {};
+
+	/// @brief タイマ制御ブロックリストが使い終わる。
+	virtual void detach(CTimerCBList * /*p_list*/) {};
+
+	/**
+	 * @brief 標準の時計（CMonotonicClock）を返す。
+	 * 
+	 * @param	なし
+	 * @retval	時計のポインタ
+	 */
+	static CClock* getDefault();
+};
+
+/**
+ * @class CMonotonicClock CThreadBase.h
+ * @brief 実時間の時計クラス（CLOCK_MONOTONIC）
+ * 
+ */
+class CMonotonicClock : public CClock
+{
+public:
+	/// @brief 現在時刻を返す。
+	virtual long long now() const;
+};
+
+/**
+ * @class CVirtualClock CThreadBase.h
+ * @brief 仮想時計クラス
+ * 
+ * 時刻は set()、advance()でだけ進みます。<BR>
+ * 時刻を進めると、この時計を使うスレッドを起こし、時刻が来たタイマを処理させます。
+ * 何時間分のタイマ動作も、実際に待たずに確認できます。
+ * 
+ * 	CVirtualClock clock;
+ * 	thread.setClock(&clock);	// start()前
+ * 	thread.start();
+ * 	clock.advance(60 * 1000000000LL);	// １分進める
+ * 
+ * 時計は、使うスレッドより後に破棄してください。
+ * 
+ */
+class CVirtualClock : public CClock
+{
+public:
+	/**
+	 * @brief コンストラクタ
+	 * 
+	 * @param	nsec_start	開始時刻（ナノ秒）
+	 */
+	CVirtualClock(long long nsec_start=0);
+
+	/// @brief デストラクタ
+	virtual ~CVirtualClock();
+
+	/// @brief 現在時刻を返す。
+	virtual long long now() const;
+
+	/// @brief 仮想時計か否か（真）
+	virtual bool isVirtual() const { return(true); }
+
+	/// @brief タイマ制御ブロックリストが使い始める。
+	virtual void attach(CTimerCBList *p_list);
+
+	/// @brief タイマ制御ブロックリストが使い終わる。
+	virtual void detach(CTimerCBList *p_list);
+
+	/**
+	 * @brief 時刻を設定する。（戻すことはできない）
+	 * 
+	 * @param	nsec_time	時刻（ナノ秒）
+	 * @retval	なし
+	 */
+	void set(long long nsec_time);
+
+	/**
+	 * @brief 時刻を進める。
+	 * 
+	 * @param	nsec_elapsed_time	進める時間（ナノ秒）
+	 * @retval	なし
+	 */
+	void advance(long long nsec_elapsed_time);
+
+private:
+	CVirtualClock(const CVirtualClock&);
+	CVirtualClock& operator=(const CVirtualClock&);
+
+	/// @brief 時刻を進めたことを知らせる。
+	void notify();
+
+	long long				m_now;			///< 現在時刻
+	vector<CTimerCBList*>	m_vec_p_list;	///< この時計を使うタイマ制御ブロックリスト
+	pthread_mutex_t			m_mutex;		///< ミューテック（上記リストの排他）
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// タイマ制御ブロッククラス、タイマ制御ブロックリストクラス
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @class CTimerCB CThreadBase.h
+ * @brief タイマ制御ブロッククラス
+ * 
+ * タイマ処理に必要な情報をまとめています。
+ * 
+ */
+class CTimerCB
+{
+public:
+	/// @brief 目標時刻
+	CTimeVal	m_target_time;
+
+	/// @brief タイマID
+	int		m_timer_id;
+
+	/// @brief 周期（周期起動で使用）
+	int		m_msec_period;
+
+	/// @brief 削除フラグ
+	bool	m_remove;
+
+	/// @brief コンストラクタ（デフォルト値付き）
 	CTimerCB(int msec_elapsed_time=0, int timer_id=0, int msec_period=0)
 	: m_timer_id(timer_id)
 	, m_msec_period(msec_period)
@@ -191,107 +1225,929 @@ public:
 		m_target_time.addMS(msec_elapsed_time);
 	};
 
-	/// @brief デストラクタ
-	virtual ~CTimerCB()
+	/// @brief デストラクタ
+	virtual ~CTimerCB()
+	{
+	};
+
+	/**
+	 * @brief 削除の可否を返す。
+	 * 
+	 * STLのアルゴリズム（remove_if）で使用する。
+	 * 
+	 * @param	x		タイマ制御ブロック
+	 * @retval	0		削除不可
+	 * @retval	0以外	削除可
+	 */
+	static bool is_remove(const CTimerCB& x)
+	{
+		return(x.m_remove);
+	}
+
+	/**
+	 * @brief 時刻の比較をする。
+	 * 
+	 * @param	x		比較対象のタイマ制御ブロック
+	 * @retval	0		比較対象と等しいか大きい
+	 * @retval	0以外	比較対象より小さい
+	 */
+	bool operator<(const CTimerCB& x) const
+	{
+		return(m_target_time < x.m_target_time);
+	}
+};
+
+/**
+ * @class CTimerHandle CThreadBase.h
+ * @brief タイマハンドルクラス
+ * 
+ * setTimer()で設定したタイマを１つだけ指します。<BR>
+ * タイマの管理表の位置と世代番号を持ち、タイムアウト又はキャンセルで
+ * 位置が再利用されても、古いハンドルは一致しません。<BR>
+ * 発行したタイマ制御ブロックリストも持ち、他のスレッドのタイマには一致しません。
+ * 
+ */
+class CTimerHandle
+{
+public:
+	/// @brief コンストラクタ
+	CTimerHandle()
+	: m_p_list(NULL)
+	, m_index(0)
+	, m_generation(0)
+	{
+	};
+
+	/// @brief ハンドルが設定されているか否か
+	bool isSet() const
+	{
+		return(m_generation != 0);
+	}
+
+	/// @brief ハンドルをクリアする。
+	void clear()
+	{
+		m_p_list     = NULL;
+		m_index      = 0;
+		m_generation = 0;
+	}
+
+	/// @brief 比較
+	bool operator==(const CTimerHandle& x) const
+	{
+		return((m_p_list == x.m_p_list) && (m_index == x.m_index) && (m_generation == x.m_generation));
+	}
+	bool operator!=(const CTimerHandle& x) const
+	{
+		return(!(*this == x));
+	}
+
+private:
+	friend class CTimerCBList;
+
+	const CTimerCBList*	m_p_list;	///< 発行したタイマ制御ブロックリスト
+	unsigned int	m_index;		///< 管理表の位置
+	unsigned int	m_generation;	///< 世代番号（０は未設定）
+};
+
+/**
+ * @class CTimerCBList CThreadBase.h
+ * @brief タイマ制御ブロックリストクラス
+ * 
+ * タイマ制御ブロックを階層タイミングホイールで管理する。<BR>
+ * 時刻は CLOCK_MONOTONIC のナノ秒で扱うので、時刻合わせ（NTP等）の影響を受けません。
+ * setClock()で時計（CClock）を差し替えることもできます。<BR>
+ * タイムアウト時刻はナノ秒で持ち、ホイールはマイクロ秒を１ティックとして、
+ * WHEEL_SIZE 個のスロットを持つ段を WHEEL_LEVELS 段重ねています。
+ * 上の段ほど１スロットの幅が広く、時刻が近づくと下の段に移します。<BR>
+ * ホイールへの出し入れはタイマ数によらず一定時間です。<BR>
+ * キャンセルはタイマID毎の索引、又はタイマハンドルで行います。（全体を走査しない）
+ * 索引は map なので、登録・削除時の索引の更新は、使用中のタイマIDの種類数 k に対して
+ * O(log k) かかります。（同じタイマIDのタイマの数にはよらない）<BR>
+ * タイマは管理表に確保し、解放したものを再利用します。<BR>
+ * 同じティックにタイムアウトするタイマは、登録順に取り出します。<BR>
+ * <BR>
+ * 猶予（slack）を指定したタイマは、タイムアウト時刻から猶予の範囲で、なるべく
+ * 区切りのよいティックにずらします。猶予の範囲が重なるタイマは同じティックに
+ * 揃いやすくなり、１回の起床でまとめて処理できます。<BR>
+ * <BR>
+ * Linuxでは timerfd を１つ持ち、次に起きるべき時刻に合わせます。
+ * スレッドは getFD()を監視すれば、タイムアウトで起こされます。
+ * （他のスレッドから早い時刻のタイマを登録した場合も、timerfd を合わせ直す）
+ * 
+ */
+class CTimerCBList
+{
+public:
+	/// @brief コンストラクタ
+	CTimerCBList();
+
+	/// @brief デストラクタ
+	virtual ~CTimerCBList();
+
+	/**
+	 * @brief 現在時刻（CLOCK_MONOTONIC）をナノ秒で返す。
+	 * 
+	 * @param	なし
+	 * @retval	現在時刻（ナノ秒）
+	 */
+	static long long getTime();
+
+	/**
+	 * @brief 時計を設定する。
+	 * 
+	 * タイマを登録する前に設定すること。
+	 * 
+	 * @param	p_clock		時計（NULL は標準の時計）
+	 * @param	p_notifier	仮想時計の時刻を進めた時に、timerfd の代わりに使う通知
+	 * @retval	0		正常
+	 * @retval	0以外	異常（タイマ登録あり）
+	 */
+	int  setClock(CClock *p_clock, CThreadNotifier *p_notifier=NULL);
+
+	/**
+	 * @brief 時計を返す。
+	 * 
+	 * @param	なし
+	 * @retval	時計のポインタ
+	 */
+	CClock* getClock() const { return(m_p_clock); }
+
+	/**
+	 * @brief 時計の現在時刻を返す。
+	 * 
+	 * @param	なし
+	 * @retval	現在時刻（ナノ秒）
+	 */
+	long long now() const { return(m_p_clock->now()); }
+
+	/**
+	 * @brief 時刻が進んだことを、待っているスレッドに知らせる。（仮想時計から呼ばれる）
+	 * 
+	 * @param	なし
+	 * @retval	なし
+	 */
+	void kick();
+
+	/**
+	 * @brief タイマ制御ブロックを作り、リストに登録する。
+	 * 
+	 * @param	msec_elapsed_time	タイムアウトまでの経過時間（ミリ秒単位）
+	 * @param	timer_id			タイマID
+	 * @param	msec_period			周期（周期起動で使用／ミリ秒単位）
+	 * @param	p_handle			タイマハンドルを返す。（不要なら NULL）
+	 * @param	msec_slack			遅れてよい時間（ミリ秒単位）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  set(int msec_elapsed_time, int timer_id=0, int msec_period=0, CTimerHandle *p_handle=NULL, int msec_slack=0);
+
+	/**
+	 * @brief タイマ制御ブロックを作り、リストに登録する。（ナノ秒単位）
+	 * 
+	 * @param	nsec_elapsed_time	タイムアウトまでの経過時間（ナノ秒単位）
+	 * @param	timer_id			タイマID
+	 * @param	nsec_period			周期（周期起動で使用／ナノ秒単位）
+	 * @param	p_handle			タイマハンドルを返す。（不要なら NULL）
+	 * @param	nsec_slack			遅れてよい時間（ナノ秒単位）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setNs(long long nsec_elapsed_time, int timer_id=0, long long nsec_period=0, CTimerHandle *p_handle=NULL, long long nsec_slack=0);
+
+	/**
+	 * @brief タイマ制御ブロックを、リストに登録する。
+	 * 
+	 * 目標時刻（gettimeofday()の時刻）までの残り時間で登録します。
+	 * 
+	 * @param	rTimerCB	タイマ制御ブロック
+	 * @param	p_handle	タイマハンドルを返す。（不要なら NULL）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  set(CTimerCB &rTimerCB, CTimerHandle *p_handle=NULL);
+
+	/**
+	 * @brief メッセージを預けるタイマを登録する。
+	 * 
+	 * タイムアウトすると、timeout()でメッセージを返します。
+	 * 取り出す前に削除されたタイマのメッセージは、本クラスが解放します。
+	 * 
+	 * @param	nsec_deadline	タイムアウト時刻（now()と同じナノ秒）
+	 * @param	timer_id		タイマID（内部用）
+	 * @param	p_msg			スレッドメッセージのポインタ
+	 * @param	p_handle		タイマハンドルを返す。（不要なら NULL）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setMsg(long long nsec_deadline, int timer_id, CThreadMsg *p_msg, CTimerHandle *p_handle=NULL);
+
+	/**
+	 * @brief リストからタイマ制御ブロックを削除する。
+	 * 
+	 * @param	timer_id	削除するタイマID。-1であれば全て削除する。
+	 * 						（-1 の場合も、(-1)未満の内部用タイマは削除しない）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  cancel(int timer_id=0);	// timer_id が (-1)であれば全キャンセル
+
+	/**
+	 * @brief タイマハンドルが指すタイマだけを削除する。
+	 * 
+	 * @param	handle		タイマハンドル
+	 * @retval	0		正常
+	 * @retval	0以外	異常（タイムアウト又はキャンセル済み、他のリストのハンドル、(-1)未満の内部用タイマ）
+	 */
+	int  cancel(const CTimerHandle& handle);
+
+	/**
+	 * @brief タイマハンドルが指す、メッセージを預けたタイマだけを削除する。
+	 * 
+	 * 預けていたメッセージは解放します。
+	 * 
+	 * @param	handle		setMsg()で受け取ったタイマハンドル
+	 * @retval	0		正常
+	 * @retval	0以外	異常（キューイング又はキャンセル済み、他のリストのハンドル、メッセージのタイマでない）
+	 */
+	int  cancelMsg(const CTimerHandle& handle);
+
+	/**
+	 * @brief タイムアウトしたタイマ制御ブロックを１つ取り出す。
+	 * 
+	 * 周期起動のタイマは、次の周期で登録し直す。
+	 * 
+	 * @param	p_timer_id	タイムアウトしたタイマIDを返す。
+	 * @param	p_handle	タイムアウトしたタイマのハンドルを返す。
+	 * @param	pp_msg		setMsg()で預けたメッセージを返す。（それ以外は NULL）
+	 * @param	p_nsec_late	タイムアウトすべき時刻からの遅れ（ナノ秒）を返す。
+	 * @retval	0		タイムアウトしていない
+	 * @retval	0以外	タイムアウト
+	 */
+	bool timeout(int *p_timer_id=NULL, CTimerHandle *p_handle=NULL, CThreadMsg **pp_msg=NULL, long long *p_nsec_late=NULL);
+
+	/**
+	 * @brief 次に起きるべき時刻を返す。
+	 * 
+	 * 上の段のタイマは、下の段に移す時刻を返します。（タイムアウトより早いことがある）
+	 * 
+	 * @param	なし
+	 * @retval	0		タイマ登録がない
+	 * @retval	0以外	次に起きるべき時刻（now()と同じナノ秒）
+	 */
+	long long next_time();
+
+	/**
+	 * @brief 監視用の timerfd を返す。
+	 * 
+	 * @param	なし
+	 * @retval	(-1)	timerfd が使用できない（next_time()で待ち時間を決めること）
+	 * @retval	(-1)以外	ファイルディスクリプタ
+	 */
+	int  getFD() const { return(m_timer_fd); }
+
+	/**
+	 * @brief timerfd を次に起きるべき時刻に合わせる。
+	 * 
+	 * 待ちに入る前に呼び出す。時刻が変わっていなければ何もしない。
+	 * 
+	 * @param	なし
+	 * @retval	なし
+	 */
+	void arm();
+
+	/**
+	 * @brief timerfd の通知を読み捨てる。
+	 * 
+	 * @param	なし
+	 * @retval	なし
+	 */
+	void drain();
+
+private:
+	/// @brief タイミングホイールの大きさ
+	enum {
+		WHEEL_BITS		= 6,						///< １段のスロット数（ビット数）
+		WHEEL_SIZE		= (1 << WHEEL_BITS),		///< １段のスロット数
+		WHEEL_MASK		= (WHEEL_SIZE - 1),
+		WHEEL_LEVELS	= 7,						///< 段数（2^42 マイクロ秒まで）
+		NODE_CHUNK		= 256,						///< 管理表を一度に確保する数
+		TICK_NSEC		= 1000						///< １ティックのナノ秒
+	};
+
+	/// @brief ティック（CLOCK_MONOTONIC のマイクロ秒）
+	typedef unsigned long long TICK;
+
+	/// @brief 双方向リストのリンク（スロットの先頭は番兵）
+	class CLink
+	{
+	public:
+		CLink*	m_p_prev;
+		CLink*	m_p_next;
+		CLink() : m_p_prev(this), m_p_next(this) {};
+		bool empty() const { return(m_p_next == this); };
+	};
+
+	/// @brief タイマ
+	class CNode : public CLink
+	{
+	public:
+		long long	m_deadline;		///< タイムアウト時刻（ナノ秒）
+		long long	m_nsec_period;	///< 周期（ナノ秒）
+		long long	m_nsec_slack;	///< 遅れてよい時間（ナノ秒）
+		CThreadMsg*	m_p_msg;		///< 預かっているメッセージ
+		TICK	m_expire;			///< タイムアウトするティック
+		int		m_timer_id;			///< タイマID
+		int		m_level;			///< 段（(-1)はタイムアウト済み）
+		int		m_slot;				///< スロット
+		CNode*	m_p_id_prev;		///< 同じタイマIDの前
+		CNode*	m_p_id_next;		///< 同じタイマIDの次（空きは空きリストの次）
+		unsigned int	m_index;		///< 管理表の位置
+		unsigned int	m_generation;	///< 世代番号（解放する度に進める）
+	};
+
+	CTimerCBList(const CTimerCBList&);
+	CTimerCBList& operator=(const CTimerCBList&);
+
+	int  insert(long long deadline, int timer_id, long long nsec_period, long long nsec_slack, CTimerHandle *p_handle, CThreadMsg *p_msg=NULL);
+	static TICK toTick(long long nsec, bool bool_round_up);
+	static TICK toExpire(long long deadline, long long nsec_slack);
+	void add(CNode *p_node);
+	void unlink(CNode *p_node);
+	void remove(CNode *p_node);
+	CNode* allocNode();
+	void freeNode(CNode *p_node);
+	CNode* findNode(const CTimerHandle& handle);
+	void cascade(int level, int slot);
+	void advance(TICK now);
+	bool nextTick(TICK *p_tick) const;
+	void setFD(TICK tick);
+
+	/// @brief 次に処理するティック
+	TICK			m_cur_tick;
+
+	/// @brief スロット
+	CLink			m_slot[WHEEL_LEVELS][WHEEL_SIZE];
+
+	/// @brief 空でないスロット（段毎のビットマップ）
+	unsigned long long	m_bitmap[WHEEL_LEVELS];
+
+	/// @brief タイムアウト済みのリスト
+	CLink			m_expired;
+
+	/// @brief タイマID毎の索引（同じタイマIDのタイマの先頭）
+	map<int, CNode*>	m_map_p_node;
+
+	/// @brief タイマの管理表（NODE_CHUNK 個ずつ確保）
+	vector<CNode*>	m_vec_p_chunk;
+
+	/// @brief 空いているタイマのリスト
+	CNode*			m_p_free_node;
+
+	/// @brief timerfd（使用できなければ (-1)）
+	int				m_timer_fd;
+
+	/// @brief timerfd に設定しているティック（０は未設定）
+	TICK			m_armed_tick;
+
+	/// @brief 時計
+	CClock*			m_p_clock;
+
+	/// @brief timerfd の代わりに使う通知（仮想時計用）
+	CThreadNotifier*	m_p_notifier;
+
+	/// @brief ミューテック
+	pthread_mutex_t	m_mutex;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// メッセージハンドラクラス
+////////////////////////////////////////////////////////////////////////////////
+
+class CThreadBase;
+class CFutureState;
+
+/**
+ * @class CMsgHandler CThreadBase.h
+ * @brief メッセージハンドラクラス
+ * 
+ * CThreadBase::setMsgHandler()で登録したメンバ関数を呼び出します。
+ * 
+ */
+class CMsgHandler
+{
+public:
+	/// @brief デストラクタ
+	virtual ~CMsgHandler() {};
+
+	/**
+	 * @brief ハンドラを呼び出す。
+	 * 
+	 * @param	p_thread_base	ハンドラを登録したスレッド
+	 * @param	p_msg			スレッドメッセージのポインタ（型IDは一致済み）
+	 * @retval	ハンドラの返り値
+	 */
+	virtual int invoke(CThreadBase *p_thread_base, CThreadMsg *p_msg) = 0;
+};
+
+/**
+ * @class CMsgHandlerT CThreadBase.h
+ * @brief メッセージハンドラテンプレート
+ * 
+ * T のメンバ関数 int T::handler(MSG*) を呼び出します。
+ * 
+ */
+template <class T, class MSG>
+class CMsgHandlerT : public CMsgHandler
+{
+public:
+	/// @brief コンストラクタ
+	CMsgHandlerT(int (T::*handler)(MSG*))
+	: m_handler(handler)
+	{};
+
+	/// @brief デストラクタ
+	virtual ~CMsgHandlerT() {};
+
+	virtual int invoke(CThreadBase *p_thread_base, CThreadMsg *p_msg)
+	{
+		return((static_cast<T*>(p_thread_base)->*m_handler)(static_cast<MSG*>(p_msg)));
+	}
+
+private:
+	int (T::*m_handler)(MSG*);
+};
+
+#if __cplusplus >= 201103L
+////////////////////////////////////////////////////////////////////////////////
+// フューチャ、プロミス、要求メッセージクラス（要求／応答）
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @class CFutureState CThreadBase.h
+ * @brief フューチャの共有状態クラス
+ * 
+ * 要求元（CFuture）と要求先（CPromise）で共有し、参照カウントで解放します。<BR>
+ * 領域はメッセージプールから確保し、結果は CFutureStateT の中に格納するので、
+ * 完了時に領域を確保しません。<BR>
+ * 状態は STS_PENDING から、ただ一度だけ CThreadBase のエラーコードに変わります。
+ * （正常は ERR_OK、タイムアウトは ERR_TIMEOUT、要求先が応答せずに
+ * メッセージを破棄した場合は ERR_TERMINATE）<BR>
+ * 応答メッセージが設定されていれば、完了時に要求元スレッドにキューイングします。
+ * 
+ */
+class CFutureState
+{
+public:
+	/// @brief 完了前の状態
+	enum {
+		STS_PENDING		= 1,	///< 完了していない
+		STS_COMPLETING	= 2		///< 完了処理中（結果を格納中）
+	};
+
+	/// @brief コンストラクタ
+	CFutureState();
+
+	/// @brief デストラクタ
+	virtual ~CFutureState();
+
+	/// @brief 参照を追加する。
+	void addRef() { __atomic_add_fetch(&m_ref, 1, __ATOMIC_RELAXED); }
+
+	/// @brief 参照を外す。（最後の参照であれば解放する）
+	void release()
+	{
+		if (__atomic_sub_fetch(&m_ref, 1, __ATOMIC_ACQ_REL) == 0) {
+			delete this;
+		}
+	}
+
+	/**
+	 * @brief 状態を返す。
+	 *
+	 * @param	なし
+	 * @retval	STS_PENDING	完了していない
+	 * @retval	上記以外	完了（CThreadBase のエラーコード）
+	 */
+	int  status() const
+	{
+		int sts = __atomic_load_n(&m_status, __ATOMIC_ACQUIRE);
+		return((sts == STS_COMPLETING) ? STS_PENDING : sts);
+	}
+
+	/**
+	 * @brief 完了を待つ。
+	 *
+	 * @param	msec_timeout	待ち時間（ミリ秒単位／負の値は無期限）
+	 * @retval	状態（時間内に完了しなければ ERR_TIMEOUT。状態は変えない）
+	 */
+	int  wait(int msec_timeout);
+
+	/**
+	 * @brief 結果なしで完了させる。
+	 *
+	 * @param	sts		状態（CThreadBase のエラーコード）
+	 * @retval	true	完了させた
+	 * @retval	false	既に完了していた
+	 */
+	bool complete(int sts)
+	{
+		if (!begin()) {
+			return(false);
+		}
+		finish(sts);
+		return(true);
+	}
+
+	/// @brief 正常（ERR_OK）で完了させる。（既に完了していた場合は偽）
+	bool completeOK();
+
+	/// @brief 応答なし（ERR_TERMINATE）で完了させる。（既に完了していた場合は偽）
+	bool abandon();
+
+	/**
+	 * @brief 完了時に要求元スレッドにキューイングするメッセージを設定する。
+	 *
+	 * 要求を送信する前に設定して下さい。完了しないまま解放された場合は削除します。
+	 *
+	 * @param	p_thread	要求元スレッド
+	 * @param	p_msg		応答メッセージ
+	 * @retval	なし
+	 */
+	void setReply(CThreadBase *p_thread, CThreadMsg *p_msg)
+	{
+		m_p_reply_thread = p_thread;
+		m_p_reply_msg    = p_msg;
+	}
+
+	/// @brief メッセージプールから確保する。
+	static void* operator new(size_t size) { return(CThreadMsgPool::allocate(size)); }
+
+	/// @brief メッセージプールに返す。
+	static void  operator delete(void *p, size_t size) { CThreadMsgPool::deallocate(p, size); }
+
+protected:
+	/// @brief 完了処理を開始する。（STS_PENDING -> STS_COMPLETING）
+	bool begin()
+	{
+		int sts = STS_PENDING;
+		return(__atomic_compare_exchange_n(&m_status, &sts, static_cast<int>(STS_COMPLETING),
+					false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+	}
+
+	/// @brief 完了処理を終了する。（待っているスレッドを起こし、応答メッセージを送る）
+	void finish(int sts);
+
+	/// @brief 正常（ERR_OK）で完了処理を終了する。
+	void finishOK();
+
+private:
+	CFutureState(const CFutureState&);
+	CFutureState& operator=(const CFutureState&);
+
+	int					m_ref;				///< 参照カウント
+	int					m_status;			///< 状態
+	int					m_waiting;			///< wait()で待っているスレッドがある
+	pthread_mutex_t		m_mutex;			///< wait()用
+	pthread_cond_t		m_cond;				///< wait()用
+	CThreadBase*		m_p_reply_thread;	///< 要求元スレッド
+	CThreadMsg*			m_p_reply_msg;		///< 応答メッセージ
+};
+
+/**
+ * @class CFutureStateT CThreadBase.h
+ * @brief 結果付きのフューチャの共有状態クラス
+ */
+template <class R>
+class CFutureStateT : public CFutureState
+{
+public:
+	CFutureStateT() : m_bool_value(false) {};
+
+	virtual ~CFutureStateT()
+	{
+		if (m_bool_value) {
+			value().~R();
+		}
+	};
+
+	/// @brief 結果を格納して完了させる。（既に完了していた場合は偽）
+	template <class V>
+	bool setValue(V&& v)
+	{
+		if (!begin()) {
+			return(false);
+		}
+		new (m_buf) R(std::forward<V>(v));
+		m_bool_value = true;
+		finishOK();
+		return(true);
+	};
+
+	/// @brief 結果を返す。（正常に完了した場合のみ）
+	R& value() { return(*reinterpret_cast<R*>(m_buf)); };
+
+private:
+	alignas(R) unsigned char	m_buf[sizeof(R)];	///< 結果の格納領域
+	bool						m_bool_value;		///< 結果を格納済み
+};
+
+/// @brief 結果なしのフューチャの共有状態クラス
+template <>
+class CFutureStateT<void> : public CFutureState
+{
+public:
+	/// @brief 完了させる。（既に完了していた場合は偽）
+	bool setValue() { return(completeOK()); };
+};
+
+/**
+ * @class CFuture CThreadBase.h
+ * @brief フューチャクラス
+ * 
+ * 要求元が結果を受け取るためのハンドルです。コピーできます。<BR>
+ * CThreadBase::callTask()、callMsg()が返します。
+ * 
+ */
+template <class R>
+class CFuture
+{
+public:
+	CFuture() : m_p_state(NULL) {};
+	explicit CFuture(CFutureStateT<R> *p_state) : m_p_state(p_state) { if (m_p_state) m_p_state->addRef(); };
+	CFuture(const CFuture& x) : m_p_state(x.m_p_state) { if (m_p_state) m_p_state->addRef(); };
+	CFuture& operator=(const CFuture& x)
 	{
+		if (x.m_p_state) x.m_p_state->addRef();
+		if (m_p_state) m_p_state->release();
+		m_p_state = x.m_p_state;
+		return(*this);
 	};
+	~CFuture() { if (m_p_state) m_p_state->release(); };
+
+	/// @brief 要求に対応しているか否か
+	bool valid() const { return(m_p_state != NULL); };
+
+	/// @brief 完了したか否か
+	bool ready() const { return(m_p_state && (m_p_state->status() != CFutureState::STS_PENDING)); };
+
+	/// @brief 状態（CFutureState::status()参照）
+	int  status() const { return(m_p_state ? m_p_state->status() : CFutureState::STS_PENDING); };
 
 	/**
-	 * @brief 削除の可否を返す。
-	 * 
-	 * STLのアルゴリズム（remove_if）で使用する。
-	 * 
-	 * @param	x		タイマ制御ブロック
-	 * @retval	0		削除不可
-	 * @retval	0以外	削除可
+	 * @brief 完了を待つ。
+	 *
+	 * 要求先が自スレッドの場合は、デッドロックになるので呼び出さないで下さい。
+	 *
+	 * @param	msec_timeout	待ち時間（ミリ秒単位／負の値は無期限）
+	 * @retval	状態（時間内に完了しなければ ERR_TIMEOUT）
 	 */
-	static bool is_remove(const CTimerCB& x)
+	int  wait(int msec_timeout=(-1)) { return(m_p_state ? m_p_state->wait(msec_timeout) : CFutureState::STS_PENDING); };
+
+	/// @brief 結果を返す。（status()が ERR_OK の場合のみ）
+	typename std::add_lvalue_reference<R>::type get() { return(m_p_state->value()); };
+
+private:
+	CFutureStateT<R>*	m_p_state;
+};
+
+/// @brief 結果なしのフューチャクラス
+template <>
+inline void CFuture<void>::get() {}
+
+/**
+ * @class CPromise CThreadBase.h
+ * @brief プロミスクラス
+ * 
+ * 要求先が結果を返すためのハンドルです。ムーブのみできます。<BR>
+ * set()せずに破棄された場合は ERR_TERMINATE で完了させます。
+ * （要求先が終了してメッセージが削除された場合等）
+ * 
+ */
+template <class R>
+class CPromise
+{
+public:
+	CPromise() : m_p_state(NULL) {};
+	explicit CPromise(CFutureStateT<R> *p_state) : m_p_state(p_state) { if (m_p_state) m_p_state->addRef(); };
+	CPromise(CPromise&& x) : m_p_state(x.m_p_state) { x.m_p_state = NULL; };
+	CPromise& operator=(CPromise&& x)
 	{
-		return(x.m_remove);
-	}
+		if (this != &x) {
+			reset();
+			m_p_state = x.m_p_state;
+			x.m_p_state = NULL;
+		}
+		return(*this);
+	};
+	~CPromise() { reset(); };
 
-	/**
-	 * @brief 時刻の比較をする。
-	 * 
-	 * @param	x		比較対象のタイマ制御ブロック
-	 * @retval	0		比較対象と等しいか大きい
-	 * @retval	0以外	比較対象より小さい
-	 */
-	bool operator<(const CTimerCB& x) const
+	/// @brief 結果を返して完了させる。（既に完了していた場合は偽）
+	template <class... V>
+	bool set(V&&... v) { return(m_p_state && m_p_state->setValue(std::forward<V>(v)...)); };
+
+	/// @brief 結果なしで完了させる。（CThreadBase のエラーコードで異常を返す）
+	bool setStatus(int sts) { return(m_p_state && m_p_state->complete(sts)); };
+
+private:
+	CPromise(const CPromise&);
+	CPromise& operator=(const CPromise&);
+
+	void reset()
 	{
-		return(m_target_time < x.m_target_time);
-	}
+		if (m_p_state) {
+			m_p_state->abandon();
+			m_p_state->release();
+			m_p_state = NULL;
+		}
+	};
+
+	CFutureStateT<R>*	m_p_state;
 };
 
 /**
- * @class CTimerCBList CThreadBase.h
- * @brief タイマ制御ブロックリストクラス
+ * @class CCallMsg CThreadBase.h
+ * @brief 要求メッセージベースクラス
  * 
- * タイマ制御ブロックをタイムアウト順に繋げて管理する。
+ * CThreadBase::callMsg()で送信する要求メッセージは、このクラスから派生させます。
+ * 要求先は reply()で結果を返します。
+ * 
+ * 	class CQueryMsg : public CThreadMsgT<CQueryMsg, CCallMsg<int> > { ... };
+ * 	int CMyThread::onQueryMsg(CQueryMsg *p_msg) { p_msg->reply(42); return(ERR_OK); }
  * 
  */
-class CTimerCBList
+template <class R>
+class CCallMsg : public CThreadMsg
 {
 public:
-	/// @brief コンストラクタ
-	CTimerCBList();
+	/// @brief 結果を返す。（既に完了していた場合は偽）
+	template <class... V>
+	bool reply(V&&... v) { return(m_promise.set(std::forward<V>(v)...)); };
 
-	/// @brief デストラクタ
-	virtual ~CTimerCBList();
+	/// @brief 異常を返す。（CThreadBase のエラーコード）
+	bool replyStatus(int sts) { return(m_promise.setStatus(sts)); };
+
+	/// @brief プロミス（CThreadBase::callMsg()が設定する）
+	CPromise<R>	m_promise;
+};
+
+/// @brief 関数オブジェクトの返り値の型
+template <class F>
+struct CTaskResult
+{
+	typedef decltype(std::declval<typename std::decay<F>::type&>()()) type;
+};
+
+/// @brief callTask()で要求先が実行する関数オブジェクト
+template <class F, class R>
+struct CCallTask
+{
+	F			m_func;
+	CPromise<R>	m_promise;
+	void operator()() { m_promise.set(m_func()); }
+};
+
+template <class F>
+struct CCallTask<F, void>
+{
+	F				m_func;
+	CPromise<void>	m_promise;
+	void operator()() { m_func(); m_promise.set(); }
+};
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// スレッド配置クラス
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @class CThreadPlacement CThreadBase.h
+ * @brief スレッド配置クラス
+ * 
+ * スレッドを動かす CPU、NUMA ノード、スケジューリングポリシーと優先度、
+ * スタックサイズ、スレッド名をまとめて指定します。<BR>
+ * CThreadBase::setPlacement()で設定すると、start()で適用します。
+ * 設定しなかった項目は変更しません。（pthread_create のデフォルト）<BR>
+ * CPU、NUMA ノード、スレッド名は Linux のみです。
+ * 
+ * 	CThreadPlacement placement;<BR>
+ * 	placement.addCPU(2);<BR>
+ * 	placement.setSchedule(SCHED_FIFO, 10);<BR>
+ * 	placement.setName("log");<BR>
+ * 	log_thread.setPlacement(placement);<BR>
+ * 
+ */
+class CThreadPlacement
+{
+public:
+	/// @brief 固定値
+	enum {
+		NODE_ANY		= (-1),		///< ノードを指定しない
+		POLICY_INHERIT	= (-1),		///< スケジューリングポリシーを指定しない
+		MAX_NAME		= 15		///< スレッド名の最大長（バイト）
+	};
+
+	/// @brief コンストラクタ（何も指定しない）
+	CThreadPlacement();
 
 	/**
-	 * @brief タイマ制御ブロックを作り、タイムアウト順にリストに登録する。
+	 * @brief 動かす CPU を追加する。
 	 * 
-	 * @param	msec_elapsed_time	タイムアウトまでの経過時間（ミリ秒単位）
-	 * @param	timer_id			タイマID
-	 * @param	msec_period			周期（周期起動で使用／ミリ秒単位）
+	 * 追加した CPU のどれかで動きます。
+	 * 
+	 * @param	cpu		CPU 番号
 	 * @retval	0		正常
 	 * @retval	0以外	異常
 	 */
-	int  set(int msec_elapsed_time, int timer_id=0, int msec_period=0);
+	int  addCPU(int cpu);
 
 	/**
-	 * @brief タイマ制御ブロックを、タイムアウト順にリストに登録する。
+	 * @brief 動かす NUMA ノードを指定する。
 	 * 
-	 * @param	rTimerCB	タイマ制御ブロック
+	 * ノードの全ての CPU を追加します。
+	 * bool_node_pool が真の場合は、スレッドが解放したメッセージの領域を
+	 * ノード毎の置き場に返し、同じノードのスレッドで再利用します。
+	 * （CThreadMsgPool::setNode()参照）
+	 * 
+	 * @param	node			ノード番号
+	 * @param	bool_node_pool	ノード毎のメッセージプールを使う
+	 * @retval	0		正常
+	 * @retval	0以外	異常（ノードがない）
+	 */
+	int  setNode(int node, bool bool_node_pool=false);
+
+	/**
+	 * @brief スケジューリングポリシーと優先度を指定する。
+	 * 
+	 * SCHED_FIFO、SCHED_RR は権限が必要です。（なければ start()が異常になります）
+	 * 
+	 * @param	policy		ポリシー（SCHED_OTHER、SCHED_FIFO、SCHED_RR 等）
+	 * @param	priority	優先度（ポリシーの範囲内）
 	 * @retval	0		正常
 	 * @retval	0以外	異常
 	 */
-	int  set(CTimerCB &rTimerCB);
+	int  setSchedule(int policy, int priority=0);
 
 	/**
-	 * @brief リストからタイマ制御ブロックを削除する。
+	 * @brief スタックサイズを指定する。
 	 * 
-	 * @param	timer_id	削除するタイマID。-1であれば全て削除する。
+	 * @param	stack_size	スタックサイズ（バイト／PTHREAD_STACK_MIN 以上）
 	 * @retval	0		正常
 	 * @retval	0以外	異常
 	 */
-	int  cancel(int timer_id=0);	// timer_id が (-1)であれば全キャンセル
+	int  setStackSize(size_t stack_size);
 
 	/**
-	 * @brief リスト先頭のタイマ制御ブロックがタイムアウトしているか否かを返す。
+	 * @brief スレッド名を指定する。（ps、top、gdb 等で表示される）
 	 * 
-	 * @param	p_timer_id	タイムアウトしたタイマIDを返す。
-	 * @retval	0		タイムアウトしていない
-	 * @retval	0以外	タイムアウト
+	 * @param	name	スレッド名（MAX_NAME バイト以下）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setName(const string& name);
+
+	/// @brief 何も指定していないか否か
+	bool empty() const;
+
+	/// @brief NUMA ノード（指定していなければ NODE_ANY）
+	int  getNode() const { return(m_node); }
+
+	/// @brief ノード毎のメッセージプールを使うか否か
+	bool isNodePool() const { return(m_bool_node_pool); }
+
+	/// @brief スレッド名
+	const string& getName() const { return(m_name); }
+
+	/**
+	 * @brief スレッド属性に適用する。（スタックサイズ、スケジューリング）
+	 * 
+	 * @param	p_pthread_attr	スレッド属性（初期化済み）
+	 * @retval	0		正常
+	 * @retval	0以外	異常（pthread 関数のエラー番号）
 	 */
-	bool timeout(int *p_timer_id=NULL);
+	int  applyAttr(pthread_attr_t *p_pthread_attr) const;
 
 	/**
-	 * @brief 次にタイムアウトする目標時刻を返す。
+	 * @brief 起動したスレッドに適用する。（CPU、スレッド名）
 	 * 
-	 * @param	なし
-	 * @retval	0		タイマ登録がない
-	 * @retval	0以外	次にタイムアウトする目標時刻
+	 * @param	pthread		スレッド識別子
+	 * @retval	0		正常
+	 * @retval	0以外	異常（pthread 関数のエラー番号）
 	 */
-	CTimeVal next_time();
+	int  applyThread(pthread_t pthread) const;
 
 private:
-	/// @brief タイマ制御ブロックのリスト
-	list<CTimerCB>	m_list_TCB;
-
-	/// @brief ミューテック
-	pthread_mutex_t	m_mutex;
+#if defined(__linux__)
+	cpu_set_t	m_cpuset;			///< 動かす CPU
+#endif
+	int			m_cpus;				///< 動かす CPU の数（０は指定なし）
+	int			m_node;				///< NUMA ノード
+	bool		m_bool_node_pool;	///< ノード毎のメッセージプールを使う
+	int			m_policy;			///< スケジューリングポリシー
+	int			m_priority;			///< 優先度
+	size_t		m_stack_size;		///< スタックサイズ（０は指定なし）
+	string		m_name;				///< スレッド名
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -307,7 +2163,13 @@ private:
  * スレッドベースクラスのリターンコードは原則的に０が正常です。
  * （POSIX pthread 関数にあわせています。）
  * 
+ * setScheduler()でアクタスケジューラを設定すると、専用のスレッドを作らず、
+ * スケジューラのワーカスレッドで動くアクタになります。（派生クラスの変更は不要）
+ * 
  */
+class CActorScheduler;
+class CTaskPool;
+
 class CThreadBase
 {
 public:
@@ -319,7 +2181,8 @@ public:
 		ERR_BUSY		= -3,	///< ビジー状態
 		ERR_TERMINATE	= -4,	///< 終了状態
 		ERR_RESOURCE	= -5,	///< リソース不足
-		ERR_SYSTEM		= -6	///< システムコールで異常
+		ERR_SYSTEM		= -6,	///< システムコールで異常
+		ERR_TIMEOUT		= -7	///< タイムアウト
 	};
 
 	/// @brief コンストラクタ
@@ -329,18 +2192,271 @@ public:
 	virtual ~CThreadBase();
 
 	/**
-	 * @brief スレッド属性を設定する。
+	 * @brief スレッド属性を設定する。
+	 * 
+	 * start()実行前に呼び出して下さい。
+	 * スレッド番号はプロセス内で重複なく指定してください。
+	 * 
+	 * @param	thread_no		スレッド番号（インスタンス管理で使用）
+	 * @param	parent			親スレッドのポインタ（親スレッドへの通知で使用）
+	 * @param	p_pthread_attr	スレッド属性（pthread_createのパラメータ）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setAttribute(const int thread_no=(-1), CThreadBase* parent=NULL, pthread_attr_t* p_pthread_attr=NULL);
+
+	/**
+	 * @brief スレッド属性を設定する。（配置指定）
+	 * 
+	 * setAttribute(thread_no, parent)と setPlacement(placement)を呼び出します。
+	 * 
+	 * @param	thread_no		スレッド番号（インスタンス管理で使用）
+	 * @param	parent			親スレッドのポインタ（親スレッドへの通知で使用）
+	 * @param	placement		配置（CPU、NUMA ノード、スケジューリング、スタック、スレッド名）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setAttribute(const int thread_no, CThreadBase* parent, const CThreadPlacement& placement);
+
+	/**
+	 * @brief スレッドの配置を設定する。
+	 * 
+	 * start()実行前に呼び出して下さい。start()で適用し、適用できなければ
+	 * start()が異常（pthread 関数のエラー番号）で復帰します。
+	 * setAttribute()のスレッド属性と併用した場合は、こちらで指定した項目が優先します。
+	 * アクタ（setScheduler()）には使用できません。
+	 * 
+	 * @param	placement		配置
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setPlacement(const CThreadPlacement& placement);
+
+	/**
+	 * @brief スレッドの配置を返す。
+	 * 
+	 * @param	なし
+	 * @retval	配置
+	 */
+	const CThreadPlacement& getPlacement() const
+	{
+		return(m_placement);
+	}
+
+	/**
+	 * @brief ファイルディスクリプタの監視方式を設定する。
+	 * 
+	 * start()実行前に呼び出して下さい。
+	 * Linuxではエポール（CFileDescriptor::MODE_EPOLL）がデフォルトです。
+	 * エポールが使用できない環境では、select()で動作します。
+	 * 
+	 * @param	mode	監視方式
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setReactorMode(CFileDescriptor::MODE mode);
+
+	/**
+	 * @brief スレッドキューの方式を設定する。
+	 * 
+	 * start()実行前に呼び出して下さい。
+	 * ロックフリー方式（CThreadQueue::MODE_LOCKFREE）がデフォルトです。
+	 * 
+	 * @param	mode	キューの方式
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setQueueMode(CThreadQueue::MODE mode);
+
+	/**
+	 * @brief スレッドキューのレーン（優先度）を設定する。
+	 * 
+	 * start()実行前に呼び出して下さい。
+	 * デフォルトは２レーン（LANE_HIGH、LANE_NORMAL）の DRAIN_STRICT です。
+	 * レーン２以降は、postMsgToLane()で指定します。
+	 * 
+	 * @param	lanes		レーン数（２〜CThreadQueue::MAX_LANES）
+	 * @param	drain		取り出し方
+	 * @param	p_weights	レーン毎の重み（DRAIN_WEIGHTED）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setQueueLanes(int lanes, CThreadQueue::DRAIN drain=CThreadQueue::DRAIN_STRICT, const int *p_weights=NULL);
+
+	/**
+	 * @brief スレッドキューのレーンに溜まっているメッセージ数を返す。
+	 * 
+	 * @param	lane	レーン
+	 * @retval	メッセージ数（ロックフリー方式では概数）
+	 */
+	unsigned long getQueueDepth(int lane)
+	{
+		return(m_queue.getDepth(lane));
+	}
+
+	/**
+	 * @brief スレッドキューの容量を設定する。
+	 *
+	 * start()実行前に呼び出して下さい。デフォルトは無制限です。
+	 * 容量を超えた時の postMsg()等の動作は full で選びます。
+	 * ・FULL_BLOCK：空きができるまで送信元を待たせる。
+	 * ・FULL_FAIL：キューイングせず ERR_BUSY を返す。（postMsg()はメッセージを解放）
+	 * ・FULL_DROP_OLDEST：最も低いレーンの最も古いメッセージを捨てる。（ミューテック方式になる）
+	 * ・FULL_DROP_NEWEST：送ったメッセージを捨てて ERR_OK を返す。
+	 * 自スレッドからのキューイングと、終了メッセージ、水位通知メッセージは
+	 * 容量に関わらずキューイングします。（待たない、捨てない）
+	 *
+	 * @param	capacity	容量（全レーンの合計／０は無制限）
+	 * @param	full		容量を超えた時の動作
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setQueueCapacity(unsigned long capacity, CThreadQueue::FULL full=CThreadQueue::FULL_BLOCK);
+
+	/**
+	 * @brief スレッドキューの水位を設定する。
+	 *
+	 * start()実行前に呼び出して下さい。
+	 * 滞留数が高水位以上になった時と、低水位以下に戻った時に、
+	 * addQueueListener()で登録したスレッドに CQueueWatermarkMsg を送ります。
+	 *
+	 * @param	high	高水位（０は通知しない）
+	 * @param	low		低水位（高水位未満）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setQueueWatermark(unsigned long high, unsigned long low);
+
+	/**
+	 * @brief スレッドキューの水位の変化を通知するスレッドを登録する。
+	 *
+	 * どのスレッドからも呼び出せます。通知は p_listener の onQueueWatermark()で受け取ります。
+	 * 登録した時に既に高水位以上であれば、すぐに通知します。
+	 * p_listener を削除する前に removeQueueListener()で登録を外して下さい。
+	 * （removeQueueListener()は、送っている途中の通知が終わるまで待ちます）
+	 *
+	 * @param	p_listener	通知先スレッド
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  addQueueListener(CThreadBase *p_listener);
+
+	/**
+	 * @brief addQueueListener()の登録を外す。
+	 *
+	 * 他のスレッドが p_listener に通知を送っている途中であれば、終わるまで待ちます。
+	 * 戻った後は p_listener に通知を送らないので、削除して構いません。
+	 *
+	 * @param	p_listener	通知先スレッド
+	 * @retval	0		正常
+	 * @retval	0以外	異常（登録されていない）
+	 */
+	int  removeQueueListener(CThreadBase *p_listener);
+
+	/**
+	 * @brief スレッドキューが高水位以上か否かを返す。（低水位以下に戻るまで真）
+	 *
+	 * @param	なし
+	 * @retval	真		高水位以上
+	 * @retval	偽		それ以外
+	 */
+	bool isQueueHigh() const
+	{
+		return(m_queue.isHigh());
+	}
+
+	/**
+	 * @brief スレッドキューに溜まっているメッセージ数（全レーンの合計）を返す。
+	 *
+	 * @param	なし
+	 * @retval	メッセージ数（ロックフリー方式では概数）
+	 */
+	unsigned long getQueueSize()
+	{
+		return(m_queue.size());
+	}
+
+	/**
+	 * @brief 容量を超えて捨てた（又はキューイングしなかった）メッセージ数を返す。
+	 *
+	 * @param	なし
+	 * @retval	メッセージ数
+	 */
+	unsigned long long getQueueDropped() const
+	{
+		return(m_queue.getDropped());
+	}
+
+	/// @brief 一度に処理するメッセージ数のデフォルト
+	enum { DEFAULT_BATCH_SIZE = 32 };
+
+	/**
+	 * @brief 一度に処理するメッセージ数を設定する。
+	 * 
+	 * start()実行前に呼び出して下さい。
+	 * run()はスレッドキューから最大この数だけまとめて取り出し、続けて処理します。
+	 * タイマのタイムアウト確認は、まとめて処理する間には行いません。
+	 * １を指定すると、１メッセージ毎にタイマを確認します。
+	 * 
+	 * @param	batch_size	一度に処理するメッセージ数（１以上）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setBatchSize(int batch_size);
+
+	/**
+	 * @brief タイマが使う時計を設定する。
+	 * 
+	 * start()実行前に呼び出して下さい。
+	 * CVirtualClock を設定すると、タイマ（setTimer()、postMsgAfter()、
+	 * 要求のタイムアウト）は仮想時計の時刻で動きます。
+	 * 
+	 * @param	p_clock		時計（NULL は標準の時計）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setClock(CClock *p_clock);
+
+	/**
+	 * @brief アクタとして動かすスケジューラを設定する。
 	 * 
 	 * start()実行前に呼び出して下さい。
-	 * スレッド番号はプロセス内で重複なく指定してください。
+	 * 設定すると start()はスレッドを作らず、スケジューラのワーカスレッドが
+	 * メッセージ、タイマ、ファイルディスクリプタのイベントを処理します。
+	 * １つのアクタを同時に複数のワーカが処理することはなく、
+	 * メッセージの順序もスレッドと同じです。
+	 * エポールモードと timerfd が必要です。（Linuxのみ）
+	 * stop()、join()で終了を待つ場合は、そのスケジューラのワーカ以外から呼び出して下さい。
 	 * 
-	 * @param	thread_no		スレッド番号（インスタンス管理で使用）
-	 * @param	parent			親スレッドのポインタ（親スレッドへの通知で使用）
-	 * @param	p_pthread_attr	スレッド属性（pthread_createのパラメータ）
+	 * @param	p_scheduler		スケジューラ（NULL はスレッドで動かす）
 	 * @retval	0		正常
 	 * @retval	0以外	異常
 	 */
-	int  setAttribute(const int thread_no=(-1), CThreadBase* parent=NULL, pthread_attr_t* p_pthread_attr=NULL);
+	int  setScheduler(CActorScheduler *p_scheduler);
+
+	/**
+	 * @brief アクタとして動かすスケジューラを返す。
+	 * 
+	 * @param	なし
+	 * @retval	スケジューラ（スレッドで動かす場合は NULL）
+	 */
+	CActorScheduler* getScheduler() const
+	{
+		return(m_p_scheduler);
+	}
+
+	/**
+	 * @brief タイマが使う時計の現在時刻を返す。
+	 * 
+	 * postMsgAt()の時刻はこの時刻で指定します。
+	 * 
+	 * @param	なし
+	 * @retval	現在時刻（ナノ秒）
+	 */
+	long long now() const
+	{
+		return(m_TimerCBList.now());
+	}
 
 	/**
 	 * @brief スレッドを起動する。
@@ -385,6 +2501,7 @@ public:
 	 * これは使用者の負荷を低減しメモリリークを防ぐための仕様です。
 	 * 
 	 * キューイングされたメッセージは、 onMsg()関数で順番に通知されます。
+	 * setQueueCapacity()で容量を設定した場合は、空きを待つか ERR_BUSY になることがあります。
 	 * 
 	 * @param	pp_msg			スレッドメッセージのポインタ
 	 * @param	bool_high_prior	高優先（先頭にキューイング）
@@ -393,9 +2510,305 @@ public:
 	 */
 	virtual int  postMsg(CThreadMsg *p_msg, bool bool_high_prior=false);
 
+	/**
+	 * @brief 指定時間後に、スレッドにメッセージをキューイングする。
+	 * 
+	 * メッセージはスレッドのタイマに預け、時間が来たらスレッド自身がキューイングします。
+	 * （待つためのスレッドやポーリングは使いません）
+	 * どのスレッドからも呼び出せます。メッセージの解放は postMsg()と同じで、
+	 * 異常で復帰した場合も本関数内で解放します。
+	 * キューイング前にスレッドが終了した場合は、キューイングせずに解放します。
+	 * 
+	 * @param	p_msg			スレッドメッセージのポインタ
+	 * @param	msec_delay		キューイングするまでの時間（ミリ秒単位）
+	 * @param	p_handle		タイマハンドルを返す。（不要なら NULL）
+	 * 							cancelPostedMsg(handle)で取り消すと、メッセージは解放されます。
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  postMsgAfter(CThreadMsg *p_msg, int msec_delay, CTimerHandle *p_handle=NULL);
+
+	/**
+	 * @brief スレッドキューのレーンを指定して、メッセージをキューイングする。
+	 * 
+	 * メッセージの解放は postMsg()と同じです。
+	 * postMsg()の高優先はレーン０（CThreadQueue::LANE_HIGH）、
+	 * 通常はレーン１（CThreadQueue::LANE_NORMAL）と同じです。
+	 * 
+	 * @param	p_msg			スレッドメッセージのポインタ
+	 * @param	lane			レーン（レーン数以上は最も低いレーン）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  postMsgToLane(CThreadMsg *p_msg, int lane);
+
+	/**
+	 * @brief 指定時刻に、スレッドにメッセージをキューイングする。
+	 * 
+	 * postMsgAfter()の時刻指定版です。
+	 * 
+	 * @param	p_msg			スレッドメッセージのポインタ
+	 * @param	nsec_deadline	キューイングする時刻（now()と同じナノ秒）
+	 * @param	p_handle		タイマハンドルを返す。（不要なら NULL）
+	 * 							cancelPostedMsg(handle)で取り消すと、メッセージは解放されます。
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  postMsgAt(CThreadMsg *p_msg, long long nsec_deadline, CTimerHandle *p_handle=NULL);
+
+	/**
+	 * @brief postMsgAfter()、postMsgAt()で預けたメッセージを取り消す。
+	 * 
+	 * どのスレッドからも呼び出せます。取り消したメッセージは解放します。
+	 * 他のスレッドが発行したハンドルや、setTimer()のハンドルは取り消しません。
+	 * 
+	 * @param	handle		postMsgAfter()、postMsgAt()で受け取ったタイマハンドル
+	 * @retval	0			正常
+	 * @retval	ERR_PARAM	キューイング又は取り消し済み、本スレッドのハンドルでない
+	 */
+	int  cancelPostedMsg(const CTimerHandle& handle)
+	{
+		return(m_TimerCBList.cancelMsg(handle));
+	}
+
+#if __cplusplus >= 201103L
+	/**
+	 * @brief スレッドにメッセージをキューイングする。（所有権を渡す）
+	 * 
+	 * キューイングできた場合は p_msg は空になり、本クラスが解放します。
+	 * キューイングできなかった場合（ERR_CONTEXT、ERR_TERMINATE 等）は、
+	 * 解放せずに p_msg に残すので、呼び出し側で再送や破棄を判断できます。
+	 * 
+	 * 	postMsg(std::unique_ptr<CMyMsg>(new CMyMsg(...)));
+	 * 
+	 * @param	p_msg			スレッドメッセージ
+	 * @param	bool_high_prior	高優先（先頭にキューイング）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	template <class T>
+	int  postMsg(std::unique_ptr<T>&& p_msg, bool bool_high_prior=false)
+	{
+		int ret = putMsg(p_msg.get(), bool_high_prior);
+		if ((ret == ERR_OK) || (ret == ERR_SYSTEM)) {
+			p_msg.release();
+		}
+		return(ret);
+	}
+
+	/**
+	 * @brief メッセージを生成して、スレッドにキューイングする。
+	 * 
+	 * 引数をそのまま T のコンストラクタに渡して生成します。
+	 * （領域はメッセージプールから確保します。）
+	 * スレッドが活動状態でない場合は、生成せずに異常で復帰します。
+	 * 
+	 * 	emplaceMsg<CTcpSocketSendMsg>(std::move(vec_data));
+	 * 
+	 * @param	args	T のコンストラクタの引数
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	template <class T, class... ARGS>
+	int  emplaceMsg(ARGS&&... args)
+	{
+		if (active() == false) {
+			return((m_pthread == 0) ? ERR_CONTEXT : ERR_TERMINATE);
+		}
+		return(postMsg(new T(std::forward<ARGS>(args)...)));
+	}
+
+	/**
+	 * @brief 関数オブジェクトをスレッドで実行する。
+	 * 
+	 * 引数なしで呼び出せる関数オブジェクト（ラムダ式等）を CTaskMsg に格納して
+	 * キューイングし、スレッド内で呼び出します。（返り値は捨てます）
+	 * 通常のメッセージと同じキューを通るので、順序、優先、まとめて取り出す処理も
+	 * 同じです。キャプチャが CTaskMsg::INLINE_SIZE バイト以下であれば、
+	 * メッセージ以外の領域は確保しません。
+	 * スレッドが活動状態でない場合は、生成せずに異常で復帰します。
+	 * 
+	 * 	postTask([this, n]() { m_count += n; });
+	 * 
+	 * @param	f				関数オブジェクト
+	 * @param	bool_high_prior	高優先（先頭にキューイング）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	template <class F>
+	int  postTask(F&& f, bool bool_high_prior=false)
+	{
+		if (active() == false) {
+			return((m_pthread == 0) ? ERR_CONTEXT : ERR_TERMINATE);
+		}
+		return(postMsg(new CTaskMsg(std::forward<F>(f)), bool_high_prior));
+	}
+
+	/**
+	 * @brief 関数オブジェクトをスレッドで実行し、返り値をフューチャで受け取る。
+	 * 
+	 * postTask()と同様に実行し、返り値で完了させます。
+	 * 要求元はどのスレッドでも構いません。CFuture::wait()で完了を待てます。
+	 * キューイングできなかった場合は、その異常で完了したフューチャを返します。
+	 * 
+	 * 	CFuture<int> f = target.callTask([]() { return(42); });
+	 * 	if (f.wait(1000) == CThreadBase::ERR_OK) { int n = f.get(); }
+	 * 
+	 * @param	func			関数オブジェクト
+	 * @param	bool_high_prior	高優先（先頭にキューイング）
+	 * @retval	フューチャ
+	 */
+	template <class F>
+	CFuture<typename CTaskResult<F>::type> callTask(F&& func, bool bool_high_prior=false)
+	{
+		typedef typename CTaskResult<F>::type R;
+		CFutureStateT<R> *p_state = new CFutureStateT<R>;
+		CFuture<R> future(p_state);
+		CCallTask<typename std::decay<F>::type, R> task = { std::forward<F>(func), CPromise<R>(p_state) };
+		postCall(p_state, new CTaskMsg(std::move(task)), bool_high_prior);
+		return(future);
+	}
+
+	/**
+	 * @brief 要求メッセージをキューイングし、応答をフューチャで受け取る。
+	 * 
+	 * 要求先は CCallMsg::reply()で応答します。
+	 * 応答せずにメッセージを破棄すると ERR_TERMINATE で完了します。
+	 * 
+	 * @param	p_msg			要求メッセージのポインタ（本クラスが解放します）
+	 * @param	bool_high_prior	高優先（先頭にキューイング）
+	 * @retval	フューチャ
+	 */
+	template <class R>
+	CFuture<R> callMsg(CCallMsg<R> *p_msg, bool bool_high_prior=false)
+	{
+		CFutureStateT<R> *p_state = new CFutureStateT<R>;
+		CFuture<R> future(p_state);
+		if (p_msg == NULL) {
+			p_state->complete(ERR_PARAM);
+			return(future);
+		}
+		p_msg->m_promise = CPromise<R>(p_state);
+		postCall(p_state, p_msg, bool_high_prior);
+		return(future);
+	}
+
+	/**
+	 * @brief 他のスレッドで関数オブジェクトを実行し、完了を自スレッドで受け取る。
+	 * 
+	 * 自スレッド内から呼び出して下さい。完了（正常、異常、タイムアウト）すると、
+	 * 自スレッドで on_reply(CFuture<R>&) を一度だけ呼び出します。
+	 * 完了を待たずに戻るので、複数の要求を並行して出せます。
+	 * msec_timeout が 0 より大きい場合は、自スレッドのタイマでタイムアウトを監視し、
+	 * 時間内に完了しなければ ERR_TIMEOUT で完了させます。（後から来た応答は捨てます）
+	 * 要求元スレッドは、全ての完了を受け取るまで破棄しないで下さい。
+	 * 
+	 * 	callTask(&target, [](){ return(42); },
+	 * 		[this](CFuture<int>& f) { if (f.status() == ERR_OK) m_sum += f.get(); }, 1000);
+	 * 
+	 * @param	p_target		要求先スレッド
+	 * @param	func			関数オブジェクト
+	 * @param	on_reply		完了時に呼び出す関数オブジェクト
+	 * @param	msec_timeout	タイムアウト（ミリ秒単位／0 は監視しない）
+	 * @retval	フューチャ
+	 */
+	template <class F, class CB>
+	CFuture<typename CTaskResult<F>::type> callTask(CThreadBase *p_target, F&& func, CB&& on_reply, int msec_timeout=0)
+	{
+		typedef typename CTaskResult<F>::type R;
+		CFutureStateT<R> *p_state = new CFutureStateT<R>;
+		CFuture<R> future(p_state);
+		setCallReply(p_state, future, std::forward<CB>(on_reply), msec_timeout);
+		CCallTask<typename std::decay<F>::type, R> task = { std::forward<F>(func), CPromise<R>(p_state) };
+		if (p_target == NULL) {
+			p_state->complete(ERR_PARAM);
+			return(future);
+		}
+		p_target->postCall(p_state, new CTaskMsg(std::move(task)), false);
+		return(future);
+	}
+
+	/**
+	 * @brief 他のスレッドに要求メッセージを送り、応答を自スレッドで受け取る。
+	 * 
+	 * callTask(p_target, func, on_reply, msec_timeout)の要求メッセージ版です。
+	 * 
+	 * @param	p_target		要求先スレッド
+	 * @param	p_msg			要求メッセージのポインタ（本クラスが解放します）
+	 * @param	on_reply		完了時に呼び出す関数オブジェクト
+	 * @param	msec_timeout	タイムアウト（ミリ秒単位／0 は監視しない）
+	 * @retval	フューチャ
+	 */
+	template <class R, class CB>
+	CFuture<R> callMsg(CThreadBase *p_target, CCallMsg<R> *p_msg, CB&& on_reply, int msec_timeout=0)
+	{
+		CFutureStateT<R> *p_state = new CFutureStateT<R>;
+		CFuture<R> future(p_state);
+		setCallReply(p_state, future, std::forward<CB>(on_reply), msec_timeout);
+		if ((p_target == NULL) || (p_msg == NULL)) {
+			delete p_msg;
+			p_state->complete(ERR_PARAM);
+			return(future);
+		}
+		p_msg->m_promise = CPromise<R>(p_state);
+		p_target->postCall(p_state, p_msg, false);
+		return(future);
+	}
+
+	/**
+	 * @brief タスクプールで関数オブジェクトを実行し、完了を自スレッドで受け取る。
+	 * 
+	 * callTask(p_target, func, on_reply, msec_timeout)の要求先がタスクプールの版です。
+	 * func はプールのワーカスレッドで（他のタスクと並行して）実行されるので、
+	 * スレッドの状態には触らず、結果は返り値で返して下さい。
+	 * on_reply は自スレッドで呼び出します。
+	 * 
+	 * 	submitTask(&pool, [data]() { return(parse(data)); },
+	 * 		[this](CFuture<CResult>& f) { if (f.status() == ERR_OK) apply(f.get()); });
+	 * 
+	 * @param	p_pool			タスクプール
+	 * @param	func			関数オブジェクト
+	 * @param	on_reply		完了時に呼び出す関数オブジェクト
+	 * @param	msec_timeout	タイムアウト（ミリ秒単位／0 は監視しない）
+	 * @retval	フューチャ
+	 */
+	template <class F, class CB>
+	CFuture<typename CTaskResult<F>::type> submitTask(CTaskPool *p_pool, F&& func, CB&& on_reply, int msec_timeout=0)
+	{
+		typedef typename CTaskResult<F>::type R;
+		CFutureStateT<R> *p_state = new CFutureStateT<R>;
+		CFuture<R> future(p_state);
+		setCallReply(p_state, future, std::forward<CB>(on_reply), msec_timeout);
+		CCallTask<typename std::decay<F>::type, R> task = { std::forward<F>(func), CPromise<R>(p_state) };
+		if (p_pool == NULL) {
+			p_state->complete(ERR_PARAM);
+			return(future);
+		}
+		postPoolCall(p_pool, p_state, new CTaskMsg(std::move(task)));
+		return(future);
+	}
+#endif
+
+	/**
+	 * @brief タスクプールでタスクを実行し、完了をメッセージで受け取る。
+	 * 
+	 * p_task をプールのワーカスレッドで実行（runTask()）した後、
+	 * 自スレッドにキューイングします。（p_task の型のハンドラで受け取ります）
+	 * 要求元スレッドは、全ての完了を受け取るまで破棄しないで下さい。
+	 * 異常時はタスクを削除します。
+	 * 
+	 * @param	p_pool		タスクプール
+	 * @param	p_task		タスクのポインタ（本クラスが解放します）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  submitTask(CTaskPool *p_pool, CPoolTask *p_task);
+
 	/**
 	 * @brief スレッド識別子を返す。
 	 * 
+	 * アクタの場合は、start()を呼び出したスレッドの識別子です。（起動済みの判定用）
+	 * 
 	 * @param	なし
 	 * @retval	スレッド識別子
 	 */
@@ -446,6 +2859,7 @@ public:
 	 * 
 	 * スレッド番号をキーに、
 	 * スレッド管理テーブルから該当インスタンスのポインタを返す。
+	 * ハッシュ表で引くので、登録数によらず一定時間で、ロックを取りません。
 	 * 
 	 * @param	thread_no		スレッド番号
 	 * @param	p_thread_status	スレッド状態
@@ -457,6 +2871,7 @@ public:
 	 * @brief 登録位置からインスタンスを返す。
 	 * 
 	 * スレッド管理テーブルの登録位置からインスタンスのポインタを返す。
+	 * ロックを取りません。
 	 * 
 	 * @param	index			登録位置
 	 * @param	p_thread_status	スレッド状態
@@ -478,85 +2893,320 @@ protected:
 	 * @retval	0		正常
 	 * @retval	0以外	異常
 	 */
-	virtual int  onPreThreadCreate()	{ return(ERR_OK); }
+	virtual int  onPreThreadCreate()	{ return(ERR_OK); }
+
+	/**
+	 * @brief 自スレッド起動直後に呼び出される。
+	 * 
+	 * 自スレッド起動直後にやるべき処理があれば、本関数をオーバーライドします。
+	 * 本関数が異常で復帰した場合、自スレッドを終了させます。
+	 * 
+	 * @param	なし
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	virtual int  onThreadInitiate()		{ return(ERR_OK); }
+
+	/**
+	 * @brief 自スレッド終了直前に呼び出される。
+	 * 
+	 * 自スレッド終了直前にやるべき処理があれば、本関数をオーバーライドします。
+	 * 
+	 * @param	なし
+	 * @retval	なし
+	 */
+	virtual void onThreadTerminate()	{ return; }
+
+	/**
+	 * @brief スレッド終了後に呼び出される。
+	 * 
+	 * stop()関数又は join()関数内から、pthread_join()実行後に呼び出されます。
+	 * スレッド終了後にやるべき処理があれば、本関数をオーバーライドします。
+	 * stop()関数又は join()関数で「スレッド終了待ち」を行わない場合、
+	 * 本関数は呼び出されません。
+	 * 尚、本関数はスレッド終了後なので、親スレッドの実行権で動作します。
+	 * 
+	 * @param	なし
+	 * @retval	なし
+	 */
+	virtual void onPostThreadJoin()		{ return; }
+
+	/**
+	 * @brief メッセージ受信時に呼び出される。
+	 * 
+	 * メッセージ受信時にやるべき処理があれば、本関数をオーバーライドします。
+	 * スレッドメッセージの解放（delete）はベースクラスで行います。
+	 * 本関数内で解放（delete）しないで下さい。
+	 * 
+	 * 尚、スレッド終了メッセージ（ CStopMsg::）は
+	 * ベースクラスで処理するため、本関数は呼び出されません。
+	 * 
+	 * @param	p_msg	スレッドメッセージのポインタ
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	virtual int onMsg(CThreadMsg *p_msg)	{ return(ERR_OK); }
+
+	/**
+	 * @brief まとめて取り出したメッセージを受信した時に呼び出される。
+	 * 
+	 * run()がスレッドキューからまとめて取り出したメッセージを、一度に通知します。
+	 * 複数のメッセージをまとめて処理したい場合（ログの一括書き込み等）は、
+	 * 本関数をオーバーライドします。
+	 * デフォルトの実装は、メッセージ毎に onMsg()を呼び出します。
+	 * 
+	 * スレッドメッセージの解放（delete）はベースクラスで行います。
+	 * 本関数内で解放（delete）しないで下さい。
+	 * スレッド終了メッセージ（ CStopMsg::）は含まれません。
+	 * 
+	 * @param	pp_msg	スレッドメッセージのポインタの配列（到着順）
+	 * @param	num		メッセージの数（１以上）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	virtual int onMsgBatch(CThreadMsg **pp_msg, int num);
+
+	/**
+	 * @brief メッセージハンドラを登録する。
+	 * 
+	 * 型ID付きメッセージ（CThreadMsgT から派生）MSG を受信すると、
+	 * onMsg()ではなく、登録したメンバ関数が呼び出されます。
+	 * 型IDで表を引くので、dynamic_cast を連ねるより高速です。
+	 * 登録がない型のメッセージは、従来通り onMsg()で通知されます。
+	 * 
+	 * start()実行前（コンストラクタ等）、又は自スレッド内で呼び出して下さい。
+	 * 同じ型に再登録すると、置き換えます。
+	 * 
+	 * 	setMsgHandler(&CMyThread::onMyMsg);	// int CMyThread::onMyMsg(CMyMsg*)
+	 * 
+	 * @param	handler	メンバ関数のポインタ
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	template <class T, class MSG>
+	int  setMsgHandler(int (T::*handler)(MSG*))
+	{
+		if (handler == NULL) {
+			return(ERR_PARAM);
+		}
+		size_t type = MSG::msgType();
+		if (type >= m_vec_p_handler.size()) {
+			m_vec_p_handler.resize(type + 1, NULL);
+		}
+		delete m_vec_p_handler[type];
+		m_vec_p_handler[type] = new CMsgHandlerT<T, MSG>(handler);
+		return(ERR_OK);
+	}
+
+	/**
+	 * @brief メッセージを振り分ける。
+	 * 
+	 * 登録されたメッセージハンドラがあれば呼び出し、なければ onMsg()を呼び出す。
+	 * onMsgBatch()をオーバーライドした場合、個々のメッセージは
+	 * onMsg()ではなく、本関数で処理して下さい。
+	 * 
+	 * @param	p_msg	スレッドメッセージのポインタ
+	 * @retval	ハンドラ又は onMsg()の返り値
+	 */
+	int  dispatchMsg(CThreadMsg *p_msg)
+	{
+		if (m_p_metrics) {
+			return(dispatchMsgMetrics(p_msg));
+		}
+		return(invokeMsg(p_msg));
+	}
+
+	/**
+	 * @brief タイマを設定する。
+	 * 
+	 * @param	msec_elapsed_time	タイムアウトまでの経過時間（ミリ秒単位）
+	 * @param	timer_id			タイマID
+	 * @param	msec_period			周期（周期起動で使用／ミリ秒単位）
+	 * @param	p_handle			タイマハンドルを返す。（不要なら NULL）
+	 * 								cancelTimer(handle)でこのタイマだけをキャンセルできる。
+	 * @param	msec_slack			遅れてよい時間（ミリ秒単位）
+	 * 								指定すると、近い時刻のタイマと同じ起床でまとめて処理する。
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setTimer(int msec_elapsed_time, int timer_id=0, int msec_period=0, CTimerHandle *p_handle=NULL, int msec_slack=0)
+	{
+		return(m_TimerCBList.set(msec_elapsed_time, timer_id, msec_period, p_handle, msec_slack));
+	}
+
+	/**
+	 * @brief タイマを設定する。（マイクロ秒単位）
+	 * 
+	 * 引数は setTimer()と同じで、時間の単位がマイクロ秒です。
+	 * 
+	 * @param	usec_elapsed_time	タイムアウトまでの経過時間（マイクロ秒単位）
+	 * @param	timer_id			タイマID
+	 * @param	usec_period			周期（周期起動で使用／マイクロ秒単位）
+	 * @param	p_handle			タイマハンドルを返す。（不要なら NULL）
+	 * @param	usec_slack			遅れてよい時間（マイクロ秒単位）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setTimerUs(long long usec_elapsed_time, int timer_id=0, long long usec_period=0, CTimerHandle *p_handle=NULL, long long usec_slack=0)
+	{
+		return(m_TimerCBList.setNs(usec_elapsed_time * 1000, timer_id, usec_period * 1000, p_handle, usec_slack * 1000));
+	}
+
+	/**
+	 * @brief タイマを設定する。（ナノ秒単位）
+	 * 
+	 * 引数は setTimer()と同じで、時間の単位がナノ秒です。
+	 * 実際の精度は、ホイールの１ティック（マイクロ秒）とスレッドの起床遅延に依存します。
+	 * 
+	 * @param	nsec_elapsed_time	タイムアウトまでの経過時間（ナノ秒単位）
+	 * @param	timer_id			タイマID
+	 * @param	nsec_period			周期（周期起動で使用／ナノ秒単位）
+	 * @param	p_handle			タイマハンドルを返す。（不要なら NULL）
+	 * @param	nsec_slack			遅れてよい時間（ナノ秒単位）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  setTimerNs(long long nsec_elapsed_time, int timer_id=0, long long nsec_period=0, CTimerHandle *p_handle=NULL, long long nsec_slack=0)
+	{
+		return(m_TimerCBList.setNs(nsec_elapsed_time, timer_id, nsec_period, p_handle, nsec_slack));
+	}
+
+	/**
+	 * @brief タイマをキャンセルする。
+	 * 
+	 * @param	timer_id	キャンセルするタイマID。-1であれば全てキャンセルする。
+	 * @retval	0			正常
+	 * @retval	0以外		異常
+	 */
+	int  cancelTimer(int timer_id=0)	// timer_id が (-1)であれば全キャンセル
+	{
+		if (timer_id < (-1)) {
+			return(ERR_PARAM);	// (-1)未満は内部用
+		}
+		return(m_TimerCBList.cancel(timer_id));
+	}
 
 	/**
-	 * @brief 自スレッド起動直後に呼び出される。
+	 * @brief タイマハンドルが指すタイマだけをキャンセルする。
 	 * 
-	 * 自スレッド起動直後にやるべき処理があれば、本関数をオーバーライドします。
-	 * 本関数が異常で復帰した場合、自スレッドを終了させます。
+	 * 同じタイマIDの他のタイマはキャンセルしません。タイマはハンドルから直接引きますが、
+	 * タイマIDの索引の更新に、使用中のタイマIDの種類数に対して O(log k) かかります。
 	 * 
-	 * @param	なし
-	 * @retval	0		正常
-	 * @retval	0以外	異常
+	 * @param	handle		setTimer()で受け取ったタイマハンドル
+	 * @retval	0			正常
+	 * @retval	ERR_PARAM	タイムアウト又はキャンセル済み、内部用タイマのハンドル
 	 */
-	virtual int  onThreadInitiate()		{ return(ERR_OK); }
+	int  cancelTimer(const CTimerHandle& handle)
+	{
+		return(m_TimerCBList.cancel(handle));
+	}
 
 	/**
-	 * @brief 自スレッド終了直前に呼び出される。
+	 * @brief タイムアウトしたタイマのハンドルを返す。
 	 * 
-	 * 自スレッド終了直前にやるべき処理があれば、本関数をオーバーライドします。
+	 * onTimer()の中で使用し、どのタイマがタイムアウトしたかを判別する。
+	 * 内部用タイマ（postMsgAfter()等）のタイムアウトでは変わりません。
 	 * 
-	 * @param	なし
-	 * @retval	なし
+	 * @retval	タイマハンドル
 	 */
-	virtual void onThreadTerminate()	{ return; }
+	const CTimerHandle& getTimerHandle() const
+	{
+		return(m_timer_handle);
+	}
+
+public:
+	/// @brief タイマの統計情報
+	typedef struct {
+		unsigned long long	fired;		///< タイムアウトしたタイマ数
+		unsigned long long	wakeups;	///< タイムアウトを処理した起床の回数
+		unsigned long long	saved;		///< 節約した起床の回数（他のタイマと同じ起床で処理したタイマ数）
+		unsigned long long	internal;	///< タイムアウトした内部用タイマ数（postMsgAfter()等。上記には含めない）
+	} TIMER_STATS;
 
 	/**
-	 * @brief スレッド終了後に呼び出される。
+	 * @brief タイマの統計情報を取得する。
 	 * 
-	 * stop()関数又は join()関数内から、pthread_join()実行後に呼び出されます。
-	 * スレッド終了後にやるべき処理があれば、本関数をオーバーライドします。
-	 * stop()関数又は join()関数で「スレッド終了待ち」を行わない場合、
-	 * 本関数は呼び出されません。
-	 * 尚、本関数はスレッド終了後なので、親スレッドの実行権で動作します。
+	 * 他のスレッドからも呼び出せます。
+	 * 猶予（slack）を指定したタイマがまとまると、saved が増えます。
+	 * fired、wakeups、saved は setTimer()等で登録したタイマだけを数え、
+	 * postMsgAfter()、postMsgAt()、要求のタイムアウトの内部用タイマは internal に分けます。
 	 * 
-	 * @param	なし
+	 * @param	p_stats	統計情報の格納先
 	 * @retval	なし
 	 */
-	virtual void onPostThreadJoin()		{ return; }
+	void getTimerStats(TIMER_STATS *p_stats) const
+	{
+		if (p_stats == NULL) {
+			return;
+		}
+		p_stats->fired    = __atomic_load_n(&m_timer_fired,   __ATOMIC_RELAXED);
+		p_stats->wakeups  = __atomic_load_n(&m_timer_wakeups, __ATOMIC_RELAXED);
+		p_stats->saved    = p_stats->fired - p_stats->wakeups;
+		p_stats->internal = __atomic_load_n(&m_timer_internal, __ATOMIC_RELAXED);
+	}
+
+	/// @brief 実行統計の分布の区分数
+	enum { NUM_BUCKET = 32 };
+
+	/// @brief 実行統計の分布（ナノ秒）
+	typedef struct {
+		unsigned long long	count;				///< 回数
+		unsigned long long	nsec_total;			///< 合計
+		unsigned long long	nsec_max;			///< 最大
+		unsigned long long	bucket[NUM_BUCKET];	///< 回数の分布（[0]は０、[i]は 2^(i-1)以上 2^i未満、最後はそれ以上全て）
+	} HISTOGRAM;
+
+	/// @brief 実行統計
+	typedef struct {
+		unsigned long		queue_depth;	///< スレッドキューの滞留数
+		unsigned long		queue_peak;		///< スレッドキューの滞留数の最大値
+		unsigned long long	processed;		///< 処理したメッセージ数
+		unsigned long long	wakeups;		///< イベント待ちから起きた回数
+		HISTOGRAM			latency;		///< キューイングしてから取り出すまで
+		HISTOGRAM			msg_time;		///< onMsg()（メッセージハンドラ）の実行時間
+		HISTOGRAM			timer_time;		///< onTimer()の実行時間
+		HISTOGRAM			event_time;		///< onEvent()、onEventFD()の実行時間
+		HISTOGRAM			timer_late;		///< タイマがタイムアウトすべき時刻からの遅れ
+	} METRICS;
 
 	/**
-	 * @brief メッセージ受信時に呼び出される。
-	 * 
-	 * メッセージ受信時にやるべき処理があれば、本関数をオーバーライドします。
-	 * スレッドメッセージの解放（delete）はベースクラスで行います。
-	 * 本関数内で解放（delete）しないで下さい。
+	 * @brief 実行統計を取るか否かを設定する。
 	 * 
-	 * 尚、スレッド終了メッセージ（ CStopMsg::）は
-	 * ベースクラスで処理するため、本関数は呼び出されません。
+	 * start()実行前に呼び出して下さい。
+	 * 取らない場合の負担は、メッセージ毎のポインタの判定１回だけです。
+	 * 取る場合は、キューイングと各ハンドラの前後で時刻（CLOCK_MONOTONIC）を読みます。
 	 * 
-	 * @param	p_msg	スレッドメッセージのポインタ
+	 * @param	bool_metrics	真の場合は取る
 	 * @retval	0		正常
 	 * @retval	0以外	異常
 	 */
-	virtual int onMsg(CThreadMsg *p_msg)	{ return(ERR_OK); }
+	int  setMetrics(bool bool_metrics);
 
 	/**
-	 * @brief タイマを設定する。
+	 * @brief 実行統計を取得する。
 	 * 
-	 * @param	msec_elapsed_time	タイムアウトまでの経過時間（ミリ秒単位）
-	 * @param	timer_id			タイマID
-	 * @param	msec_period			周期（周期起動で使用／ミリ秒単位）
+	 * 他のスレッドからも、ロックを取らずに呼び出せます。
+	 * 各項目はそれぞれ正確ですが、項目間は同じ瞬間の値とは限りません。
+	 * 
+	 * @param	p_metrics	実行統計の格納先
 	 * @retval	0		正常
-	 * @retval	0以外	異常
+	 * @retval	0以外	異常（実行統計を取っていない）
 	 */
-	int  setTimer(int msec_elapsed_time, int timer_id=0, int msec_period=0)
-	{
-		return(m_TimerCBList.set(msec_elapsed_time, timer_id, msec_period));
-	}
+	int  getMetrics(METRICS *p_metrics);
 
 	/**
-	 * @brief タイマをキャンセルする。
+	 * @brief スレッド番号を指定して実行統計を取得する。
 	 * 
-	 * @param	timer_id	キャンセルするタイマID。-1であれば全てキャンセルする。
-	 * @retval	0			正常
-	 * @retval	0以外		異常
+	 * スレッド管理テーブルから引くので、ロックを取りません。
+	 * 
+	 * @param	thread_no	スレッド番号
+	 * @param	p_metrics	実行統計の格納先
+	 * @retval	0		正常
+	 * @retval	0以外	異常（未登録、破棄済み、実行統計を取っていない）
 	 */
-	int  cancelTimer(int timer_id=0)	// timer_id が (-1)であれば全キャンセル
-	{
-		return(m_TimerCBList.cancel(timer_id));
-	}
+	static int getMetrics(const int thread_no, METRICS *p_metrics);
+
+protected:
 
 	/**
 	 * @brief タイムアウト時に呼び出される。
@@ -568,6 +3218,20 @@ protected:
 	 */
 	virtual void onTimer(int timer_id)	{ return; }
 
+	/**
+	 * @brief 登録先スレッドのキューの水位が変化した時に呼び出される。
+	 *
+	 * addQueueListener()で登録した場合に、自スレッドで呼び出されます。
+	 * bool_high は通知を送った時点の状態です。通知が前後した場合、古い通知は捨てるので、
+	 * 最後の状態に揃います。同じ状態で続けて呼ばれることがあります。
+	 *
+	 * @param	p_thread	水位が変化したスレッド（削除されているかもしれないので識別にだけ使う）
+	 * @param	bool_high	高水位以上か否か
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	virtual int  onQueueWatermark(CThreadBase * /*p_thread*/, bool /*bool_high*/)	{ return(ERR_OK); }
+
 	/**
 	 * @brief 自スレッドにスレッド終了メッセージをキューイングする。
 	 * 
@@ -591,18 +3255,172 @@ protected:
 		return(m_FDs.remove(fd));
 	}
 
+	/**
+	 * @brief FD_SETSIZE 以上のファイルディスクリプタの登録を許すか否かを設定する。
+	 * 
+	 * デフォルトは許しません。（appendFD()が異常を返す）
+	 * fd_set で扱えないので、onEventFD()をオーバーライドして個別に処理する派生先だけが
+	 * 許可して下さい。エポールモードでのみ有効です。
+	 * 
+	 * @param	bool_enable	許すか否か
+	 * @retval	なし
+	 */
+	void setLargeFD(bool bool_enable)
+	{
+		m_FDs.setLargeFD(bool_enable);
+	}
+
 	// 登録したファイルディスクリプタにイベントが発生した時に呼び出す。
 	virtual int onEvent(fd_set *p_readfds, fd_set *p_writefds, fd_set *p_exceptfds)
 	{
 		return(ERR_OK);
 	}
 
+	/**
+	 * @brief エポールモードで、イベントが発生したファイルディスクリプタ毎に呼び出される。
+	 * 
+	 * デフォルトの実装は、イベントを fd_set に設定します。
+	 * 設定されたイベントは、まとめて onEvent()で通知されます。
+	 * FD_SETSIZE 以上のファイルディスクリプタは fd_set で扱えないので、
+	 * それを使用する場合は本関数をオーバーライドし、setLargeFD()で登録を許可してください。
+	 * （デフォルトの実装は、fd_set に設定できないものの監視をやめます）<BR>
+	 * 0以外を返すと、select()モードの onEvent()と同じく、その起床のイベント処理を打ち切ります。
+	 * 残りのイベントは次の待ちで改めて通知し、それまでに設定したイベントは onEvent()で通知します。
+	 * 
+	 * @param	fd				ファイルディスクリプタ
+	 * @param	bool_read		読み込み可
+	 * @param	bool_write		書き込み可
+	 * @param	bool_except		例外発生
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	virtual int onEventFD(int fd, bool bool_read, bool bool_write, bool bool_except)
+	{
+		if (m_FDs.setReady(fd, bool_read, bool_write, bool_except)) {
+			// 通知できないまま残すと、レベルトリガで起こされ続ける。他のイベントは処理を続ける。
+			removeFD(fd);
+		}
+		return(ERR_OK);
+	}
+
 	// 起動側との排他に使用する。
 	// 起動前後に一度だけ使用している。
 	// もったいないので、派生先でも使用可能とする。
 	pthread_mutex_t	m_mutex;
 
 private:
+	/**
+	 * @brief スレッドにメッセージをキューイングする。（内部用）
+	 * 
+	 * postMsg()と異なり、キューイングできなかった場合もメッセージを解放しません。
+	 * ERR_SYSTEM（通知の異常）の場合は、キューイング済みです。
+	 * 
+	 * @param	p_msg			スレッドメッセージのポインタ
+	 * @param	bool_high_prior	高優先（先頭にキューイング）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  putMsg(CThreadMsg *p_msg, bool bool_high_prior)
+	{
+		return(putMsgToLane(p_msg, bool_high_prior ? CThreadQueue::LANE_HIGH : CThreadQueue::LANE_NORMAL));
+	}
+
+	/// @brief メッセージハンドラ又は onMsg()を呼び出す。
+	int  invokeMsg(CThreadMsg *p_msg)
+	{
+		size_t type = p_msg->getMsgType();
+		if ((type < m_vec_p_handler.size()) && m_vec_p_handler[type]) {
+			return(m_vec_p_handler[type]->invoke(this, p_msg));
+		}
+		return(onMsg(p_msg));
+	}
+
+	/// @brief 実行時間を計ってメッセージを振り分ける。
+	int  dispatchMsgMetrics(CThreadMsg *p_msg);
+
+	/// @brief 実行統計の分布に加える。（自スレッドから呼び出す）
+	static void addSample(HISTOGRAM *p_histogram, long long nsec);
+
+	/// @brief 実行統計の分布を読む。
+	static void loadHistogram(const HISTOGRAM *p_src, HISTOGRAM *p_dst);
+
+	/// @brief レーンを指定してキューイングする。（内部用／異常時も削除しない）
+	int  putMsgToLane(CThreadMsg *p_msg, int lane);
+
+	/// @brief 待ち状態であれば通知して起こす。（自スレッドからは何もしない）
+	int  wakeup();
+
+	/// @brief 自スレッド（アクタの場合は処理中のワーカ）から呼ばれたか否か
+	bool isSelf() const;
+
+	/// @brief イベント待ちの準備をする。（通知用、タイマ用のファイルディスクリプタを登録）
+	void openReactor();
+
+	/// @brief １回分の処理をする。（終了メッセージを受信したら偽）
+	/// bool_block が偽の場合（アクタ）は待たずに、発生済みのイベントだけを処理する。
+	bool step(bool bool_block);
+
+	/// @brief 発生したイベントを処理する。
+	void dispatchEvents(int result);
+
+	/// @brief 終了処理をする。
+	void terminate();
+
+	/// @brief アクタを起動する。
+	int  startActor();
+
+	/// @brief アクタの処理をする。（ワーカから呼ばれる。終了したら偽）
+	bool runActor();
+
+	/// @brief アクタの処理を終える時に、続きがあれば起こされるようにする。
+	void park();
+
+	/// @brief 水位の変化を登録されたスレッドに送る。（CThreadQueue から呼ばれる）
+	static void notifyWatermark(void *vp_arg, bool bool_high);
+
+	/// @brief 水位通知メッセージを受信した。（メッセージハンドラ）
+	int  onQueueWatermarkMsg(CQueueWatermarkMsg *p_msg);
+
+#if __cplusplus >= 201103L
+	/// @brief タスクメッセージを実行する。（メッセージハンドラ）
+	int  onTaskMsg(CTaskMsg *p_msg);
+
+	/// @brief 要求をキューイングする。（できなければ、その異常で完了させる）
+	int  postCall(CFutureState *p_state, CThreadMsg *p_msg, bool bool_high_prior);
+
+	/// @brief 要求をタスクプールに投入する。（できなければ、その異常で完了させる）
+	int  postPoolCall(CTaskPool *p_pool, CFutureState *p_state, CTaskMsg *p_msg);
+
+	/// @brief 要求のタイムアウトを監視する。（タイマIDを返す）
+	int  setCallTimer(CFutureState *p_state, int msec_timeout);
+
+	/// @brief 要求のタイムアウトの監視を終了する。
+	void endCall(int timer_id);
+
+	/// @brief 要求がタイムアウトした。
+	void onCallTimeout(int timer_id);
+
+	/// @brief 完了時に要求元スレッドで実行する関数オブジェクト
+	template <class R, class CB>
+	struct CCallReply
+	{
+		CThreadBase*	m_p_thread;
+		int				m_timer_id;
+		CFuture<R>		m_future;
+		CB				m_on_reply;
+		void operator()() { m_p_thread->endCall(m_timer_id); m_on_reply(m_future); }
+	};
+
+	/// @brief 完了時の応答メッセージを設定する。
+	template <class R, class CB>
+	void setCallReply(CFutureStateT<R> *p_state, const CFuture<R>& future, CB&& on_reply, int msec_timeout)
+	{
+		int timer_id = (msec_timeout > 0) ? setCallTimer(p_state, msec_timeout) : 0;
+		CCallReply<R, typename std::decay<CB>::type> reply = { this, timer_id, future, std::forward<CB>(on_reply) };
+		p_state->setReply(this, new CTaskMsg(std::move(reply)));
+	}
+#endif
+
 	pthread_t		m_pthread;			///< スレッド識別子
 	pthread_t		m_pthread_copy;		///< スレッド識別子のコピー
 										// m_pthread は終了しても必要となる。
@@ -611,32 +3429,69 @@ private:
 	CThreadBase*	m_parent;			///< 親スレッド
 	pthread_attr_t	m_pthread_attr;		///< スレッド属性（pthread_createのパラメータ）
 	pthread_attr_t*	m_p_pthread_attr;	///< スレッド属性のポインタ
+	CThreadPlacement	m_placement;	///< スレッドの配置
+	bool			m_bool_abort;		///< 配置を適用できなかったので、起動直後に終了する
 
-	/// @brief パイプのファイルディスクリプタ
-	enum {
-		PIPE_READ	= 0,	///< 読み込み用
-		PIPE_WRITE	= 1,	///< 書き込み用
-		PIPE_SIZE	= 2		///< サイズ
-	};
-	int				m_pipe[PIPE_SIZE];	///< スレッド間通知用パイプ
+	CThreadNotifier	m_notifier;			///< スレッド間通知
+	int				m_waiting;			///< 待ち状態フラグ（真の時だけ通知する）
+
+	int					m_batch_size;	///< 一度に処理するメッセージ数
+	vector<CThreadMsg*>	m_vec_p_batch;	///< まとめて取り出したメッセージ
+	void*				m_vp_ret;		///< スレッド終了時の返り値
+
+	CActorScheduler*	m_p_scheduler;		///< アクタとして動かすスケジューラ
+	bool				m_bool_initiated;	///< アクタの onThreadInitiate()を呼び出した
+	bool				m_bool_finished;	///< アクタが終了した（スケジューラの m_mutex で排他）
+	int					m_actor_running;	///< アクタの持ち主の状態（ワーカ間の受け渡しを acquire／release で行う）
 
 	CFileDescriptor	m_FDs;				///< ファイルディスクリプタ
 
 	CThreadQueue	m_queue;			///< スレッドキュー
 
+	vector<CThreadBase*>	m_vec_p_listener;	///< 水位の変化を通知するスレッド
+	int						m_listener_busy;	///< 通知を送っている途中のスレッド数
+	unsigned long long		m_watermark_seq;	///< 水位通知の通し番号
+	pthread_mutex_t			m_listener_mutex;	///< ミューテック（上記の排他）
+	pthread_cond_t			m_listener_cond;	///< 通知を送り終えたことの待ち合わせ
+	map<CThreadBase*, unsigned long long>	m_map_watermark_seq;	///< 受け取った水位通知の最新の通し番号（自スレッドだけが使用）
+
 	CTimerCBList	m_TimerCBList;		///< タイマ制御ブロックリスト
+	CTimerHandle	m_timer_handle;		///< タイムアウトしたタイマのハンドル
+	unsigned long long	m_timer_fired;		///< タイムアウトしたタイマ数（自スレッドだけが更新）
+	unsigned long long	m_timer_wakeups;	///< タイムアウトを処理した起床の回数（同上）
+	unsigned long long	m_timer_internal;	///< タイムアウトした内部用タイマ数（同上）
+
+	METRICS*		m_p_metrics;		///< 実行統計（取らない場合は NULL／自スレッドだけが更新）
+
+	vector<CMsgHandler*>	m_vec_p_handler;	///< メッセージハンドラ（型IDで引く）
+
+	/// @brief 内部用タイマID（(-1)未満を内部用とする）
+	enum {
+		TIMER_ID_MSG	= -2,		///< postMsgAfter()、postMsgAt()
+		TIMER_ID_CALL	= -3		///< 要求のタイムアウト（これ以下を順に使う）
+	};
+
+	int								m_call_timer_id;	///< 次に使う要求のタイマID
+	map<int, CFutureState*>			m_map_p_call;		///< タイムアウト監視中の要求（タイマIDで引く）
 
 	// スレッドクラスのインスタンス管理
 	/*
 		スレッド番号が(-1)は管理対象外
+		登録したものは削除しない。（状態が STS_DESTROY になる）
+		参照と状態の変更はロックを取らず、新規の登録だけミューテックで排他する。
+		表を大きくした時の古い表は、参照中のスレッドがあるかもしれないので解放しない。
 	*/
-	static pthread_mutex_t	g_class_mutex;	///< インスタンス管理テーブルのミューテック
+	static pthread_mutex_t	g_class_mutex;	///< インスタンス管理テーブルのミューテック（登録のみ）
 	struct _ThreadCB {
-		int				thread_no;			///< スレッド番号
-		CThreadBase*	p_thread_base;		///< スレッドのポインタ
-		int				thread_status;		///< スレッド状態
+		int				thread_no;			///< スレッド番号（登録後は変えない）
+		CThreadBase*	p_thread_base;		///< スレッドのポインタ（登録後は変えない）
+		int				thread_status;		///< スレッド状態（アトミックに読み書きする）
 	};
-	static vector<_ThreadCB> g_vectorThreadCB;
+	struct _ThreadTable;						///< 管理テーブル（CThreadBase.cpp で定義）
+	static _ThreadTable*	g_p_thread_table;	///< 管理テーブル（ロックなしで参照する）
+
+	/// @brief スレッド番号で管理テーブルを引く。（未登録は NULL）
+	static _ThreadCB* findThreadCB(const int thread_no);
 
 	/**
 	 * @brief スレッド終了、スレッド終了待ち合わせ。
@@ -661,6 +3516,8 @@ private:
 	 */
 	int setInstanceInfo(const int thread_status) const;
 
+	friend class CActorScheduler;
+
 public:
 	/**
 	 * @brief スレッドのrun関数。
@@ -673,4 +3530,254 @@ public:
 	void* run();	// public じゃないとダメなので。直接呼ぶなよ。
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// アクタスケジューラクラス
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @class CActorScheduler CThreadBase.h
+ * @brief アクタスケジューラクラス
+ * 
+ * 多数の CThreadBase（アクタ）を、決まった数のワーカスレッドで動かします。<BR>
+ * アクタ毎のエポールは、メッセージの通知（eventfd）、タイマ（timerfd）、
+ * 派生クラスが登録したファイルディスクリプタを監視しているので、
+ * スケジューラはアクタのエポールを自分のエポールで監視し、
+ * イベントがあったアクタをワーカに処理させます。<BR>
+ * アクタは EPOLLONESHOT で登録し、処理が終わってから監視を再開するので、
+ * １つのアクタを同時に複数のワーカが処理することはありません。<BR>
+ * １回の処理では最大 setBatchSize()個のメッセージを処理し、
+ * 残りがあれば他のアクタの後に続きを処理します。<BR>
+ * <BR>
+ * 	CActorScheduler scheduler;<BR>
+ * 	scheduler.start(4);<BR>
+ * 	CMyThread actor;<BR>
+ * 	actor.setScheduler(&scheduler);<BR>
+ * 	actor.start();<BR>
+ * 	...<BR>
+ * 	actor.stop();<BR>
+ * 	scheduler.stop();<BR>
+ * <BR>
+ * スケジューラは、動作中のアクタより後に削除して下さい。
+ * 
+ */
+class CActorScheduler
+{
+public:
+	/// @brief コンストラクタ
+	CActorScheduler();
+
+	/// @brief デストラクタ（ワーカが動いていれば止める）
+	virtual ~CActorScheduler();
+
+	/**
+	 * @brief ワーカスレッドを起動する。
+	 * 
+	 * アクタの start()はこの前でも構いません。（ワーカが起動してから処理します）
+	 * 
+	 * @param	workers			ワーカスレッド数（１以上）
+	 * @param	p_pthread_attr	スレッド属性（pthread_createのパラメータ）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  start(int workers, pthread_attr_t *p_pthread_attr=NULL);
+
+	/**
+	 * @brief ワーカスレッドを終了する。
+	 * 
+	 * 処理中のアクタの処理が終わってから終了します。
+	 * 動作中のアクタは止めないので、先にアクタを stop()して下さい。
+	 * 
+	 * @param	なし
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  stop();
+
+	/**
+	 * @brief ワーカスレッド数を返す。
+	 * 
+	 * @param	なし
+	 * @retval	ワーカスレッド数
+	 */
+	int  getWorkers() const { return(static_cast<int>(m_vec_worker.size())); }
+
+	/**
+	 * @brief 動作中のアクタ数を返す。
+	 * 
+	 * @param	なし
+	 * @retval	アクタ数
+	 */
+	int  getActors() const { return(__atomic_load_n(&m_actors, __ATOMIC_RELAXED)); }
+
+private:
+	friend class CThreadBase;
+
+	/// @brief アクタの持ち主の状態（CThreadBase::m_actor_running）
+	enum {
+		ACTOR_IDLE		= 0,	///< 誰も持っていない（次に通知されたワーカが受け取る）
+		ACTOR_RUNNING	= 1,	///< ワーカ（又は起動側）が持っている
+		ACTOR_PENDING	= 2		///< 持っている間に通知された（持ち主が続けて処理する）
+	};
+
+	/// @brief 通知されたアクタを受け取る。（偽は持ち主に任せた）
+	static bool acquire(CThreadBase *p_actor);
+
+	/// @brief アクタを手放す。（偽は手放す前に通知されたので、続けて持つ）
+	static bool release(CThreadBase *p_actor);
+
+	/// @brief アクタを登録する。（最初の処理を予約する）
+	int  attach(CThreadBase *p_actor);
+
+	/// @brief アクタの登録を外す。（アクタの終了処理の前に、処理中のワーカから呼ぶ）
+	void detach(CThreadBase *p_actor);
+
+	/// @brief アクタが終了したことを知らせる。（以降、アクタに触らない）
+	void finish(CThreadBase *p_actor);
+
+	/// @brief アクタの終了を待つ。
+	void join(CThreadBase *p_actor);
+
+	/// @brief ワーカスレッドのスタートルーチン
+	static void* worker_routine(void *vp_arg);
+
+	/// @brief ワーカスレッドの処理
+	void work();
+
+	int					m_epfd;			///< アクタのエポールを監視するエポール
+	int					m_stop_fd;		///< ワーカを止める通知（eventfd）
+	vector<pthread_t>	m_vec_worker;	///< ワーカスレッド
+	int					m_actors;		///< 動作中のアクタ数
+	pthread_mutex_t		m_mutex;		///< ミューテック（アクタの終了の待ち合わせ）
+	pthread_cond_t		m_cond;			///< 条件変数（同上）
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// タスクプールクラス
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @class CTaskPool CThreadBase.h
+ * @brief タスクプールクラス（ワークスティーリング）
+ * 
+ * 重い計算処理（受信データの解析、ログの圧縮等）を、スレッドのループを止めずに
+ * 複数のワーカスレッドで並行して実行します。<BR>
+ * 完了はタスクを投入したスレッドにメッセージで届くので、
+ * スレッドの処理が並行して動くことはありません。<BR>
+ * ワーカ毎に両頭待ち行列（Chase-Lev）を持ち、ワーカ内から投入したタスク（分割等）は
+ * 自分の待ち行列の末尾に積んで末尾から取り出します。（キャッシュに残っているものから）
+ * 空になったワーカは、他のワーカの待ち行列の先頭から盗みます。<BR>
+ * ワーカ外（スレッド）から投入したタスクは、共有の待ち行列に入れます。<BR>
+ * <BR>
+ * 	CTaskPool pool;<BR>
+ * 	pool.start(4);<BR>
+ * 	thread.submitTask(&pool, new CParseTask(...));	// thread 内から<BR>
+ * 	...<BR>
+ * 	pool.stop();<BR>
+ * 
+ */
+class CTaskPool
+{
+public:
+	/// @brief 統計情報
+	struct STATS {
+		unsigned long long	executed;	///< 実行したタスク数
+		unsigned long long	stolen;		///< 他のワーカから盗んだタスク数
+	};
+
+	/// @brief コンストラクタ
+	CTaskPool();
+
+	/// @brief デストラクタ（ワーカが動いていれば止める）
+	virtual ~CTaskPool();
+
+	/**
+	 * @brief ワーカスレッドを起動する。
+	 * 
+	 * @param	workers			ワーカスレッド数（１以上）
+	 * @param	p_pthread_attr	スレッド属性（pthread_createのパラメータ）
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  start(int workers, pthread_attr_t *p_pthread_attr=NULL);
+
+	/**
+	 * @brief ワーカスレッドを終了する。
+	 * 
+	 * 投入済みのタスクを全て実行してから終了します。
+	 * 
+	 * @param	なし
+	 * @retval	0		正常
+	 * @retval	0以外	異常
+	 */
+	int  stop();
+
+	/**
+	 * @brief タスクを投入する。
+	 * 
+	 * 通常は CThreadBase::submitTask()を使って下さい。
+	 * ワーカスレッドで runTask()を呼び出した後、p_reply_thread にキューイングします。
+	 * （p_reply_thread が NULL の場合は削除します）
+	 * ワーカスレッド内から投入したタスクは、そのワーカの待ち行列に積みます。
+	 * 
+	 * @param	p_task			タスクのポインタ
+	 * @param	p_reply_thread	完了を受け取るスレッド
+	 * @retval	0		正常
+	 * @retval	0以外	異常（タスクは削除しない）
+	 */
+	int  submit(CPoolTask *p_task, CThreadBase *p_reply_thread);
+
+	/**
+	 * @brief ワーカスレッド数を返す。
+	 * 
+	 * @param	なし
+	 * @retval	ワーカスレッド数
+	 */
+	int  getWorkers() const { return(static_cast<int>(m_vec_p_worker.size())); }
+
+	/**
+	 * @brief 統計情報を取得する。
+	 * 
+	 * @param	p_stats		統計情報の格納先
+	 * @retval	なし
+	 */
+	void getStats(STATS *p_stats) const;
+
+private:
+	CTaskPool(const CTaskPool&);
+	CTaskPool& operator=(const CTaskPool&);
+
+	friend class CThreadBase;
+
+	struct CWorker;		///< ワーカ（CThreadBase.cpp で定義）
+
+	/// @brief メッセージを投入する。
+	int  push(CThreadMsg *p_msg);
+
+	/// @brief 実行するメッセージを探す。（自分、共有、他のワーカの順）
+	CThreadMsg* find(CWorker *p_worker);
+
+	/// @brief メッセージを実行する。
+	void execute(CThreadMsg *p_msg);
+
+	/// @brief ワーカスレッドのスタートルーチン
+	static void* worker_routine(void *vp_arg);
+
+	/// @brief ワーカスレッドの処理
+	void work(CWorker *p_worker);
+
+	/// @brief 先頭から workers 個のワーカスレッドを止めて、全てのワーカを削除する。
+	void shutdown(size_t workers);
+
+	vector<CWorker*>	m_vec_p_worker;		///< ワーカ
+	deque<CThreadMsg*>	m_deq_p_inject;		///< 共有の待ち行列（ワーカ外から投入）
+	pthread_mutex_t		m_inject_mutex;		///< ミューテック（上記の排他）
+	int					m_pending;			///< 未実行のタスク数
+	int					m_sleepers;			///< 待ち状態のワーカ数
+	bool				m_bool_stop;		///< 終了要求
+	bool				m_bool_running;		///< 投入を受け付ける
+	pthread_mutex_t		m_mutex;			///< ミューテック（ワーカの待ち合わせ）
+	pthread_cond_t		m_cond;				///< 条件変数（同上）
+	STATS				m_stats;			///< 削除したワーカの統計情報
+};
+
 #endif
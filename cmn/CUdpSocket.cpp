@@ -35,7 +35,7 @@ void CUdpSocket::onThreadTerminate()
 
 int CUdpSocket::onMsg(CThreadMsg *p_msg)
 {
-	if (CUdpSocketSendMsg* pUdpSocketSendMsg = dynamic_cast<CUdpSocketSendMsg*>(p_msg)) {
+	if (CUdpSocketSendMsg* pUdpSocketSendMsg = msg_cast<CUdpSocketSendMsg>(p_msg)) {
 		sendTo(	pUdpSocketSendMsg->p_data,
 				pUdpSocketSendMsg->data_len,
 				pUdpSocketSendMsg->str_peer_addr,
@@ -81,16 +81,17 @@ public:
 };
 
 // 送信メッセージ（要求元 -> ＵＤＰソケットクラス）
-class CUdpSocketSendMsg : public CUdpSocketMsg
+class CUdpSocketSendMsg : public CThreadMsgT<CUdpSocketSendMsg, CUdpSocketMsg>
 {
 public:
 	int		data_len;
 	char	*p_data;
 
 	CUdpSocketSendMsg(int _data_len=0, const void *_vp_data=NULL, string _str_peer_addr="", uint16_t _peer_port=0)
-	: CUdpSocketMsg(_str_peer_addr, _peer_port)
+	: CThreadMsgT<CUdpSocketSendMsg, CUdpSocketMsg>(_str_peer_addr, _peer_port)
 	, data_len(_data_len)
 	, p_data(NULL)
+	, m_bool_moved(false)
 	{
 		if (data_len > 0) {
 			p_data = new char[data_len];
@@ -99,12 +100,42 @@ public:
 			}
 		}
 	};
+#if __cplusplus >= 201103L
+	// バッファをムーブで受け取る（コピーしない）
+	CUdpSocketSendMsg(vector<char>&& _vec_data, string _str_peer_addr, uint16_t _peer_port)
+	: CThreadMsgT<CUdpSocketSendMsg, CUdpSocketMsg>(_str_peer_addr, _peer_port)
+	, data_len(static_cast<int>(_vec_data.size()))
+	, p_data(NULL)
+	, m_bool_moved(true)
+	, m_vec_data(std::move(_vec_data))
+	{
+		if (data_len > 0) {
+			p_data = m_vec_data.data();
+		}
+	};
+	CUdpSocketSendMsg(string&& _str_data, string _str_peer_addr, uint16_t _peer_port)
+	: CThreadMsgT<CUdpSocketSendMsg, CUdpSocketMsg>(_str_peer_addr, _peer_port)
+	, data_len(static_cast<int>(_str_data.size()))
+	, p_data(NULL)
+	, m_bool_moved(true)
+	, m_str_data(std::move(_str_data))
+	{
+		if (data_len > 0) {
+			p_data = &m_str_data[0];
+		}
+	};
+#endif
 	virtual ~CUdpSocketSendMsg()
 	{
-		if (p_data) {
+		if (p_data && !m_bool_moved) {
 			delete [] p_data;
 		}
 	};
+
+private:
+	bool			m_bool_moved;	// ムーブで受け取ったバッファ（下記）を使用中
+	vector<char>	m_vec_data;
+	string			m_str_data;
 };
 
 // 通知メッセージのベース
@@ -123,14 +154,14 @@ public:
 };
 
 // 受信メッセージ（ＵＤＰソケットクラス -> 通知先）
-class CUdpSocketReceiveMsg : public CUdpSocketNoticeMsg
+class CUdpSocketReceiveMsg : public CThreadMsgT<CUdpSocketReceiveMsg, CUdpSocketNoticeMsg>
 {
 public:
 	int		data_len;
 	char	*p_data;
 
 	CUdpSocketReceiveMsg(int _data_len=0, const char *_p_data=NULL, string _str_peer_addr="", uint16_t _peer_port=0)
-	: CUdpSocketNoticeMsg(_str_peer_addr, _peer_port)
+	: CThreadMsgT<CUdpSocketReceiveMsg, CUdpSocketNoticeMsg>(_str_peer_addr, _peer_port)
 	, data_len(_data_len)
 	, p_data(NULL)
 	{
@@ -151,14 +182,14 @@ public:
 
 // エラーメッセージ（ＵＤＰソケットクラス -> 通知先）
 // エラーによっては、相手アドレスと相手ポートが設定されないこともあります。
-class CUdpSocketErrorMsg : public CUdpSocketNoticeMsg
+class CUdpSocketErrorMsg : public CThreadMsgT<CUdpSocketErrorMsg, CUdpSocketNoticeMsg>
 {
 public:
 	int	error;
 	int	_errno;	// アンダーバー付けないとエラーになる！
 
 	CUdpSocketErrorMsg(string _str_peer_addr="", uint16_t _peer_port=0)
-	: CUdpSocketNoticeMsg(_str_peer_addr, _peer_port)
+	: CThreadMsgT<CUdpSocketErrorMsg, CUdpSocketNoticeMsg>(_str_peer_addr, _peer_port)
 	, error(EGUDP_ERR::OK)
 	, _errno(0)
 	{};
@@ -244,6 +275,23 @@ public:
 		int ret = postMsg(pUdpSocketSendMsg);
 		return(ret);
 	};
+#if __cplusplus >= 201103L
+	// データ送信要求（バッファをムーブで渡す。コピーしない）
+	int Send(vector<char>&& vec_data, string str_peer_addr, uint16_t peer_port)
+	{
+		if (vec_data.empty() || (str_peer_addr == "") || (peer_port == 0)) {
+			return(ERR_PARAM);
+		}
+		return(emplaceMsg<CUdpSocketSendMsg>(std::move(vec_data), str_peer_addr, peer_port));
+	};
+	int Send(string&& str_data, string str_peer_addr, uint16_t peer_port)
+	{
+		if (str_data.empty() || (str_peer_addr == "") || (peer_port == 0)) {
+			return(ERR_PARAM);
+		}
+		return(emplaceMsg<CUdpSocketSendMsg>(std::move(str_data), str_peer_addr, peer_port));
+	};
+#endif
 
 protected:
 	/*
@@ -0,0 +1,307 @@
+﻿//
+// benchmark program
+//
+// スレッドベースクラスの性能測定用です。
+// 引数なしで全項目を測定します。
+//
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <iostream>
+#include <string>
+#include "CThreadBase.h"
+#include "CTimeVal.h"
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+// スレッドキューの競合（ミューテック方式とロックフリー方式の比較）
+////////////////////////////////////////////////////////////////////////////////
+
+class CBenchMsg : public CThreadMsg
+{
+public:
+	CBenchMsg() {};
+	virtual ~CBenchMsg() {};
+};
+
+// 受信側：受信数を数えるだけ
+class CBenchConsumer : public CThreadBase
+{
+public:
+	CBenchConsumer() : m_count(0) {};
+	virtual ~CBenchConsumer() {};
+
+	long getCount() { return(__atomic_load_n(&m_count, __ATOMIC_ACQUIRE)); };
+
+protected:
+	virtual int onMsg(CThreadMsg * /*p_msg*/)
+	{
+		__atomic_store_n(&m_count, m_count + 1, __ATOMIC_RELEASE);
+		return(ERR_OK);
+	};
+
+private:
+	long	m_count;
+};
+
+// 送信側（pthread）
+// window が 0 以外の場合、未処理のメッセージが概ね window 個を超えないよう待つ。
+struct BENCH_PRODUCER {
+	CBenchConsumer*	p_target;
+	int				count;
+	int				producers;
+	int				window;
+};
+
+static void* producer_routine(void* arg)
+{
+	BENCH_PRODUCER* p = reinterpret_cast<BENCH_PRODUCER*>(arg);
+	for (int i = 0; i < p->count; i++) {
+		if (p->window) {
+			while ((static_cast<long>(i) * p->producers) - p->p_target->getCount() > p->window) {
+				sched_yield();
+			}
+		}
+		p->p_target->postMsg(new CBenchMsg);
+	}
+	return(NULL);
+}
+
+static double bench_queue(CThreadQueue::MODE mode, int producers, int count, int window=0)
+{
+	CBenchConsumer consumer;
+	consumer.setQueueMode(mode);
+	consumer.start();
+
+	vector<pthread_t>		threads(producers);
+	vector<BENCH_PRODUCER>	params(producers);
+	CTimeVal begin(CTimeVal::CURRENT);
+	for (int i = 0; i < producers; i++) {
+		params[i].p_target	= &consumer;
+		params[i].count		= count;
+		params[i].producers	= producers;
+		params[i].window	= window;
+		pthread_create(&threads[i], NULL, producer_routine, &params[i]);
+	}
+	for (int i = 0; i < producers; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	while (consumer.getCount() < static_cast<long>(producers) * count) {
+		sched_yield();
+	}
+	CTimeVal end(CTimeVal::CURRENT);
+	consumer.stop();
+
+	CTimeVal span = end.getSpan(begin);
+	double sec = span.tv_sec + (span.tv_usec / 1000000.0);
+	return((producers * count) / sec);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// タイマの処理量（仮想時計で時刻を進めるので、実際には待たない）
+////////////////////////////////////////////////////////////////////////////////
+
+static double span_sec(const CTimeVal& begin)
+{
+	CTimeVal end(CTimeVal::CURRENT);
+	CTimeVal span = end.getSpan(begin);
+	return(span.tv_sec + (span.tv_usec / 1000000.0));
+}
+
+// timers 個のタイマを 1〜60秒後に設定し、半分をハンドルでキャンセルして、
+// 残りがタイムアウトするまで時計を１ミリ秒ずつ進める。
+// 時計を進める（リストを起こす）処理と、タイムアウトの取り出し（timeout()）は分けて測る。
+static void bench_timer(int timers)
+{
+	CVirtualClock clock;
+	CTimerCBList list;
+	list.setClock(&clock);
+	vector<CTimerHandle> handles(timers);
+	srand(1);
+
+	CTimeVal begin(CTimeVal::CURRENT);
+	for (int i = 0; i < timers; i++) {
+		list.set(1 + (rand() % 60000), 0, 0, &handles[i]);
+	}
+	double set_sec = span_sec(begin);
+
+	CTimeVal begin_cancel(CTimeVal::CURRENT);
+	for (int i = 0; i < timers; i += 2) {
+		list.cancel(handles[i]);
+	}
+	double cancel_sec = span_sec(begin_cancel);
+
+	const int TICKS = 60001;
+	CTimeVal begin_tick(CTimeVal::CURRENT);
+	int fired = 0;
+	long long nsec_timeout = 0;
+	for (int msec = 0; msec < TICKS; msec++) {
+		clock.advance(1000000);
+		long long nsec_begin = CTimerCBList::getTime();
+		while (list.timeout()) {
+			fired++;
+		}
+		nsec_timeout += CTimerCBList::getTime() - nsec_begin;
+	}
+	double tick_sec = span_sec(begin_tick);
+	double fire_sec = nsec_timeout / 1000000000.0;
+
+	printf("%d		%.0f	%.0f	%.0f	%.0f	(%d fired, 60s simulated in %.3fs)\n", timers,
+		timers / set_sec, (timers / 2) / cancel_sec, TICKS / tick_sec, fired / fire_sec, fired, tick_sec);
+}
+
+// １秒周期と３０分周期のタイマを timers 個ずつ設定し、
+// 時計を１秒ずつ進めて１０時間分を動かす。
+static void bench_timer_periodic(int timers)
+{
+	const long long STEP_NSEC = 1000000000LL;
+	const long long HOURS     = 10;
+	CVirtualClock clock;
+	CTimerCBList list;
+	list.setClock(&clock);
+	for (int i = 0; i < timers; i++) {
+		list.set(1000, 0, 1000);
+		list.set(30 * 60 * 1000, 1, 30 * 60 * 1000);
+	}
+
+	CTimeVal begin(CTimeVal::CURRENT);
+	long long fired = 0;
+	long long steps = (HOURS * 3600 * 1000000000LL) / STEP_NSEC;
+	for (long long i = 0; i < steps; i++) {
+		clock.advance(STEP_NSEC);
+		while (list.timeout()) {
+			fired++;
+		}
+	}
+	double sec = span_sec(begin);
+	printf("%d + %d	%lldh simulated in %.3fs	(%lld fired, %.0f fired/sec)\n",
+		timers, timers, HOURS, sec, fired, fired / sec);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ピンポン（スレッドとアクタの比較）
+////////////////////////////////////////////////////////////////////////////////
+
+class CPingMsg : public CThreadMsgT<CPingMsg>
+{
+public:
+	CPingMsg(int count) : m_count(count) {};
+	virtual ~CPingMsg() {};
+	int		m_count;	///< 残りの往復数
+};
+
+// 受け取ったら、残りがあれば相手に送り返す。
+class CPingPong : public CThreadBase
+{
+public:
+	CPingPong() : m_p_peer(NULL), m_p_done(NULL)
+	{
+		setMsgHandler(&CPingPong::onPing);
+	};
+	virtual ~CPingPong() {};
+
+	CPingPong*	m_p_peer;
+	int*		m_p_done;	///< 終わった組の数
+
+protected:
+	int onPing(CPingMsg *p_msg)
+	{
+		if (p_msg->m_count > 0) {
+			m_p_peer->postMsg(new CPingMsg(p_msg->m_count - 1));
+		} else {
+			__atomic_add_fetch(m_p_done, 1, __ATOMIC_RELEASE);
+		}
+		return(ERR_OK);
+	};
+};
+
+// pairs 組で rounds 回ずつ送り合う。workers が 0 以外ならアクタで動かす。
+static double bench_pingpong(int pairs, int rounds, int workers)
+{
+	CActorScheduler scheduler;
+	if (workers) {
+		scheduler.start(workers);
+	}
+	int done = 0;
+	vector<CPingPong*> vec_p_actor(pairs * 2);
+	for (int i = 0; i < pairs * 2; i++) {
+		vec_p_actor[i] = new CPingPong;
+	}
+	for (int i = 0; i < pairs * 2; i++) {
+		vec_p_actor[i]->m_p_peer = vec_p_actor[i ^ 1];
+		vec_p_actor[i]->m_p_done = &done;
+		if (workers) {
+			vec_p_actor[i]->setScheduler(&scheduler);
+		}
+		vec_p_actor[i]->start();
+	}
+	CTimeVal begin(CTimeVal::CURRENT);
+	for (int i = 0; i < pairs * 2; i += 2) {
+		vec_p_actor[i]->postMsg(new CPingMsg(rounds));
+	}
+	while (__atomic_load_n(&done, __ATOMIC_ACQUIRE) < pairs) {
+		usleep(1000);
+	}
+	double sec = span_sec(begin);
+	for (int i = 0; i < pairs * 2; i++) {
+		delete vec_p_actor[i];
+	}
+	return((static_cast<double>(pairs) * rounds) / sec);
+}
+
+int main(int /*argc*/, char* /*argv*/[]) {
+	const int COUNT = 200000;	// 送信側１つあたりのメッセージ数
+	const int PRODUCERS[] = { 1, 2, 4, 8 };
+
+	cout << "queue contention (messages/sec)" << endl;
+	cout << "producers\tmutex\t\tlock-free" << endl;
+	for (size_t i = 0; i < sizeof(PRODUCERS) / sizeof(PRODUCERS[0]); i++) {
+		double mutex    = bench_queue(CThreadQueue::MODE_MUTEX,    PRODUCERS[i], COUNT);
+		double lockfree = bench_queue(CThreadQueue::MODE_LOCKFREE, PRODUCERS[i], COUNT);
+		printf("%d\t\t%.0f\t%.0f\n", PRODUCERS[i], mutex, lockfree);
+	}
+
+	// 送信が受信を大きく上回らない定常状態では、メッセージの領域が再利用される。
+	// （CTB_NO_MSG_POOL を定義してビルドしたものと比較する）
+	const int WINDOW = 256;
+	CThreadMsgPool::STATS before, after;
+	cout << endl << "steady state, window " << WINDOW << " (messages/sec)" << endl;
+	cout << "producers\tlock-free\tpool hit\tpool miss" << endl;
+	for (size_t i = 0; i < sizeof(PRODUCERS) / sizeof(PRODUCERS[0]); i++) {
+		CThreadMsgPool::getStats(&before);
+		double lockfree = bench_queue(CThreadQueue::MODE_LOCKFREE, PRODUCERS[i], COUNT, WINDOW);
+		CThreadMsgPool::getStats(&after);
+		printf("%d\t\t%.0f\t%llu\t\t%llu\n", PRODUCERS[i], lockfree,
+			after.hit - before.hit, after.miss - before.miss);
+	}
+
+	const int TIMERS[] = { 1000, 10000, 100000, 1000000 };
+	cout << endl << "timer wheel, virtual clock (operations/sec)" << endl;
+	cout << "timers		set		cancel		tick		fire" << endl;
+	for (size_t i = 0; i < sizeof(TIMERS) / sizeof(TIMERS[0]); i++) {
+		bench_timer(TIMERS[i]);
+	}
+
+	const int PERIODIC[] = { 1, 100 };
+	cout << endl << "periodic timers (1s + 30min), virtual clock in 1s steps" << endl;
+	for (size_t i = 0; i < sizeof(PERIODIC) / sizeof(PERIODIC[0]); i++) {
+		bench_timer_periodic(PERIODIC[i]);
+	}
+
+	const int PAIRS[] = { 1, 16, 256 };
+	const int WORKERS = 4;
+	cout << endl << "ping-pong, threads vs " << WORKERS << " actor workers (messages/sec)" << endl;
+	cout << "pairs		threads		actors" << endl;
+	for (size_t i = 0; i < sizeof(PAIRS) / sizeof(PAIRS[0]); i++) {
+		int rounds = 200000 / PAIRS[i];
+		double threads = bench_pingpong(PAIRS[i], rounds, 0);
+		double actors  = bench_pingpong(PAIRS[i], rounds, WORKERS);
+		printf("%d		%.0f	%.0f\n", PAIRS[i], threads, actors);
+	}
+	return 0;
+}
@@ -37,21 +37,20 @@ void CTcpEcho::onThreadTerminate()
 	}
 }
 
-int CTcpEcho::onMsg(CThreadMsg *p_msg)
+int CTcpEcho::onReceiveMsg(CTcpSocketReceiveMsg *pTcpSocketReceiveMsg)
 {
-	if (CTcpSocketReceiveMsg* pTcpSocketReceiveMsg = dynamic_cast<CTcpSocketReceiveMsg*>(p_msg)) {
-		pTcpSocketReceiveMsg->pTcpSocket->Send(pTcpSocketReceiveMsg->p_data, pTcpSocketReceiveMsg->data_len);
-//		cout << "data receive: " << pTcpSocketReceiveMsg->data_len << " bytes" << endl;
-		return(ERR_OK);
-	}
-	if (CTcpSocketChangeStatusMsg* pTcpSocketChangeStatusMsg = dynamic_cast<CTcpSocketChangeStatusMsg*>(p_msg)) {
-		int i = pTcpSocketChangeStatusMsg->pTcpSocket->get_thread_no();
-		if (pTcpSocketChangeStatusMsg->new_status == EGSOCK_STS::DISCONNECT) {
-			LT_MSG(m_LogHandle, (m_StrAid.Format("disconnect.(%d)", i)).c_str(), 0);
-		} else {
-			LT_MSG(m_LogHandle, (m_StrAid.Format(   "connect.(%d)", i)).c_str(), 0);
-		}
-		return(ERR_OK);
+	pTcpSocketReceiveMsg->pTcpSocket->Send(pTcpSocketReceiveMsg->p_data, pTcpSocketReceiveMsg->data_len);
+//	cout << "data receive: " << pTcpSocketReceiveMsg->data_len << " bytes" << endl;
+	return(ERR_OK);
+}
+
+int CTcpEcho::onChangeStatusMsg(CTcpSocketChangeStatusMsg *pTcpSocketChangeStatusMsg)
+{
+	int i = pTcpSocketChangeStatusMsg->pTcpSocket->get_thread_no();
+	if (pTcpSocketChangeStatusMsg->new_status == EGSOCK_STS::DISCONNECT) {
+		LT_MSG(m_LogHandle, (m_StrAid.Format("disconnect.(%d)", i)).c_str(), 0);
+	} else {
+		LT_MSG(m_LogHandle, (m_StrAid.Format(   "connect.(%d)", i)).c_str(), 0);
 	}
 	return(ERR_OK);
 }
@@ -34,6 +34,8 @@ public:
 	CTcpEcho(uint16_t port=0)
 	: CTcpListener(port)
 	{
+		setMsgHandler(&CTcpEcho::onReceiveMsg);
+		setMsgHandler(&CTcpEcho::onChangeStatusMsg);
 	};
 
 	virtual ~CTcpEcho()
@@ -43,9 +45,11 @@ public:
 protected:
 	virtual int  onThreadInitiate();
 	virtual void onThreadTerminate();
-	virtual int  onMsg(CThreadMsg *p_msg);
 	virtual int  onConnect(int connectFD, struct sockaddr_in &client_addr);
 
+	int  onReceiveMsg(CTcpSocketReceiveMsg *pTcpSocketReceiveMsg);
+	int  onChangeStatusMsg(CTcpSocketChangeStatusMsg *pTcpSocketChangeStatusMsg);
+
 private:
 	CTcpSocket	m_TcpSocket[EGSOCK_ECHO::MAX_PORT];
 	CLogHandle	m_LogHandle;